@@ -2,11 +2,52 @@
 #define ALMGR_H
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /********************************************************************************
- * ALMgr - Access List manager, basically reads from a text document to find the
- *         IP address given. If it's a whitelist, then returns true for allowed
- *         if found and opposite for blacklists
+ * CIDRTrie - binary trie of IPv4 prefixes (one level per address bit, most
+ *            significant first). An address matches if any prefix on its path
+ *            was inserted, so a lookup is at most 32 steps no matter how long
+ *            the list is. Addresses are in host byte order.
+ ********************************************************************************/
+
+class CIDRTrie {
+	public:
+	CIDRTrie();
+	
+	void insert(uint32_t prefix, unsigned int len);
+	bool contains(uint32_t addr) const;
+	
+	size_t size() const { return _count; };
+	
+	private:
+	struct node {
+		uint32_t child[2] = {0, 0};   // Index into _nodes, 0 = none (the root is never a child)
+		bool terminal = false;
+	};
+	
+	std::vector<node> _nodes;
+	size_t _count = 0;
+};
+
+/********************************************************************************
+ * ALMgr - Access List manager, reads a text document of IP addresses or CIDR
+ *         ranges ("10.1.0.0/16"), one per line ('#' starts a comment). If it's
+ *         a whitelist, then returns true for allowed if found and opposite for
+ *         blacklists.
+ *
+ *         The file is parsed once into a CIDRTrie. isAllowed glances at the
+ *         file's modification time (at most once a second) and, if it changed,
+ *         builds a new trie and swaps it in. Lookups only take an atomic copy
+ *         of the current trie's shared_ptr, so they never wait on a reload, and
+ *         a replaced trie is freed as soon as the last lookup using it is done.
  ********************************************************************************/
 
 class ALMgr {
@@ -17,10 +58,26 @@ class ALMgr {
 	bool isAllowed(const char *ipaddr);
 	bool isAllowed(unsigned long ipaddr);
 	
+	// Re-reads the file now if it changed. Returns true if a new list was loaded
+	bool refresh();
+	
 	private:
+	bool load();
+	
+	// Notes the file's size and time as loaded, unless it was modified this second and may
+	// still be mid-edit (then it's loaded again on the next check)
+	void markLoaded(const struct stat &sbuf);
+	
 	std::string _al_file;
 	
 	bool _is_whitelist;
+	
+	std::shared_ptr<const CIDRTrie> _trie;   // Only touched through std::atomic_load/store
+	
+	std::mutex _reload_mutex;
+	std::atomic<time_t> _last_check;
+	time_t _mtime = 0;
+	off_t _fsize = 0;
 };
 
 #endif // ALMGR_H
@@ -1,25 +1,45 @@
 #ifndef ANTENNASIM_H
 #define ANTENNASIM_H
 
-#include <list>
+#include <vector>
+#include <string>
+#include <atomic>
 #include <unistd.h>
 #include "exceptions.h"
 #include "DronePlotDB.h"
+#include "SimClock.h"
 
-// Simulates an antenna receiving drone information and populates the DronePlotDB class as it "receives"
-// information. 
+class Counter;
+
+// Simulates the antennas a node fronts receiving drone information and populates the DronePlotDB
+// class as they "receive" information. Each antenna is a feed--loaded from a binary plot file or
+// generated--whose injects are sorted into one contiguous array up front. simulate() runs every
+// feed on its own thread, all adding to the database at once, each taking the lock once per
+// batch of injects that came due together. How long those adds take (lock waits included) is
+// published as repl_antenna_ingest_seconds, so ingest contention shows up in the metrics.
 //
 // Students should not change anything with this class
 
 class AntennaSim {
 	public:
-	AntennaSim(DronePlotDB &dpdb, const char *source_filename, float time_mult, int verbosity);
+	// Real seconds between starting the clock and the first inject, to let the servers come
+	// online. Start the clock with this much lead so sim time zero is when the injects begin
+	static const unsigned int startup_delay = 3;
+	
+	AntennaSim(DronePlotDB &dpdb, SimClock &clock, int verbosity);
+	AntennaSim(DronePlotDB &dpdb, const char *source_filename, SimClock &clock, int verbosity);
 	virtual ~AntennaSim();
 	
-	// Load the data that will be fed to the accessible DB to simulate drone updates
+	// Load the data that will be fed to the accessible DB to simulate drone updates, as one more feed
 	void loadSourceDB(const char *filename);
 	
-	// Run the simulation (usually in a thread)
+	// Adds a feed of made-up traffic: drones wandering around, each seen rate times a sim second
+	// by node_id for duration sim seconds. Each feed gets its own drone IDs
+	void addGeneratedFeed(unsigned int node_id, unsigned int drones, double rate, unsigned int duration);
+	
+	size_t numFeeds() { return _feeds.size(); };
+	
+	// Run the simulation (usually in a thread), returning once every feed is done
 	void simulate();
 	
 	// Terminate the simulation (and probably exit the thread)
@@ -30,19 +50,32 @@ class AntennaSim {
 	
 	private:
 	
+	// One antenna: its injects in time order
+	struct antenna_feed {
+		std::string name;
+		std::vector<DronePlot> injects;
+		Counter *injected;
+	};
+	
+	void addFeed(const std::string &name, std::vector<DronePlot> &&injects);
+	
+	// Feeds one antenna's injects to the database as their time arrives (runs on its own thread)
+	void runFeed(antenna_feed &feed);
+	
+	// Sim seconds since the injects started (the shared clock's epoch)
 	double getAdjustedTime();
 	
 	// Simulation checks periodically to know when to exit the thread
-	bool _exiting;
+	std::atomic<bool> _exiting;
 	
 	DronePlotDB &_to_db;
-	DronePlotDB _source_db;
+	std::vector<antenna_feed> _feeds;
+	
+	SimClock &_clock;
+	bool _clock_joined = false;
 	
-	float _time_mult;
 	int _time_offset;
 	int _verbosity;
-	
-	time_t _start_time;
 };
 
 
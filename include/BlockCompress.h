@@ -0,0 +1,34 @@
+#ifndef BLOCKCOMPRESS_H
+#define BLOCKCOMPRESS_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*******************************************************************************************
+ * BlockCompress - small, fast LZ77 block compressor in the style of LZ4. Meant for whole
+ *                 replication payloads: one call compresses one block, no streaming state.
+ *                 Favors speed over ratio (single hash probe, greedy matching).
+ *
+ *                 Block layout: varint uncompressed size, then sequences of
+ *                    token       - high nibble literal length, low nibble match length - 4
+ *                                  (15 in either nibble means extra length bytes follow)
+ *                    [lit len]   - extra literal length bytes (255 = keep adding)
+ *                    literals
+ *                    offset      - 16 bit little-endian distance back to the match
+ *                    [match len] - extra match length bytes (255 = keep adding)
+ *                 The final sequence carries literals only and ends the block.
+ *******************************************************************************************/
+class BlockCompress {
+	public:
+	
+	// Compresses len bytes from in, replacing the contents of out
+	static void compress(const uint8_t *in, size_t len, std::vector<uint8_t> &out);
+	
+	// Decompresses a block made by compress, replacing the contents of out. Blocks claiming
+	// to expand beyond max_size are rejected.
+	static void decompress(const uint8_t *in, size_t len, std::vector<uint8_t> &out, size_t max_size);
+};
+
+
+#endif
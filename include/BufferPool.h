@@ -0,0 +1,71 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+class Counter;
+
+/*******************************************************************************************
+ * BufferPool - recycles byte vectors (replication batches, socket and marshalling buffers)
+ *              so a replication round reuses capacity left behind by the last one instead of
+ *              allocating and growing new vectors. acquire() hands back an empty vector that
+ *              often already has the capacity needed; release() takes one back.
+ *
+ *              Each thread keeps a few released buffers of its own, lock free. Past that they
+ *              go to a shared, mutex'd depot, which is how buffers released on the network
+ *              thread get back to the database thread that fills them. Buffers beyond the
+ *              depot's limit, or bigger than max_capacity, are just freed, so an odd huge
+ *              batch doesn't stay pinned.
+ *
+ *              Only the global pool has per-thread caches; other instances go straight to
+ *              their depot.
+ *
+ *              Reuse and fresh allocations are counted in repl_buffer_pool_reused_total and
+ *              repl_buffer_pool_allocated_total.
+ *******************************************************************************************/
+class BufferPool {
+	public:
+	BufferPool(size_t max_buffers, size_t max_capacity);
+	~BufferPool() = default;
+	
+	BufferPool(const BufferPool &) = delete;
+	BufferPool &operator=(const BufferPool &) = delete;
+	
+	// The pool the replication paths share
+	static BufferPool &global();
+	
+	// An empty buffer with room for at least reserve bytes
+	std::vector<uint8_t> acquire(size_t reserve = 0);
+	
+	// Takes buf back for reuse, leaving it empty
+	void release(std::vector<uint8_t> &buf);
+	
+	// Buffers sitting in the shared depot
+	size_t getDepotSize();
+	
+	private:
+	BufferPool(size_t max_buffers, size_t max_capacity, bool thread_cached);
+	
+	// Per-thread stash of the global pool's buffers (see BufferPool.cpp)
+	friend struct buffer_cache;
+	
+	// Adds or takes a buffer from the depot
+	void stash(std::vector<uint8_t> &buf);
+	bool take(std::vector<uint8_t> &buf);
+	
+	bool _thread_cached;
+	size_t _max_buffers;
+	size_t _max_capacity;
+	
+	std::mutex _mutex;
+	std::vector<std::vector<uint8_t>> _depot;
+	
+	Counter &_reused;
+	Counter &_allocated;
+};
+
+
+#endif
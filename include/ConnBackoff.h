@@ -0,0 +1,99 @@
+#ifndef CONNBACKOFF_H
+#define CONNBACKOFF_H
+
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include "PeerID.h"
+
+/***************************************************************************************
+ * ConnBackoff - per-peer connect retry policy. Each failed connect doubles the wait
+ *               before the next try (with random jitter so a site coming back isn't hit
+ *               by every peer at once), and only one attempt per failing peer is in
+ *               flight at a time. After trip_failures failures in a row the circuit
+ *               opens: nobody tries that peer for open_time, then a single probe decides
+ *               whether it closes again. A successful connect resets the peer.
+ *
+ *               The one attempt's claim on a peer is held by a Claim, so a connection that
+ *               is dropped or destroyed before it reports back frees the peer for the
+ *               next connection instead of leaving it claimed for good.
+ *
+ ***************************************************************************************/
+class ConnBackoff {
+	public:
+	typedef std::chrono::steady_clock clock;
+	
+	struct Config {
+		double base_delay = 0.5;          // Wait after the first failure (seconds)
+		double max_delay = 30.0;          // Longest wait between ordinary retries
+		unsigned int trip_failures = 6;   // Failures in a row that open the circuit
+		double open_time = 60.0;          // How long an open circuit stays open
+		double connect_timeout = 5.0;     // Give up on a connect that hasn't finished by now
+	};
+	
+	/***********************************************************************************
+	 * Claim - a connection's hold on the one in-flight attempt to a failing peer. Let go
+	 *         of it (release() or destruction) and, if the attempt hasn't been reported
+	 *         through success() or failure() yet, the peer can be tried again right away.
+	 *         The ConnBackoff must outlive its claims.
+	 ***********************************************************************************/
+	class Claim {
+		public:
+		Claim() = default;
+		~Claim() { release(); };
+		
+		Claim(const Claim &) = delete;
+		Claim &operator=(const Claim &) = delete;
+		
+		void release();
+		
+		private:
+		friend class ConnBackoff;
+		
+		ConnBackoff *_backoff = nullptr;
+		peer_id _peer = no_peer;
+		uint64_t _id = 0;
+	};
+	
+	ConnBackoff();
+	~ConnBackoff() = default;
+	
+	void setConfig(const Config &config);
+	const Config &getConfig() { return _config; };
+	
+	// True if a connect to peer may start now. Claims the attempt for a failing peer into
+	// claim, so the caller must report how it went with success() or failure(), or let
+	// the claim go if the connection is dropped first
+	bool canAttempt(peer_id peer, clock::time_point now, Claim &claim);
+	
+	void success(peer_id peer);
+	
+	// Records a failed attempt and schedules the next. Returns true if this opened the circuit
+	bool failure(peer_id peer, clock::time_point now);
+	
+	// Earliest time the next attempt to peer may start. While another connection has the
+	// attempt in flight, that's a base_delay from now, when it's worth checking again
+	clock::time_point nextAttempt(peer_id peer, clock::time_point now);
+	
+	private:
+	// Frees the peer if claim id still holds its in-flight attempt
+	void release(peer_id peer, uint64_t id);
+	
+	struct peer_state {
+		unsigned int failures = 0;
+		clock::time_point next_attempt;
+		bool in_flight = false;
+		uint64_t claim = 0;     // Which Claim holds the in-flight attempt
+	};
+	
+	Config _config;
+	
+	std::unordered_map<peer_id, peer_state> _peers;
+	
+	std::mt19937 _rng;
+	uint64_t _next_claim = 1;
+};
+
+
+#endif
@@ -6,54 +6,70 @@
 #include <map>
 #include <unistd.h>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
 #include "exceptions.h"
+#include "SlabPool.h"
 
 
 // Flags for the DronePlot object. The first two are already coded in and
-// you can define more. It's based off bitwise and/or operations so just
-// create a new one up to 0x128 
+// you can define more. It's based off bitwise and/or operations so each one
+// is its own bit, up to 0x8000 (flags are 16 bits)
 #define DBFLAG_NEW      0x1   // Was newly added to the database
 #define DBFLAG_SYNCD    0x2   // Has been sync'd
 #define DBFLAG_USER1    0x4   // Change as needed
 #define DBFLAG_USER2    0x8   // Change as needed
-#define DBFLAG_USER3    0x16  // Change as needed
-#define DBFLAG_USER4    0x32
+#define DBFLAG_USER3    0x10  // Change as needed
+#define DBFLAG_USER4    0x20
 
-// Manages the drone plot database for a particular node.
+// One drone plot. Kept trivially copyable (no virtuals) with the attributes in wire order
+// (see PlotRecord in PlotCodec.h) and the flags in what would otherwise be padding, so
+// plots copy as plain memory and the database's list nodes stay small.
 class DronePlot {
 	public:
 	DronePlot() = default;
-	DronePlot(int in_droneid, int in_nodeid, int in_timestamp, float in_latitude, float in_longitude);
-	virtual ~DronePlot() = default;
+	DronePlot(uint32_t in_droneid, uint32_t in_nodeid, int64_t in_timestamp, float in_latitude, float in_longitude);
 	
 	// Function to serialize, or convert this data into a binary stream in a vector class and back
 	void serialize(std::vector<uint8_t> &buf);
 	void deserialize(std::vector<uint8_t> &buf, unsigned int start_pt = 0);
 	
+	// Reads one record straight out of a raw buffer (caller guarantees getDataSize() bytes)
+	void deserialize(const uint8_t *buf);
+	
 	// Reads and writes this plot to/from a buffer in comma-separated format
 	int readCSV(std::string &buf);
 	void writeCSV(std::string &buf);
 	
-	static size_t getDataSize();   // Num of bytes required to store the data (for serialization)
+	// Num of bytes required to store the data, minus the flags (for serialization)
+	static constexpr size_t getDataSize() {
+		return sizeof(drone_id) + sizeof(node_id) + sizeof(timestamp) + sizeof(latitude) + sizeof(longitude);
+	}
 	
 	// Flag manipulation -- pass in a define above as in setFlags(DBFLAG_NEW);
-	void setFlags(unsigned short flags);
-	void clrFlags(unsigned short flags);
-	bool isFlagSet(unsigned short flags);
+	void setFlags(uint16_t flags) { _flags |= flags; };
+	void clrFlags(uint16_t flags) { _flags &= (uint16_t) ~flags; };
+	bool isFlagSet(uint16_t flags) const { return (_flags & flags) != 0; };
 	
 	// attributes - freely accessible to modify as needed
-	unsigned int drone_id  = -1;
-	unsigned int node_id   = -1;
-	time_t       timestamp = 0;
-	float        latitude  = 0;
-	float        longitude = 0;
+	uint32_t drone_id  = -1;
+	uint32_t node_id   = -1;
+	int64_t  timestamp = 0;
+	float    latitude  = 0;
+	float    longitude = 0;
 	
 	private:
-	unsigned short _flags;
+	uint16_t _flags = 0;
 	
 };
 
-using DronePlotDBIterator = std::list<DronePlot>::iterator;
+static_assert(std::is_trivially_copyable<DronePlot>::value, "DronePlot must stay trivially copyable");
+static_assert(sizeof(DronePlot) == 32, "DronePlot should be its 24 bytes of attributes plus flags");
+
+// Plots live in list nodes carved out of the database's own slab pool
+using DronePlotList = std::list<DronePlot, SlabAllocator<DronePlot>>;
+using DronePlotDBIterator = DronePlotList::iterator;
 
 /**************************************************************************************************
  * DronePlotDB - class to manage a database of DronePlot objects, which manage drone GPS plots that
@@ -67,11 +83,22 @@ class DronePlotDB {
 	virtual ~DronePlotDB() = default;
 	
 	// Add a plot to the database with the given attributes (mutex'd)
-	void addPlot(int drone_id, int node_id, time_t timestamp, float lattitude, float longitude);
+	void addPlot(uint32_t drone_id, uint32_t node_id, int64_t timestamp, float lattitude, float longitude);
+	
+	// Add a run of serialized plots straight from a buffer, locking only once (mutex'd)
+	void addPlots(const uint8_t *data, size_t count, unsigned short flags = 0);
+	
+	// Same, for plots that are already objects (copied in, with flags replaced) (mutex'd)
+	void addPlots(const DronePlot *plots, size_t count, unsigned short flags = 0);
 	
-	// Load or write the database to/from a CSV file,
-	int loadCSVFile(const char *filename);
-	int writeCSVFile(const char *filename);
+	// Load or write the database to/from a CSV file. Big files are parsed and formatted on up
+	// to threads threads (0 = one per core)
+	int loadCSVFile(const char *filename, unsigned int threads = 0);
+	int writeCSVFile(const char *filename, unsigned int threads = 0);
+	
+	// Writes a snapshot of the database as CSV to an already open fd (file, pipe or socket).
+	// Only holds the lock while copying, so it's safe while the server is running (mutex'd)
+	long writeCSV(int fd, unsigned int threads = 0);
 	
 	// Direct binary load/write to/from the specified file
 	int loadBinaryFile(const char *filename);
@@ -83,11 +110,31 @@ class DronePlotDB {
 	// Remove all plotpoints of a particular node (used to generate binary, not for student use)
 	void removeNodeID(unsigned int node_id);
 	
+	// Moves node_id's plots older than horizon into evicted (replaced), skipping any that
+	// still need replicating. Returns the number moved (mutex'd)
+	size_t evictBefore(int64_t horizon, unsigned int node_id, std::vector<DronePlot> &evicted);
+	
 	// Iterators for simple access to the database. Can use these to modify drone plot points
 	// but won't be able to add/delete PlotObjects. Use erase (below) for that as it is mutex'd
 	DronePlotDBIterator begin() { return _dbdata.begin(); };
 	DronePlotDBIterator end() { return _dbdata.end(); };
 	
+	// Walks the plots under the lock (so it's safe while the antenna is adding), calling
+	// visit(DronePlot &) on each from the start, or from pos, to the end. visit returns false
+	// to stop after that plot. Returns the iterator just past the last plot visited; it
+	// stays good for a later walk as long as nobody erases that plot (mutex'd)
+	template<typename Visit>
+	DronePlotDBIterator walk(Visit visit) {
+		std::unique_lock lk(_mutex);
+		return walkFrom(_dbdata.begin(), visit);
+	}
+	
+	template<typename Visit>
+	DronePlotDBIterator walk(DronePlotDBIterator pos, Visit visit) {
+		std::unique_lock lk(_mutex);
+		return walkFrom(pos, visit);
+	}
+	
 	// Manipulate database entries (mutex'd functions)
 	void popFront();
 	void erase(unsigned int i);
@@ -97,12 +144,26 @@ class DronePlotDB {
 	// Return the number of plot points stored
 	size_t size() { return _dbdata.size(); };
 	
-	// Wipe the database
+	// Total number of plots ever added through addPlot (for spotting new arrivals cheaply)
+	size_t getAddCount() { return _add_count; };
+	
+	// Wipe the database (and give the memory its plots were using back)
 	void clear();
 	
 	private:
-	std::list<DronePlot> _dbdata;
+	template<typename Visit>
+	DronePlotDBIterator walkFrom(DronePlotDBIterator pos, Visit &visit) {
+		while (pos != _dbdata.end()) {
+			if (!visit(*pos++))
+				break;
+		}
+		return pos;
+	}
+	
+	SlabPool _pool;   // Must outlive _dbdata
+	DronePlotList _dbdata{SlabAllocator<DronePlot>(_pool)};
 	std::mutex _mutex;
+	std::atomic<size_t> _add_count = 0;
 };
 
 
@@ -0,0 +1,119 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include "MPRing.h"
+#include "PeerID.h"
+
+// What happened. The meaning of each record's args depends on the event (see eventName/evtdump)
+enum event_type : uint16_t {
+	ev_none = 0,
+	ev_connect_start,     // Outgoing connect begun
+	ev_connect_done,      // args: microseconds the connect took
+	ev_connect_fail,      // args: failures in a row, 1 if that opened the circuit
+	ev_accept,            // args: remote address (network order)
+	ev_auth_start,        // Client sent its SID for the full handshake
+	ev_auth_ok,           // args: 1 if we're the server side
+	ev_auth_fail,         // args: 1 if we're the server side
+	ev_resume_sent,       // Client sent a ticket with its data
+	ev_resume_ok,         // Server accepted a ticket
+	ev_resume_refused,    // Server refused a ticket, falling back to the full handshake
+	ev_batch_sent,        // args: plots, raw bytes, bytes on the wire
+	ev_batch_acked,       // args: microseconds from send to ACK
+	ev_batch_recv,        // args: plots, bytes
+	ev_plots_added,       // args: plots received, plots the dedup pass that followed removed
+	ev_dropped,           // args: records lost because the queue was full
+	ev_count
+};
+
+// One record as written to the file, after the header. Fixed size so the file can be read
+// (or seeked) without parsing
+struct event_record {
+	uint64_t ts_ns;       // steady_clock nanoseconds
+	uint32_t conn;        // Connection serial number, 0 if not tied to a connection
+	uint32_t peer;        // peer_id, or no_peer
+	uint16_t event;
+	uint16_t pad[3];
+	uint64_t args[3];
+};
+
+static_assert(sizeof(event_record) == 48, "event_record must stay 48 bytes, it's the file format");
+
+// File header. The two clock readings let a decoder turn record timestamps into wall time
+const char evlog_magic[8] = {'D', 'P', 'E', 'V', 'L', 'O', 'G', '\0'};
+const uint32_t evlog_version = 1;
+
+struct evlog_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	int64_t wall_ns;      // system_clock at open
+	uint64_t mono_ns;     // steady_clock at open
+};
+
+const size_t evlog_queue_size = 16384;
+const std::chrono::milliseconds evlog_flush_interval(500);
+
+/*******************************************************************************************
+ * EventLog - binary log of what the replication paths are doing, cheap enough to leave on.
+ *            record() fills in a fixed-size record and pushes it onto a lock-free queue--no
+ *            formatting, no file I/O, no lock--and a background thread writes the queue out
+ *            in batches. If the queue is full the record is dropped and counted, and the
+ *            writer logs an ev_dropped record for the loss. Recording before open() (or
+ *            after close()) does nothing, so the calls can stay in the code unconditionally.
+ *
+ *            Decode the file with evtdump.
+ *******************************************************************************************/
+class EventLog {
+	public:
+	EventLog(size_t queue_size = evlog_queue_size);
+	~EventLog();
+	
+	EventLog(const EventLog &) = delete;
+	EventLog &operator=(const EventLog &) = delete;
+	
+	// Starts logging to filename (truncating it). Throws logfile_error if it can't be opened
+	void open(const char *filename);
+	void close();
+	
+	bool isOpen() { return _open.load(std::memory_order_relaxed); };
+	
+	void record(event_type event, peer_id peer, uint32_t conn, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0);
+	
+	// A serial number to tie a connection's records together
+	uint32_t newConnID() { return _next_conn.fetch_add(1, std::memory_order_relaxed); };
+	
+	unsigned long getDropped() { return _total_dropped.load(std::memory_order_relaxed); };
+	
+	static uint64_t now();
+	static const char *eventName(uint16_t event);
+	
+	private:
+	void writerThread();
+	void drain();
+	
+	FILE *_fptr = NULL;
+	
+	MPRing<event_record> _queue;
+	std::atomic<bool> _open{false};
+	std::atomic<uint32_t> _next_conn{1};
+	std::atomic<unsigned long> _dropped{0};
+	std::atomic<unsigned long> _total_dropped{0};
+	
+	std::vector<event_record> _write_buf;
+	
+	std::atomic<bool> _stop{false};
+	std::mutex _wake_mutex;
+	std::condition_variable _wake;
+	std::thread _writer;
+};
+
+
+#endif
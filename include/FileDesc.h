@@ -127,7 +127,7 @@ class FileDesc {
 	
 	protected:
 	
-	int _fd;
+	int _fd = -1;
 	
 };
 
@@ -144,6 +144,12 @@ class SocketFD : public FileDesc {
 	void bindFD(const char *ip_addr, unsigned short int port);
 	bool connectTo(const char *ip_addr, unsigned short port);
 	bool connectTo(unsigned long ip_addr, unsigned short port);
+	
+	// Non-blocking connect to the address set with setAddr (network format). connectAsync
+	// returns true if it connected right away; otherwise poll checkConnect until it's done
+	void setAddr(unsigned long ip_addr, unsigned short port);
+	bool connectAsync();
+	bool checkConnect();
 	void listenFD(int backlog = 5);
 	bool acceptFD(SocketFD &server);
 	
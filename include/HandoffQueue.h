@@ -0,0 +1,109 @@
+#ifndef HANDOFFQUEUE_H
+#define HANDOFFQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+/*******************************************************************************************
+ * HandoffQueue - bounded queue for handing work between two threads. Producers either
+ *                block until there's room (push) or check first and back off (tryPush), so
+ *                a slow consumer pushes back on the producer instead of growing memory.
+ *                close() wakes everyone up and makes further pushes fail, for shutdown.
+ *
+ *                The code must be defined here since it's a template
+ *******************************************************************************************/
+template<typename T>
+class HandoffQueue {
+	public:
+	explicit HandoffQueue(size_t capacity) : _capacity(capacity) {}
+	~HandoffQueue() = default;
+	
+	HandoffQueue(const HandoffQueue &) = delete;
+	HandoffQueue &operator=(const HandoffQueue &) = delete;
+	
+	/*****************************************************************************************
+	 * push - waits up to timeout for room in the queue and adds the item
+	 *
+	 *    Returns: true if queued, false if it timed out or the queue was closed
+	 *****************************************************************************************/
+	template<typename Rep, typename Period>
+	bool push(T &&item, std::chrono::duration<Rep, Period> timeout) {
+		std::unique_lock lk(_mutex);
+		if (!_not_full.wait_for(lk, timeout, [this] { return _closed || (_items.size() < _capacity); }))
+			return false;
+		if (_closed)
+			return false;
+		
+		_items.push_back(std::move(item));
+		_not_empty.notify_one();
+		return true;
+	}
+	
+	// Adds the item only if there's room right now
+	bool tryPush(T &&item) {
+		std::unique_lock lk(_mutex);
+		if (_closed || (_items.size() >= _capacity))
+			return false;
+		
+		_items.push_back(std::move(item));
+		_not_empty.notify_one();
+		return true;
+	}
+	
+	/*****************************************************************************************
+	 * pop - waits up to timeout for an item and moves it into item
+	 *
+	 *    Returns: true if an item was retrieved, false if it timed out or closed and empty
+	 *****************************************************************************************/
+	template<typename Rep, typename Period>
+	bool pop(T &item, std::chrono::duration<Rep, Period> timeout) {
+		std::unique_lock lk(_mutex);
+		if (!_not_empty.wait_for(lk, timeout, [this] { return _closed || !_items.empty(); }))
+			return false;
+		if (_items.empty())
+			return false;
+		
+		item = std::move(_items.front());
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+	
+	// Moves the next item into item if one is waiting, without blocking
+	bool tryPop(T &item) {
+		return pop(item, std::chrono::seconds(0));
+	}
+	
+	// True if a push right now would be refused
+	bool isFull() {
+		std::unique_lock lk(_mutex);
+		return _items.size() >= _capacity;
+	}
+	
+	size_t size() {
+		std::unique_lock lk(_mutex);
+		return _items.size();
+	}
+	
+	// Wakes any waiting threads and refuses new items (existing items can still be popped)
+	void close() {
+		std::unique_lock lk(_mutex);
+		_closed = true;
+		_not_full.notify_all();
+		_not_empty.notify_all();
+	}
+	
+	private:
+	std::deque<T> _items;
+	size_t _capacity;
+	bool _closed = false;
+	
+	std::mutex _mutex;
+	std::condition_variable _not_full;
+	std::condition_variable _not_empty;
+};
+
+
+#endif
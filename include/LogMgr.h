@@ -2,22 +2,43 @@
 #define LOGMGR_H
 
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include "MPRing.h"
+
+// Sizing for the log queue. Each record holds one line's text (longer lines are cut short),
+// and a full queue drops new lines rather than making the caller wait.
+const size_t log_record_text = 496;
+const size_t log_queue_size = 4096;
+const std::chrono::milliseconds log_flush_interval(200);
 
 /********************************************************************************
  * LogMgr - Log file manager. Includes setting log levels and a function to write
- *          a log entry if it is below a specified log level. Opens for each write
- *          in append mode to help with thread conflicts (but no mutexing)
+ *          a log entry if it is below a specified log level.
+ *
+ *          writeLog only copies the line into a lock-free queue, so any thread
+ *          can log without waiting on the disk. A background writer drains the
+ *          queue every flush interval (sooner if it's filling up), stamps each
+ *          line and writes the batch with one write and flush. If the queue is
+ *          full the line is dropped and counted, and the writer logs how many
+ *          were lost. flush() waits until everything logged so far is on disk.
  ********************************************************************************/
 
 class LogMgr {
 	public:
-	LogMgr(const char *log_file, unsigned int log_lvl);
+	LogMgr(const char *log_file, unsigned int log_lvl, size_t queue_size = log_queue_size);
 	~LogMgr();
 	
 	void writeLog(const char *str, unsigned int lvl = 0);
 	void writeLog(std::string &str, unsigned int lvl = 0);
 	void strerrLog(const char *str, unsigned int lvl = 0);
 	
+	void flush();
 	void closeLog();
 	
 	unsigned int getLogLvl() { return _log_lvl; }
@@ -26,11 +47,47 @@ class LogMgr {
 	
 	void changeFilename(const char *filename);
 	
+	void setFlushInterval(std::chrono::milliseconds interval) { _flush_interval = interval; };
+	
+	// Lines dropped so far because the queue was full
+	unsigned long getDropped() { return _total_dropped.load(std::memory_order_relaxed); };
+	
 	private:
+	struct log_record {
+		time_t when;
+		unsigned short len;
+		char text[log_record_text];
+	};
+	
+	void writerThread();
+	
+	// These need _file_mutex held
+	void drain();
+	void writeOut();
+	const std::string &stamp(time_t when);
+	
 	std::string _log_file;  // Path/name of the log to write to
 	unsigned int _log_lvl;  // The verbosity level
 	
 	FILE *_lfptr = NULL;
+	
+	MPRing<log_record> _queue;
+	std::atomic<unsigned long> _dropped{0};        // Since the writer last reported them
+	std::atomic<unsigned long> _total_dropped{0};
+	std::atomic<bool> _open_failed{false};
+	
+	// Writer side - _file_mutex covers the file, the write buffer and the cached timestamp
+	std::mutex _file_mutex;
+	std::string _write_buf;
+	time_t _stamp_time = 0;
+	std::string _stamp;
+	
+	std::atomic<std::chrono::milliseconds> _flush_interval{log_flush_interval};
+	std::atomic<bool> _wake_pending{false};
+	std::atomic<bool> _stop{false};
+	std::mutex _wake_mutex;
+	std::condition_variable _wake;
+	std::thread _writer;
 };
 
-#endif // ALMGR_H
+#endif // LOGMGR_H
@@ -0,0 +1,123 @@
+#ifndef MPRING_H
+#define MPRING_H
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+/*******************************************************************************************
+ * MPRing - bounded lock-free queue for many producers and consumers (the sequenced-cell
+ *          ring design). Each cell carries a sequence number that says whether it's ready
+ *          to be written or read on the current lap, so a producer or consumer only has to
+ *          win one compare-exchange on its end of the ring and never waits on a lock. A
+ *          full ring refuses the push rather than blocking, leaving the policy to the caller.
+ *
+ *          T must be default constructible and copy/move assignable. The code must be
+ *          defined here since it's a template
+ *******************************************************************************************/
+template<typename T>
+class MPRing {
+	public:
+	
+	// Capacity is rounded up to a power of two
+	explicit MPRing(size_t capacity) {
+		if (capacity == 0)
+			throw std::runtime_error("MPRing capacity must be greater than zero");
+		
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		
+		_mask = size - 1;
+		_cells.reset(new cell[size]);
+		for (size_t i = 0; i < size; i++)
+			_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+	~MPRing() = default;
+	
+	MPRing(const MPRing &) = delete;
+	MPRing &operator=(const MPRing &) = delete;
+	
+	/*****************************************************************************************
+	 * tryPush - claims the next free cell and moves item into it
+	 *
+	 *    Returns: false if the ring is full
+	 *****************************************************************************************/
+	bool tryPush(T &&item) {
+		size_t pos = _head.load(std::memory_order_relaxed);
+		cell *c;
+		while (true) {
+			c = &_cells[pos & _mask];
+			size_t seq = c->seq.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			
+			if (diff == 0) {
+				if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = _head.load(std::memory_order_relaxed);
+			}
+		}
+		
+		c->data = std::move(item);
+		c->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+	
+	/*****************************************************************************************
+	 * tryPop - takes the oldest item if one has been fully written
+	 *
+	 *    Returns: false if the ring is empty
+	 *****************************************************************************************/
+	bool tryPop(T &item) {
+		size_t pos = _tail.load(std::memory_order_relaxed);
+		cell *c;
+		while (true) {
+			c = &_cells[pos & _mask];
+			size_t seq = c->seq.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			
+			if (diff == 0) {
+				if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = _tail.load(std::memory_order_relaxed);
+			}
+		}
+		
+		item = std::move(c->data);
+		c->seq.store(pos + _mask + 1, std::memory_order_release);
+		return true;
+	}
+	
+	// Items in the ring right now - only a hint, since other threads keep moving both ends
+	size_t sizeApprox() const {
+		size_t head = _head.load(std::memory_order_relaxed);
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		return (head > tail) ? head - tail : 0;
+	}
+	
+	size_t capacity() const { return _mask + 1; };
+	
+	private:
+	struct cell {
+		std::atomic<size_t> seq;
+		T data;
+	};
+	
+	std::unique_ptr<cell[]> _cells;
+	size_t _mask;
+	
+	// Producers and consumers each hammer their own end, so keep them off each other's cache line
+	alignas(64) std::atomic<size_t> _head{0};
+	alignas(64) std::atomic<size_t> _tail{0};
+};
+
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*******************************************************************************************
+ * Counter - a count that only goes up. Updated with a relaxed atomic add, so any thread can
+ *           bump it without a lock or a fence.
+ *******************************************************************************************/
+class Counter {
+	public:
+	void add(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); };
+	uint64_t get() const { return _value.load(std::memory_order_relaxed); };
+	
+	private:
+	std::atomic<uint64_t> _value{0};
+};
+
+/*******************************************************************************************
+ * Histogram - latency distribution with log-linear buckets in microseconds, HDR style: each
+ *             power of two is split into hist_sub_buckets, so a bucket is at most
+ *             1/hist_sub_buckets as wide as its lower edge (12.5% with three sub bits) no
+ *             matter the scale. Recording is a few relaxed atomic adds. Values past the
+ *             histogram's range land in the top bucket.
+ *******************************************************************************************/
+const unsigned int hist_sub_bits = 3;
+const unsigned int hist_sub_buckets = 1 << hist_sub_bits;
+
+class Histogram {
+	public:
+	// max_seconds - largest value worth telling apart from bigger ones
+	explicit Histogram(double max_seconds);
+	
+	void record(double seconds);
+	void recordUsec(uint64_t usec);
+	
+	size_t numBuckets() const { return _buckets.size(); };
+	uint64_t bucketCount(size_t bucket) const { return _buckets[bucket].load(std::memory_order_relaxed); };
+	
+	// Largest value (microseconds) that falls into bucket
+	static uint64_t bucketLimit(size_t bucket);
+	static size_t bucketFor(uint64_t usec);
+	
+	uint64_t getCount() const { return _count.load(std::memory_order_relaxed); };
+	uint64_t getSumUsec() const { return _sum_usec.load(std::memory_order_relaxed); };
+	
+	private:
+	std::vector<std::atomic<uint64_t>> _buckets;
+	std::atomic<uint64_t> _count{0};
+	std::atomic<uint64_t> _sum_usec{0};
+};
+
+/*******************************************************************************************
+ * MetricsRegistry - the named counters and histograms the server exposes. Registering takes
+ *                   a lock, but it hands back a reference that stays valid for the life of
+ *                   the registry, so the hot paths register once and then update lock-free.
+ *                   Asking for a name (and labels) that's already registered returns the
+ *                   existing one. render() writes everything in Prometheus text format.
+ *
+ *                   global() is the one the server's components share.
+ *******************************************************************************************/
+class MetricsRegistry {
+	public:
+	MetricsRegistry() = default;
+	~MetricsRegistry() = default;
+	
+	MetricsRegistry(const MetricsRegistry &) = delete;
+	MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+	
+	static MetricsRegistry &global();
+	
+	// labels are in Prometheus form without the braces, e.g. peer="DS2"
+	Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+	Histogram &histogram(const std::string &name, const std::string &help, double max_seconds);
+	
+	void render(std::string &out);
+	
+	private:
+	struct family {
+		std::string name;
+		std::string help;
+		std::vector<std::pair<std::string, std::unique_ptr<Counter>>> counters;   // By labels
+		std::unique_ptr<Histogram> histogram;
+	};
+	
+	family &getFamily(const std::string &name, const std::string &help);
+	
+	std::vector<std::unique_ptr<family>> _families;
+	std::mutex _mutex;
+};
+
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <list>
+#include <memory>
+#include <chrono>
+#include <string>
+#include "FileDesc.h"
+#include "Metrics.h"
+
+/*******************************************************************************************
+ * MetricsServer - bare-bones HTTP listener that answers GET /metrics with the registry in
+ *                 Prometheus text format. Everything is polled from handle(), which never
+ *                 waits on the network, so it can ride along in an existing event loop.
+ *                 Each connection gets one response and is closed; clients that don't send
+ *                 their request or read the response in time are dropped.
+ *******************************************************************************************/
+class MetricsServer {
+	public:
+	MetricsServer(MetricsRegistry &registry);
+	~MetricsServer() = default;
+	
+	// Throws: socket_error if the address can't be bound
+	void bindSvr(const char *ip_addr, unsigned short port);
+	
+	bool isListening() { return _listening; };
+	
+	// Accepts new scrapers and answers any that have sent their request
+	void handle();
+	
+	private:
+	struct client {
+		std::unique_ptr<SocketFD> fd;
+		std::string request;
+		std::string response;    // Once the request is in, what's left to send
+		std::chrono::steady_clock::time_point start;
+	};
+	
+	void respond(client &conn);
+	bool service(client &conn);
+	
+	MetricsRegistry &_registry;
+	
+	SocketFD _sockfd;
+	bool _listening = false;
+	
+	std::list<client> _clients;
+};
+
+
+#endif
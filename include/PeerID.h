@@ -0,0 +1,10 @@
+#ifndef PEERID_H
+#define PEERID_H
+
+// Servers from servers.txt are interned as small numbers (their position in the file) so the
+// hot paths can index and hash them instead of comparing server ID strings
+typedef unsigned int peer_id;
+const peer_id no_peer = ~0u;
+
+
+#endif
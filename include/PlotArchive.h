@@ -0,0 +1,67 @@
+#ifndef PLOTARCHIVE_H
+#define PLOTARCHIVE_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "DronePlotDB.h"
+#include "PlotFile.h"
+
+/*******************************************************************************************
+ * PlotArchive - on-disk home for plots that have aged out of the in-memory database. Plots
+ *               are filed by timestamp into partitions partition_secs wide, each one written
+ *               as compressed PlotFiles named <dir>/plots_<partition start>_n<node>_<segment>.bin
+ *               (loadBinaryFile, or anything else that reads PlotFiles, takes them). node is
+ *               the node whose clock the timestamps are on; when that changes (a new
+ *               replication leader) the open partitions are sealed and new files started.
+ *
+ *               A partition stays open while plots for it are still coming in and is sealed
+ *               (flushed and closed) once sealBefore() says it's behind the horizon. Plots
+ *               that turn up for an already sealed partition start a new segment of it rather
+ *               than touching the finished file, and segments from earlier runs are never
+ *               overwritten.
+ *
+ *               Not thread safe: the replication server's database thread owns it.
+ *******************************************************************************************/
+class PlotArchive {
+	public:
+	explicit PlotArchive(const char *dir, int64_t partition_secs = 3600);
+	~PlotArchive();
+	
+	PlotArchive(const PlotArchive &) = delete;
+	PlotArchive &operator=(const PlotArchive &) = delete;
+	
+	// Creates the archive directory if it isn't there. Throws runtime_error if it can't be
+	void open();
+	
+	// Files plots whose timestamps are on clock_node's clock into their partitions. Throws
+	// runtime_error if a write fails
+	void add(const std::vector<DronePlot> &plots, unsigned int clock_node);
+	
+	// Seals every open partition that ends at or before the given time
+	void sealBefore(int64_t before);
+	
+	// Seals everything. Throws runtime_error if a partition couldn't be written out
+	void close();
+	
+	size_t getCount() { return _count; };
+	size_t getOpenPartitions() { return _open.size(); };
+	
+	private:
+	int64_t partitionStart(int64_t timestamp);
+	
+	// Opens the first unused segment of a partition
+	std::unique_ptr<PlotFileWriter> openPartition(int64_t start);
+	
+	std::string _dir;
+	int64_t _partition_secs;
+	
+	std::map<int64_t, std::unique_ptr<PlotFileWriter>> _open;   // By partition start
+	unsigned int _clock_node = 0;                               // Whose clock _open is on
+	size_t _count = 0;
+};
+
+
+#endif
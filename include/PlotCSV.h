@@ -0,0 +1,60 @@
+#ifndef PLOTCSV_H
+#define PLOTCSV_H
+
+#include <vector>
+#include <functional>
+#include "DronePlotDB.h"
+
+/*******************************************************************************************
+ * PlotCSV - fast parsing and writing of drone plot CSV text (drone_id,node_id,timestamp,
+ *           latitude,longitude per line). Lines are found with memchr and fields converted in
+ *           place with std::from_chars, so nothing is copied into temporary strings. Files are
+ *           mmapped and, when big enough, split at line boundaries into chunks that are
+ *           parsed on separate threads and stitched back together in file order.
+ *
+ *           Fields may have spaces or tabs around them, lines may end in \r\n, and blank
+ *           lines are skipped. Anything else malformed fails the whole parse.
+ *
+ *           Writing goes the other way with std::to_chars: plots are cut into blocks, each
+ *           block formatted into a reusable buffer on a worker thread, and the buffers
+ *           written out in order. Floats get 10 significant digits, as the old stream
+ *           based writer did, so the output is byte for byte the same.
+ *******************************************************************************************/
+class PlotCSV {
+	public:
+	
+	// Parses a single line (without its newline) into plot. False if it's malformed
+	static bool parseLine(const char *begin, const char *end, DronePlot &plot);
+	
+	// Parses every line in [begin, end), appending the plots. False at the first bad line
+	static bool parseBlock(const char *begin, const char *end, std::vector<DronePlot> &plots);
+	
+	// Same, spreading the work over up to threads threads (0 = one per core)
+	static bool parse(const char *begin, const char *end, std::vector<DronePlot> &plots, unsigned int threads = 0);
+	
+	// mmaps and parses a whole file. Returns the number of plots appended, -1 if the file
+	// couldn't be read, or -2 if it didn't parse (in which case nothing is appended)
+	static long parseFile(const char *filename, std::vector<DronePlot> &plots, unsigned int threads = 0);
+	
+	// Reads fd a large buffer at a time, parsing each buffer's whole lines (on up to threads
+	// threads) and handing them to sink in order, so memory stays bounded whatever the input
+	// size. Returns the number of plots, -1 on a read error or -2 on a bad line
+	static long parseStream(int fd, const std::function<void(std::vector<DronePlot> &)> &sink, unsigned int threads = 0);
+	
+	// Longest line formatLine can produce, newline included
+	static const size_t max_line = 96;
+	
+	// Formats one plot as a line (with its newline) at out, which needs max_line bytes of room.
+	// Returns the length
+	static size_t formatLine(const DronePlot &plot, char *out);
+	
+	// Formats count plots into buf, replacing what was there (its capacity is kept for reuse)
+	static void formatBlock(const DronePlot *plots, size_t count, std::vector<char> &buf);
+	
+	// Formats count plots on up to threads threads (0 = one per core) and writes them to fd
+	// in order. Returns the number of plots written, or -1 on a write error
+	static long write(int fd, const DronePlot *plots, size_t count, unsigned int threads = 0);
+};
+
+
+#endif
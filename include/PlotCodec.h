@@ -0,0 +1,119 @@
+#ifndef PLOTCODEC_H
+#define PLOTCODEC_H
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <iterator>
+#include "DronePlotDB.h"
+
+/*******************************************************************************************
+ * PlotRecord - the on-the-wire layout of one drone plot, exactly as DronePlot::serialize
+ *              writes it: drone_id, node_id, timestamp, latitude, longitude (24 bytes, host
+ *              byte order, no padding). Flags are never sent.
+ *******************************************************************************************/
+struct PlotRecord {
+	uint32_t drone_id;
+	uint32_t node_id;
+	int64_t timestamp;
+	float latitude;
+	float longitude;
+};
+
+static_assert(sizeof(PlotRecord) == 24, "PlotRecord must match the 24 byte wire layout");
+static_assert(sizeof(PlotRecord) == DronePlot::getDataSize(), "DronePlot attributes must match the wire layout");
+
+/*******************************************************************************************
+ * PlotColumns - column-oriented copy of a batch of plots. Handy when a pass only looks at
+ *               one or two attributes, and what the compact encodings work from.
+ *******************************************************************************************/
+struct PlotColumns {
+	std::vector<uint32_t> drone_id;
+	std::vector<uint32_t> node_id;
+	std::vector<int64_t> timestamp;
+	std::vector<float> latitude;
+	std::vector<float> longitude;
+	
+	size_t size() const { return drone_id.size(); };
+	void resize(size_t n);
+	void clear();
+};
+
+/*******************************************************************************************
+ * PlotCodec - bulk conversion between DronePlots (or PlotColumns) and the wire layout. The
+ *             buffer is sized once for the whole batch and each record is built in a
+ *             PlotRecord and block-copied, rather than pushed a byte at a time.
+ *
+ *             The iterator versions must be defined here since they're templates
+ *******************************************************************************************/
+class PlotCodec {
+	public:
+	
+	// Single record to/from a raw buffer of at least sizeof(PlotRecord) bytes
+	static void encodeOne(const DronePlot &plot, uint8_t *out) {
+		PlotRecord rec = {plot.drone_id, plot.node_id, plot.timestamp, plot.latitude, plot.longitude};
+		memcpy(out, &rec, sizeof(rec));
+	}
+	
+	static void decodeOne(const uint8_t *in, DronePlot &plot) {
+		PlotRecord rec;
+		memcpy(&rec, in, sizeof(rec));
+		plot.drone_id = rec.drone_id;
+		plot.node_id = rec.node_id;
+		plot.timestamp = rec.timestamp;
+		plot.latitude = rec.latitude;
+		plot.longitude = rec.longitude;
+	}
+	
+	/*****************************************************************************************
+	 * encode - appends the plots in [begin, end) to buf in wire format
+	 *
+	 *    Returns: number of plots encoded
+	 *****************************************************************************************/
+	template<typename Iter>
+	static size_t encode(Iter begin, Iter end, std::vector<uint8_t> &buf) {
+		size_t start = buf.size();
+		size_t count = std::distance(begin, end);
+		
+		buf.resize(start + count * sizeof(PlotRecord));
+		uint8_t *out = buf.data() + start;
+		for (; begin != end; begin++, out += sizeof(PlotRecord))
+			encodeOne(*begin, out);
+		
+		return count;
+	}
+	
+	/*****************************************************************************************
+	 * decode - reads count records from in and hands each decoded DronePlot to store
+	 *
+	 *    Params:  in - must hold count * sizeof(PlotRecord) bytes
+	 *             store - callable taking a DronePlot &
+	 *****************************************************************************************/
+	template<typename Store>
+	static void decode(const uint8_t *in, size_t count, Store store) {
+		DronePlot plot;
+		for (size_t i = 0; i < count; i++, in += sizeof(PlotRecord)) {
+			decodeOne(in, plot);
+			store(plot);
+		}
+	}
+	
+	// Column store to/from wire format. encodeColumns appends to buf, decodeColumns
+	// replaces the contents of cols
+	static void encodeColumns(const PlotColumns &cols, std::vector<uint8_t> &buf);
+	static void decodeColumns(const uint8_t *in, size_t count, PlotColumns &cols);
+	
+	// Compact batch encoding - converts a replication batch (32 bit count + wire records)
+	// to and from the compact form. See PlotCodec.cpp for the layout.
+	static void compactBatch(const std::vector<uint8_t> &batch, std::vector<uint8_t> &compact);
+	static void expandBatch(const uint8_t *compact, size_t len, std::vector<uint8_t> &batch);
+	
+	// Varint helpers (LEB128), shared with anything else that wants compact integers
+	static void putVarint(std::vector<uint8_t> &buf, uint64_t val);
+	static uint64_t getVarint(const uint8_t *&in, const uint8_t *end);
+	static uint64_t zigzag(int64_t val) { return (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63); };
+	static int64_t unzigzag(uint64_t val) { return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1); };
+};
+
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef PLOTFILE_H
+#define PLOTFILE_H
+
+#include <vector>
+#include <cstdint>
+#include "DronePlotDB.h"
+
+// File header for the versioned and compressed layouts. Raw files have no header, just wire
+// records back to back, and a raw file can't start with the magic (it would take drone and
+// node IDs that are really ASCII)
+const char plotfile_magic[8] = {'D', 'P', 'P', 'L', 'O', 'T', 'S', '\0'};
+const uint32_t plotfile_version = 1;
+
+struct plotfile_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;   // sizeof(PlotRecord) when written
+	uint32_t encoding;      // plotfile_records or plotfile_frames
+	uint32_t reserved;
+};
+
+static_assert(sizeof(plotfile_header) == 24, "plotfile_header is the file format");
+
+enum plotfile_encoding : uint32_t {
+	plotfile_records = 0,   // Wire records back to back
+	plotfile_frames = 1     // uint32 length + compressed frame, repeated
+};
+
+/*******************************************************************************************
+ * PlotFile - the binary drone plot file layouts, written and read a block at a time so
+ *            files of any size go through in bounded memory:
+ *
+ *            raw - wire records back to back (what loadBinaryFile always read)
+ *            versioned - plotfile_header, then wire records
+ *            compressed - plotfile_header, then frames of up to plotfile_frame_plots plots,
+ *                         each the PlotCodec compact batch encoding run through
+ *                         BlockCompress and prefixed with its uint32 length
+ *
+ *            The reader works out the layout from the header, so anything that loads plot
+ *            files takes all three.
+ *******************************************************************************************/
+class PlotFile {
+	public:
+	enum file_format {
+		raw, versioned, compressed
+	};
+	
+	// Looks up a format by name ("raw", "versioned" or "compressed"). False if unknown
+	static bool formatFromName(const char *name, file_format &format);
+};
+
+/*******************************************************************************************
+ * PlotFileWriter - buffers plots and writes them out a block (or frame) at a time
+ *******************************************************************************************/
+class PlotFileWriter {
+	public:
+	PlotFileWriter() = default;
+	~PlotFileWriter();
+	
+	PlotFileWriter(const PlotFileWriter &) = delete;
+	PlotFileWriter &operator=(const PlotFileWriter &) = delete;
+	
+	// Creates (or truncates) the file and writes the header. False if it can't be opened
+	bool open(const char *filename, PlotFile::file_format format);
+	
+	// Adds plots to the file. Throws runtime_error if a write fails
+	void write(const DronePlot *plots, size_t count);
+	
+	// Writes out whatever is buffered and closes the file. Throws runtime_error if that fails
+	void close();
+	
+	size_t getCount() { return _count; };
+	
+	private:
+	void flush();
+	void writeAll(const uint8_t *data, size_t len);
+	
+	int _fd = -1;
+	PlotFile::file_format _format = PlotFile::raw;
+	size_t _count = 0;
+	
+	std::vector<uint8_t> _pending;   // Wire records not yet written, after a uint32 count for framing
+	size_t _pending_plots = 0;
+	std::vector<uint8_t> _compact, _frame;
+};
+
+/*******************************************************************************************
+ * PlotFileReader - reads any of the layouts back a block at a time as wire records
+ *******************************************************************************************/
+class PlotFileReader {
+	public:
+	PlotFileReader() = default;
+	~PlotFileReader();
+	
+	PlotFileReader(const PlotFileReader &) = delete;
+	PlotFileReader &operator=(const PlotFileReader &) = delete;
+	
+	// Opens the file and works out its layout. False if it can't be opened or read
+	bool open(const char *filename);
+	
+	// Replaces records with the next block of wire records (count = size / sizeof(PlotRecord)).
+	// False at the end of the file. Throws runtime_error if the file is truncated or corrupt
+	bool next(std::vector<uint8_t> &records);
+	
+	void close();
+	
+	PlotFile::file_format getFormat() { return _format; };
+	
+	private:
+	// Reads exactly len bytes. False if the file ends before the first byte; throws
+	// runtime_error if it ends partway
+	bool readAll(uint8_t *data, size_t len);
+	
+	int _fd = -1;
+	PlotFile::file_format _format = PlotFile::raw;
+	
+	std::vector<uint8_t> _carry;     // Bytes read past the header while sniffing it
+	std::vector<uint8_t> _frame, _batch;
+};
+
+
+#endif
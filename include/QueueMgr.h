@@ -2,9 +2,16 @@
 #define QUEUEMGR_H
 
 #include <queue>
+#include <deque>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <csignal>
+#include <ctime>
 #include <crypto++/secblock.h>
 #include "TCPServer.h"
+#include "PeerID.h"
+#include "Metrics.h"
 
 /*******************************************************************************************
  * QueueMgr - Child class of the TCPServer object, manages a Queue for a middleware/app
@@ -17,9 +24,17 @@
  *            where they store their data until their data is moved into the queue for
  *            retrieval. 
  *            
- *            The pop function does two things. First, it "pops" (sends) incoming data to the
- *            management process and second, it assigns all outgoing data to a "Message
- *            Channel Agent", or TCPConn object.
+ *            The pop function "pops" (sends) incoming data to the management process.
+ *            Outgoing data is held per server and handed to a "Message Channel Agent", or
+ *            TCPConn object, by handleQueue. Each server gets at most one outgoing connection
+ *            at a time; anything queued for it meanwhile is merged into one pending batch
+ *            (up to max_coalesced_plots) so an outage doesn't leave a pile of connections
+ *            all hammering the server when it comes back.
+ *
+ *            servers.txt can be edited while running. It's reloaded on SIGHUP (see
+ *            requestReload) or when its modification time changes. Added servers are
+ *            reported so the caller can catch them up; removed servers get nothing new but
+ *            whatever was already queued for them still drains out.
  *
  *******************************************************************************************/
 class QueueMgr : public TCPServer {
@@ -37,8 +52,9 @@ class QueueMgr : public TCPServer {
 	// Loads replication information into the Queue to transmit to servers
 	void sendToAll(std::vector<uint8_t> &data);
 	void sendToServer(const char *server_id, std::vector<uint8_t> &data);
+	void sendToServer(peer_id peer, std::vector<uint8_t> &data);
 	
-	// Overload simply to remove this server from _server_list. Calls parent funct
+	// Overload simply to find this server in the server list. Calls parent funct
 	void bindSvr(const char *ip_addr, unsigned short port);
 	
 	
@@ -46,7 +62,21 @@ class QueueMgr : public TCPServer {
 	const char *getServerID() { return _server_ID.c_str(); };
 	
 	// Get the number of servers we are replicating to
-	unsigned int getNumServers() { return _server_list.size(); };
+	unsigned int getNumServers();
+	
+	// Reloads servers.txt if it changed or a reload was requested. Servers that joined (or
+	// rejoined) are loaded into added.
+	//    Returns: true if the membership changed
+	bool checkServerList(std::vector<peer_id> &added);
+	
+	// Safe to call from a signal handler--the reload happens on the next checkServerList
+	static void requestReload() { _reload_requested = 1; };
+	
+	// Looks up a server's interned peer ID by its server ID (no_peer if not listed)
+	peer_id getPeerID(const char *server_id);
+	
+	// Slowest smoothed ACK round trip (real seconds) across the servers we replicate to
+	double getMaxAckRTT();
 	
 	// Looks up another server based off IP address and port
 	const char *getClientID(unsigned long ip_addr, unsigned short port);
@@ -57,10 +87,17 @@ class QueueMgr : public TCPServer {
 	private:
 	
 	// Launches a connection to the other server from queue data
-	void launchDataConn(const char *sid, std::vector<uint8_t> &data);
+	void launchDataConn(peer_id peer, std::vector<uint8_t> &data);
 	
-	// Loads server information from servers.txt
+	// Starts a connection for each server with data waiting and no connection already going
+	void launchPending();
+	
+	// Appends a replication batch onto a pending one if it's well-formed and fits
+	static bool mergeBatch(std::vector<uint8_t> &into, const std::vector<uint8_t> &batch);
+	
+	// Loads server information from servers.txt, then keeps it up to date
 	int loadServerList(const char *filename);
+	bool reloadServerList(std::vector<peer_id> &added);
 	
 	// Set up our types for managing our queue
 	enum qe_type {
@@ -69,7 +106,7 @@ class QueueMgr : public TCPServer {
 	
 	struct queue_element {
 		
-		queue_element(qe_type in_type, const char *in_sid, std::vector<uint8_t> &in_data) : type(in_type), server_id(in_sid), data(in_data) {}
+		queue_element(qe_type in_type, const char *in_sid, std::vector<uint8_t> &in_data) : type(in_type), server_id(in_sid), data(std::move(in_data)) {}
 		
 		qe_type type;
 		std::string server_id;
@@ -81,7 +118,45 @@ class QueueMgr : public TCPServer {
 	// The queue list
 	std::queue<queue_element> _queue;
 	
-	std::vector<std::tuple<std::string, unsigned long, unsigned short>> _server_list;
+	// The servers from servers.txt (including this one), indexed by peer ID, with lookups by
+	// server ID and by address/port
+	struct peer_info {
+		std::string server_id;
+		unsigned long ip_addr;   // Network format
+		unsigned short port;     // Network format
+		bool active = true;      // False once removed from servers.txt (the ID isn't reused)
+		
+		// Replication traffic with this server, in the metrics registry (see registerPeerMetrics)
+		Counter *bytes_sent = NULL;
+		Counter *bytes_recv = NULL;
+		Counter *batches_sent = NULL;
+		Counter *batches_recv = NULL;
+	};
+	
+	static int parseServerList(const char *filename, std::vector<peer_info> &servers);
+	void rebuildAddrMap();
+	static void registerPeerMetrics(peer_info &peer);
+	
+	std::vector<peer_info> _peers;
+	std::unordered_map<std::string, peer_id> _peer_by_name;
+	std::unordered_map<uint64_t, peer_id> _peer_by_addr;
+	peer_id _self_id = no_peer;
+	
+	// Where the server list came from and what it looked like when we last loaded it
+	std::string _server_file;
+	time_t _server_mtime = 0;
+	off_t _server_size = 0;
+	time_t _last_check = 0;
+	
+	static volatile std::sig_atomic_t _reload_requested;
+	
+	static uint64_t addrKey(unsigned long ip_addr, unsigned short port) { return (static_cast<uint64_t>(ip_addr) << 16) | port; };
+	
+	// Outgoing batches per server waiting for that server's connection to free up
+	std::map<peer_id, std::deque<std::vector<uint8_t>>> _pending_out;
+	
+	// Smoothed ACK round trip per server (-1 until we have one), fed by our outgoing connections
+	std::vector<double> _ack_rtt;
 };
 
 
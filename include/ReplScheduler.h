@@ -0,0 +1,63 @@
+#ifndef REPLSCHEDULER_H
+#define REPLSCHEDULER_H
+
+/***************************************************************************************
+ * ReplScheduler - decides when ReplServer should push new plots out to the other
+ *                 servers. A flush happens once either the batch-size threshold or the
+ *                 latency deadline is reached, whichever comes first. The deadline
+ *                 adapts: deep queues shorten it so bursts get out quickly and slow
+ *                 peers (long ACK round trips) lengthen it so connections don't pile up.
+ *
+ *                 All times are in seconds on whatever clock the caller uses, as long
+ *                 as it is used consistently (ReplServer uses its adjusted sim time).
+ *
+ ***************************************************************************************/
+class ReplScheduler {
+	public:
+	struct Config {
+		unsigned int batch_size = 64;  // Flush as soon as this many plots are waiting
+		double max_latency = 2.0;      // Normal ceiling on how long a plot waits before a flush
+		double min_interval = 0.25;    // Never flush more often than this
+		double max_interval = 20.0;    // Hard ceiling on the deadline, even for slow peers
+		double rtt_mult = 4.0;         // Keep at least this many peer RTTs between flushes
+	};
+	
+	ReplScheduler();
+	explicit ReplScheduler(const Config &config);
+	~ReplScheduler() = default;
+	
+	void setConfig(const Config &config);
+	const Config &getConfig() { return _config; };
+	
+	// Reports how many plots are waiting for replication as of "now"
+	void updatePending(unsigned int pending, double now);
+	
+	// Reports the slowest smoothed ACK round trip among the peers
+	void observeAckRTT(double rtt);
+	
+	// True if the waiting plots should be sent out now
+	bool shouldFlush(double now);
+	
+	// Tells the scheduler a flush of "count" plots just happened so it can adapt
+	void flushed(unsigned int count, double now);
+	
+	// The current (adapted) latency deadline
+	double getInterval() { return _interval; };
+	
+	private:
+	
+	// Shortest allowed gap between flushes given the peers' round trip times
+	double getFloor();
+	
+	Config _config;
+	
+	double _interval;          // Current latency deadline
+	double _peer_rtt = 0.0;    // Slowest smoothed ACK round trip
+	
+	unsigned int _pending = 0; // Plots waiting right now
+	double _first_pending = 0; // When the oldest waiting plot showed up
+	double _last_flush = 0;    // When we last flushed
+};
+
+
+#endif
@@ -3,9 +3,17 @@
 
 #include <map>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <exception>
 #include "QueueMgr.h"
+#include "MetricsServer.h"
+#include "HandoffQueue.h"
 #include "DronePlotDB.h"
+#include "PlotArchive.h"
 #include "ReplicationManager.h"
+#include "ReplScheduler.h"
+#include "SimClock.h"
 
 /***************************************************************************************
  * ReplServer - class that manages replication between servers. The data is automatically
@@ -14,13 +22,28 @@
  *              the communications. This object simply runs management loops and should
  *              do deconfliction of nodes
  *
+ *              Network I/O (the QueueMgr) runs on its own thread so that a long dedup pass
+ *              on the database never stalls socket handling. The two sides only talk
+ *              through the bounded _inbound, _outbound and _catchup handoff queues.
+ *
+ *              When a server joins through a servers.txt reload, the network thread asks
+ *              for a catch-up and the database thread sends it the whole database.
+ *
+ *              Sim time comes from a SimClock shared with the AntennaSim. The database
+ *              thread joins it while replicating; on a virtual clock it sleeps between
+ *              scheduler checks so sim time can jump ahead.
+ *
+ *              With retention on, plots older than the horizon are moved out of the
+ *              database into a PlotArchive, so dedup, skew detection and catch-ups only
+ *              cover recent plots and a long-running server stays the same size.
+ *
  ***************************************************************************************/
 class ReplServer {
 	ReplicationManager replicationManager;
 	
 	public:
-	ReplServer(DronePlotDB &plotdb, const char *ip_addr, unsigned short port, float _time_mult = 1.0, unsigned int verbosity = 1);
-	ReplServer(DronePlotDB &plotdb, float _time_mult = 1.0);
+	ReplServer(DronePlotDB &plotdb, SimClock &clock, const char *ip_addr, unsigned short port, unsigned int verbosity = 1);
+	ReplServer(DronePlotDB &plotdb, SimClock &clock);
 	virtual ~ReplServer();
 	
 	// Main replication loop, continues until _shutdown is set
@@ -30,33 +53,103 @@ class ReplServer {
 	// Call this to shutdown the loop
 	void shutdown();
 	
-	// An adjusted time that accounts for "time_mult", which speeds up the clock. Any
+	// Changes when replication batches get flushed (call before replicate)
+	void configureScheduler(const ReplScheduler::Config &config) { _scheduler.setConfig(config); };
+	
+	// Records connection and replication events to a binary log (decode it with evtdump)
+	void openEventLog(const char *filename) { _queue.openEventLog(filename); };
+	
+	// Serve the metrics over HTTP on this port (same address as replication) once running
+	void serveMetrics(unsigned short port) { _metrics_port = port; };
+	
+	// Archive plots more than horizon sim seconds old into archive_dir (call before replicate).
+	// Throws runtime_error if the directory can't be created
+	void configureRetention(double horizon, const char *archive_dir);
+	
+	// Sim time off the shared clock, which accounts for the time multiplier. Any
 	// attempts to check "simulator time" should use this function
 	double getAdjustedTime();
 	
 	private:
 	
+	// The body of replicate(), which makes sure we're off the sim clock however it ends
+	void runReplication();
+	
 	void addReplDronePlots(std::vector<uint8_t> &data);
-	void addSingleDronePlot(std::vector<uint8_t> &data);
 	
-	unsigned int queueNewPlots();
+	unsigned int queueNewPlots(unsigned int expected = 0);
+	
+	// Sends everything in the database to a server that just joined
+	void queueCatchUp(peer_id peer);
 	
+	// Hands a batch to the network thread, waiting if it's backed up. False if shutting down
+	bool pushOutbound(peer_id target, std::vector<uint8_t> &data);
+	
+	// Network thread - runs the QueueMgr and shuttles batches through the handoff queues.
+	// runNetwork is the loop itself, networkLoop wraps it up on the way out
+	void networkLoop();
+	void runNetwork(std::vector<uint8_t> &held, bool &holding);
+	void sendOutbound();
+	
+	// Number of locally ingested plots that have not been queued for replication yet
+	unsigned int countPendingPlots();
+	
+	// Moves plots past the retention horizon from the database to the archive
+	void archiveOldPlots(double now);
 	
 	QueueMgr _queue;
 	
+	// Prometheus endpoint, run by the network thread (port 0 = off)
+	MetricsServer _metrics_http;
+	unsigned short _metrics_port = 0;
+	
+	// A batch for the network thread to send, to one server or (target = no_peer) all of them
+	struct outbound_batch {
+		peer_id target = no_peer;
+		std::vector<uint8_t> data;
+	};
+	
+	// Replication batches going from the network thread to the database and back, and the
+	// servers that joined and need catching up
+	HandoffQueue<std::vector<uint8_t>> _inbound;
+	HandoffQueue<outbound_batch> _outbound;
+	HandoffQueue<peer_id> _catchup;
+	std::thread _net_thread;
+	
+	// Tells the network thread to wrap up (set once the database thread is done with it), what
+	// it had received but not handed over when it stopped, and what it died of if it threw
+	std::atomic<bool> _net_stop = false;
+	std::vector<std::vector<uint8_t>> _net_leftover;
+	std::exception_ptr _net_error;
+	
+	// Slowest peer ACK round trip (real seconds), published by the network thread
+	std::atomic<double> _peer_rtt = 0.0;
+	
 	// Holds our drone plot information
 	DronePlotDB &_plotdb;
 	
-	bool _shutdown;
+	std::atomic<bool> _shutdown;
+	
+	// Sim clock shared with the antenna, and whether the database thread is counted on it
+	SimClock &_clock;
+	bool _clock_joined = false;
+	
+	// Decides when the new plots get flushed out to the other servers
+	ReplScheduler _scheduler;
 	
-	// How fast to run the system clock - 1.0 = normal speed, 2.0 = 2x as fast
-	float _time_mult;
+	// Retention - where evicted plots go (null = keep everything), the horizon in sim seconds
+	// and when the next eviction pass is due
+	std::unique_ptr<PlotArchive> _archive;
+	double _retention = 0.0;
+	double _next_eviction = 0.0;
+	std::vector<DronePlot> _evicted;
 	
-	// System clock time of when the server started
-	time_t _start_time;
+	// A received batch, decoded once for both the age histogram and the database
+	std::vector<DronePlot> _received;
 	
-	// When the last replication happened so we can know when to do another one
-	time_t _last_repl;
+	// Counters against DronePlotDB::getAddCount so we can tell how many new local plots are waiting
+	size_t _repl_added = 0;   // Plots we added from replication data
+	size_t _local_queued = 0; // Local plots accounted for by the last flush
 	
 	// How much to spam stdout with server status
 	unsigned int _verbosity;
@@ -18,6 +18,7 @@ class ReplicationManager {
 	
 	std::vector<TimeSkew> skews;
 	NodeId                leader = InvalidNodeId;
+	size_t                corrected = 0;
 	
 	public:
 	ReplicationManager() = default;
@@ -29,6 +30,13 @@ class ReplicationManager {
 	/** Updates all plots to have the same node ID */
 	void updateLeaderNodeIds(DronePlotDB & plots);
 	
+	/** The node whose clock corrected plots are on (they're relabeled with its ID), if there's one yet */
+	[[nodiscard]] bool hasLeader() const noexcept { return leader != InvalidNodeId; }
+	[[nodiscard]] unsigned int getLeader() const noexcept { return leader; }
+	
+	/** How many plot timestamps have been shifted to correct for skew so far */
+	[[nodiscard]] size_t getCorrectedCount() const noexcept { return corrected; }
+	
 	private:
 	/** Checks every plot for a new time skew */
 	void updateTimeSkews(DronePlotDBIterator begin, DronePlotDBIterator end) noexcept;
@@ -0,0 +1,67 @@
+#ifndef SESSIONTICKETS_H
+#define SESSIONTICKETS_H
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <ctime>
+
+// Ticket sizing and lifetime. A ticket is a random ID the server can look up plus a secret
+// only the server and the ticket holder know, which keys the HMAC on resumed data.
+const size_t ticket_id_size = 16;
+const size_t ticket_secret_size = 32;
+const time_t ticket_lifetime = 300;       // Seconds a server honors a ticket it issued
+const time_t ticket_margin = 10;          // Clients stop using a ticket this long before that
+const size_t max_issued_tickets = 1024;
+
+typedef std::array<uint8_t, ticket_id_size> ticket_id;
+typedef std::array<uint8_t, ticket_secret_size> ticket_secret;
+
+// A ticket as held by the client, plus the capabilities the issuing server advertised so a
+// resumed connection can encode its payload without seeing the server's SID first
+struct SessionTicket {
+	ticket_id id;
+	ticket_secret secret;
+	unsigned int peer_caps;
+	time_t expires;
+};
+
+/*******************************************************************************************
+ * SessionTickets - the tickets a server has handed out (so it can redeem them) and the
+ *                  tickets this server holds for its peers (so it can resume with them).
+ *                  Tickets are single-use: redeeming or taking one removes it, so a
+ *                  replayed first flight finds nothing and falls back to the full handshake.
+ *                  Shared by all connections on a server, so access is locked.
+ *******************************************************************************************/
+class SessionTickets {
+	public:
+	SessionTickets() = default;
+	~SessionTickets() = default;
+	
+	// Server side - remember a ticket issued to node_id / look it up and use it up
+	void issue(const std::string &node_id, const ticket_id &id, const ticket_secret &secret);
+	bool redeem(const std::string &node_id, const ticket_id &id, ticket_secret &secret);
+	
+	// Client side - hold the latest ticket from a peer / take it for a new connection
+	void store(const std::string &node_id, const SessionTicket &ticket);
+	bool take(const std::string &node_id, SessionTicket &ticket);
+	
+	private:
+	struct issued_ticket {
+		std::string node_id;
+		ticket_secret secret;
+		time_t expires;
+	};
+	
+	void purgeIssued(time_t now);
+	
+	std::map<ticket_id, issued_ticket> _issued;
+	std::map<std::string, SessionTicket> _held;
+	
+	std::mutex _mutex;
+};
+
+
+#endif
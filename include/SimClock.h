@@ -0,0 +1,114 @@
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <set>
+#include <string>
+
+/*******************************************************************************************
+ * SimClock - the "sim time" that AntennaSim and ReplServer share: seconds since the epoch
+ *            start() sets, sped up by the time multiplier. Plot timestamps are on this clock,
+ *            so anyone can tell how old a plot is by comparing it with now(). Anything that
+ *            waits on sim time sleeps through the clock so the clock decides how long that
+ *            really takes:
+ *
+ *            RealClock - the original behavior, time(NULL) based (whole seconds) and scaled
+ *            ScaledClock - steady clock based, sub-second resolution, scaled
+ *            VirtualClock - discrete event: sim time stands still while anyone is working
+ *                           and jumps straight to the earliest wakeup once every thread
+ *                           using it is asleep, so a run goes as fast as the CPU allows
+ *
+ *            Threads that sleep on a VirtualClock must join() it first (and leave() when
+ *            they're done) so it knows when everyone is asleep. join/leave do nothing on
+ *            the wall clocks.
+ *******************************************************************************************/
+class SimClock {
+	public:
+	explicit SimClock(float time_mult) : _time_mult(time_mult) {}
+	virtual ~SimClock() = default;
+	
+	SimClock(const SimClock &) = delete;
+	SimClock &operator=(const SimClock &) = delete;
+	
+	// Builds a clock by name: "real", "scaled" or "virtual". Throws runtime_error if unknown
+	static std::unique_ptr<SimClock> create(const std::string &type, float time_mult);
+	
+	// Sets sim time to -lead now, so zero comes lead sim seconds from now
+	virtual void start(double lead) = 0;
+	
+	// Sim seconds since the epoch (negative until it comes)
+	virtual double now() = 0;
+	
+	// Blocks until now() reaches when
+	virtual void sleepUntil(double when) = 0;
+	void sleepFor(double secs) { sleepUntil(now() + secs); };
+	
+	virtual void join() {};
+	virtual void leave() {};
+	
+	// True if sim time only moves when every participant is asleep
+	virtual bool isVirtual() { return false; };
+	
+	float getTimeMult() { return _time_mult; };
+	
+	protected:
+	float _time_mult;
+};
+
+class RealClock : public SimClock {
+	public:
+	explicit RealClock(float time_mult) : SimClock(time_mult) {}
+	
+	void start(double lead) override;
+	double now() override;
+	void sleepUntil(double when) override;
+	
+	private:
+	time_t _start_time = 0;
+	double _lead = 0;
+};
+
+class ScaledClock : public SimClock {
+	public:
+	explicit ScaledClock(float time_mult) : SimClock(time_mult) {}
+	
+	void start(double lead) override;
+	double now() override;
+	void sleepUntil(double when) override;
+	
+	private:
+	std::chrono::steady_clock::time_point _start_time;
+	double _lead = 0;
+};
+
+class VirtualClock : public SimClock {
+	public:
+	explicit VirtualClock(float time_mult = 1.0) : SimClock(time_mult) {}
+	
+	void start(double lead) override;
+	double now() override;
+	void sleepUntil(double when) override;
+	
+	void join() override;
+	void leave() override;
+	
+	bool isVirtual() override { return true; };
+	
+	private:
+	// Jumps to the earliest wakeup if every participant is asleep (call with _mutex held)
+	void advance();
+	
+	std::mutex _mutex;
+	std::condition_variable _moved;
+	
+	double _now = 0;
+	unsigned int _participants = 0;
+	std::multiset<double> _wakeups;   // One per sleeping participant
+};
+
+
+#endif
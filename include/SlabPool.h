@@ -0,0 +1,98 @@
+#ifndef SLABPOOL_H
+#define SLABPOOL_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <new>
+
+/*******************************************************************************************
+ * SlabPool - fixed-size block allocator. Blocks are carved out of big slabs and freed
+ *            blocks go on an intrusive free list to be handed out again first, so a
+ *            container that allocates one node at a time (std::list) does no malloc/free
+ *            per node and its nodes stay packed together instead of scattered over the
+ *            heap. The block size is set by the first allocation; anything that doesn't
+ *            fit a block goes to operator new. Slabs are only returned when the pool is
+ *            destroyed (or release() is called with nothing outstanding).
+ *
+ *            Not thread safe: a pool belongs to one container and shares its locking.
+ *******************************************************************************************/
+class SlabPool {
+	public:
+	explicit SlabPool(size_t slab_size = 64 * 1024) : _slab_size(slab_size) {}
+	~SlabPool() = default;
+	
+	SlabPool(const SlabPool &) = delete;
+	SlabPool &operator=(const SlabPool &) = delete;
+	
+	// Blocks are packed at align, so nodes take no more room than their own size needs
+	void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+	void deallocate(void *block, size_t size, size_t align = alignof(std::max_align_t));
+	
+	// Frees every slab. Only call it when nothing allocated from the pool is still in use
+	void release();
+	
+	size_t getSlabCount() { return _slabs.size(); };
+	size_t getBlocksInUse() { return _in_use; };
+	
+	private:
+	// Rounds size up to a block that keeps whatever goes in it aligned
+	static size_t blockSize(size_t size, size_t align);
+	
+	struct free_block {
+		free_block *next;
+	};
+	
+	size_t _slab_size;
+	size_t _block_size = 0;       // 0 until the first allocation
+	
+	std::vector<std::unique_ptr<char[]>> _slabs;
+	char *_carve = nullptr;       // Unused space at the end of the newest slab
+	char *_carve_end = nullptr;
+	free_block *_free = nullptr;
+	size_t _in_use = 0;
+};
+
+/*******************************************************************************************
+ * SlabAllocator - standard allocator front end for a SlabPool, so containers can use one:
+ *                 std::list<T, SlabAllocator<T>> list(SlabAllocator<T>(pool));
+ *                 Single objects come from the pool; arrays go to operator new.
+ *
+ *                 The code must be defined here since it's a template
+ *******************************************************************************************/
+template<typename T>
+class SlabAllocator {
+	public:
+	using value_type = T;
+	
+	explicit SlabAllocator(SlabPool &pool) : _pool(&pool) {}
+	
+	template<typename U>
+	SlabAllocator(const SlabAllocator<U> &other) : _pool(other.getPool()) {}
+	
+	T *allocate(size_t n) {
+		if (n == 1)
+			return static_cast<T *>(_pool->allocate(sizeof(T), alignof(T)));
+		return static_cast<T *>(::operator new(n * sizeof(T)));
+	}
+	
+	void deallocate(T *p, size_t n) {
+		if (n == 1)
+			_pool->deallocate(p, sizeof(T), alignof(T));
+		else
+			::operator delete(p);
+	}
+	
+	SlabPool *getPool() const { return _pool; };
+	
+	template<typename U>
+	bool operator==(const SlabAllocator<U> &other) const { return _pool == other.getPool(); };
+	template<typename U>
+	bool operator!=(const SlabAllocator<U> &other) const { return _pool != other.getPool(); };
+	
+	private:
+	SlabPool *_pool;
+};
+
+
+#endif
@@ -3,23 +3,39 @@
 
 #include <crypto++/secblock.h>
 #include <array>
+#include <chrono>
 #include <vector>
 #include "FileDesc.h"
 #include "LogMgr.h"
+#include "SessionTickets.h"
+#include "EventLog.h"
+#include "PeerID.h"
+#include "ConnBackoff.h"
 
 const int max_attempts = 2;
 constexpr auto RANDOM_BYTE_COUNT = 64;
 
+// Optional features a connection can negotiate. Each side tacks its set onto its server ID
+// in the SID exchange ("DS1;caps=1"); peers that don't advertise anything are sent the plain
+// legacy payload, so older servers still interoperate.
+enum conn_caps : unsigned int {
+	cap_compact = 0x1,   // Replication payload can use the compact plot batch encoding
+	cap_compress = 0x2,  // Replication payload can be block compressed
+	cap_ticket = 0x4     // Issues/accepts session tickets to skip the handshake next time
+};
+const unsigned int local_caps = cap_compact | cap_compress | cap_ticket;
+
 // Methods and attributes to manage a network connection, including tracking the username
 // and a buffer for user input. Status tracks what "phase" of login the user is currently in
 class TCPConn {
 	public:
-	TCPConn(LogMgr &server_log, CryptoPP::SecByteBlock &key, unsigned int verbosity);
-	~TCPConn() = default;
+	TCPConn(LogMgr &server_log, CryptoPP::SecByteBlock &key, SessionTickets &tickets, EventLog &events, unsigned int verbosity);
+	~TCPConn();
 	
 	// The current status of the connection
 	enum statustype {
-		s_none, s_connecting, s_connected, s_datatx, s_datarx, s_waitack, s_hasdata, s_auth2, s_auth3, s_auth4
+		s_none, s_connecting, s_connected, s_datatx, s_datarx, s_waitack, s_hasdata, s_auth2, s_auth3, s_auth4,
+		s_resumewait, s_tktrx, s_resumerx, s_tktwait
 	};
 	
 	statustype getStatus() { return _status; };
@@ -30,10 +46,24 @@ class TCPConn {
 	// depending on the state of the connection
 	void handleConnection();
 	
-	// connect - second version uses ip_addr in network format (big endian)
+	// connect - second version uses ip_addr in network format (big endian). Connects are
+	// non-blocking: poll finishConnect until it returns true before handling the connection
 	void connect(const char *ip_addr, unsigned short port);
 	void connect(unsigned long ip_addr, unsigned short port);
 	
+	// Sets who to connect to (network format) without connecting, then connects to it
+	void setTarget(unsigned long ip_addr, unsigned short port);
+	void connect();
+	
+	bool isConnectPending() { return _connect_pending; };
+	
+	// True for connections we opened to send data (as opposed to ones we accepted)
+	bool isOutgoing() { return _outgoing; };
+	
+	// Adds a record about this connection to the server's event log
+	void recordEvent(event_type ev, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0) { _events.record(ev, _peer_id, _conn_id, a0, a1, a2); };
+	bool finishConnect(double timeout);
+	
 	// Send data to the other end of the connection without encryption
 	bool getData();
 	bool sendData(std::vector<uint8_t> &buf);
@@ -42,7 +72,7 @@ class TCPConn {
 	void encryptData(std::vector<uint8_t> &buf);
 	void decryptData(std::vector<uint8_t> &buf);
 	
-	// Input data received on the socket
+	// Input data received on the socket (handed over, not copied)
 	bool isInputDataReady() { return _data_ready; };
 	void getInputData(std::vector<uint8_t> &buf);
 	
@@ -56,6 +86,10 @@ class TCPConn {
 	// Connections can set the node or server ID of this connection
 	void setNodeID(const char *new_id) { _node_id = new_id; };
 	
+	// Interned ID of the server at the other end (no_peer if we don't know it)
+	peer_id getPeerID() { return _peer_id; };
+	void setPeerID(peer_id new_id) { _peer_id = new_id; };
+	
 	void setSvrID(const char *new_id) { _svr_id = new_id; };
 	
 	// Closes the socket
@@ -65,11 +99,20 @@ class TCPConn {
 	bool isConnected();
 	
 	// When should we try to reconnect (prevents spam)
-	time_t reconnect = {};
+	std::chrono::steady_clock::time_point reconnect = {};
+	
+	// Our claim on the peer's in-flight connect attempt, if we hold it. Let go on disconnect
+	ConnBackoff::Claim backoff_claim;
 	
-	// Assign outgoing data and sets up the socket to manage the transmission
+	// Assign outgoing data (taking it from data) and sets up the socket to manage the transmission
 	void assignOutgoingData(std::vector<uint8_t> &data);
 	
+	// Seconds between sending replication data and getting the ACK back (-1 until the ACK arrives),
+	// and how big the batch it acknowledged was
+	double getAckRTT() { return _ack_rtt; };
+	size_t getAckedBytes() { return _acked_bytes; };
+	void clrAckRTT() { _ack_rtt = -1; };
+	
 	protected:
 	// Functions to execute various stages of a connection
 	void sendSID(const std::vector<uint8_t> &recvBuf);
@@ -84,8 +127,20 @@ class TCPConn {
 	void sendEncryptedBytes(const std::array<uint8_t, RANDOM_BYTE_COUNT> &randomBytes);
 	void sendRandomAndEncryptedBytes(const std::array<uint8_t, RANDOM_BYTE_COUNT> &randomBytes);
 	
+	// Session resumption - the client's ticket-bearing first flight, the server's checks on
+	// it, and handing out/keeping the ticket for next time
+	void sendResume(const SessionTicket &ticket);
+	void receiveTicket(const std::vector<uint8_t> &recvBuf);
+	void receiveResumed(const std::vector<uint8_t> &recvBuf);
+	void storeTicket(const std::vector<uint8_t> &recvBuf);
+	void appendTicket(std::vector<uint8_t> &buf);
+	
 	std::optional<std::vector<uint8_t>> getPacket();
 	
+	// Appends bytes as though they'd just been read off the socket (lets benchmarks drive the
+	// framing without a peer)
+	void feedInput(const std::vector<uint8_t> &data) { _buf.insert(_buf.end(), data.begin(), data.end()); };
+	
 	// Gets the data between startcmd and endcmd strings and places in buf
 	std::optional<std::vector<uint8_t>> getCmdData(std::pair<std::vector<uint8_t>, std::vector<uint8_t>> cmd);
 	
@@ -94,16 +149,31 @@ class TCPConn {
 	
 	std::pair<std::vector<uint8_t>, std::vector<uint8_t>> getStateStartEnd(statustype status);
 	
+	// Builds our SID message (with capabilities if wanted) and parses the other side's
+	std::vector<uint8_t> makeSID(bool with_caps, bool resume = false);
+	void parseSID(const std::vector<uint8_t> &recvBuf);
+	
+	// Converts between the raw replication batch and what actually goes inside <REP></REP>
+	void encodePayload(const std::vector<uint8_t> &batch, std::vector<uint8_t> &payload);
+	void decodePayload(const std::vector<uint8_t> &payload, std::vector<uint8_t> &batch);
+	
 	private:
 	bool _connected = false;
 	
-	std::vector<uint8_t> c_rep, c_endrep, c_auth, c_endauth, c_ack, c_sid, c_endsid, c_auth2, c_auth3, c_auth4;
+	bool _outgoing = false;
+	
+	// Non-blocking connect started but not finished, and when it started
+	bool _connect_pending = false;
+	std::chrono::steady_clock::time_point _connect_start;
+	
+	std::vector<uint8_t> c_rep, c_endrep, c_auth, c_endauth, c_ack, c_sid, c_endsid, c_auth2, c_auth3, c_auth4, c_tkt, c_endtkt;
 	
 	statustype _status = s_none;
 	
 	SocketFD _connfd;
 	
 	std::string _node_id; // The username this connection is associated with
+	peer_id _peer_id = no_peer;
 	std::string _svr_id;  // The server ID that hosts this connection object
 	
 	// Store incoming data to be read by the queue manager
@@ -111,15 +181,33 @@ class TCPConn {
 	std::vector<uint8_t> _inputbuf;
 	bool _data_ready;    // Is the input buffer full and data ready to be read?
 	
-	// Store outgoing data to be sent over the network
+	// Store outgoing data to be sent over the network (raw batch, encoded when sent)
 	std::vector<uint8_t> _outputbuf;
 	
+	// Capabilities the other side advertised, or -1 if it's a legacy peer that sent none
+	int _peer_caps = -1;
+	
+	// Server: the client asked to resume, and the ticket proof it sent ahead of its data
+	bool _resuming = false;
+	std::vector<uint8_t> _ticket_proof;
+	
+	// When the full handshake started, for the handshake time metric
+	std::chrono::steady_clock::time_point _auth_start;
+	
+	// When the replication data went out, used to time the ACK round trip
+	std::chrono::steady_clock::time_point _tx_time;
+	double _ack_rtt = -1;
+	size_t _acked_bytes = 0;
+	
 	std::array<uint8_t, RANDOM_BYTE_COUNT> _authstr = {};
 	CryptoPP::SecByteBlock &_aes_key; // Read from a file, our shared key
+	SessionTickets &_tickets;         // Shared by every connection on this server
 	
 	unsigned int _verbosity;
 	
 	LogMgr &_server_log;
+	EventLog &_events;
+	uint32_t _conn_id;   // Ties this connection's event records together
 	
 	void createRandomBytes();
 };
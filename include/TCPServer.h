@@ -7,6 +7,9 @@
 #include "FileDesc.h"
 #include "TCPConn.h"
 #include "LogMgr.h"
+#include "ConnBackoff.h"
+#include "ALMgr.h"
+#include "EventLog.h"
 #include <crypto++/secblock.h>
 
 /********************************************************************************************
@@ -17,8 +20,6 @@
  *             handleConnection functions. 
  ********************************************************************************************/
 
-const time_t reconnect_delay = 5;
-
 class TCPServer : public Server {
 	public:
 	TCPServer(unsigned int _verbosity = 1);
@@ -40,16 +41,36 @@ class TCPServer : public Server {
 	// Change where the log file is writing to
 	void changeLogfile(const char *newfile);
 	
+	// Start recording connection events to a binary event log (see EventLog)
+	void openEventLog(const char *filename) { _events.open(filename); };
+	EventLog &getEventLog() { return _events; };
+	
 	protected:
 	
 	void loadAESKey(const char *filename);
 	
+	// Starts a (non-blocking) connect for an outgoing connection if its peer's backoff allows,
+	// and books a failed attempt against the peer
+	void tryConnect(TCPConn &conn);
+	void connectFailed(TCPConn &conn, const char *msg);
+	
+	// Retry/circuit breaker state for peers we connect out to. Declared ahead of _connlist so
+	// it outlives the connections' claims on it
+	ConnBackoff _backoff;
+	
 	// List of TCPConn objects to manage connections
 	std::list<std::unique_ptr<TCPConn>> _connlist;
 	
 	CryptoPP::SecByteBlock _aes_key;
 	
+	// Session tickets we've issued to clients and hold from servers
+	SessionTickets _tickets;
+	
+	// Addresses allowed to connect in, loaded once and reloaded when the file changes
+	ALMgr _whitelist;
+	
 	LogMgr _server_log;
+	EventLog _events;
 	
 	unsigned int _verbosity;
 	
@@ -1,10 +1,66 @@
 #include <arpa/inet.h>
+#include <sys/stat.h>
 #include <stdexcept>
+#include <fstream>
 #include "ALMgr.h"
 #include "strfuncts.h"
 
-ALMgr::ALMgr(const char *al_file, bool is_whitelist) : _al_file(al_file), _is_whitelist(is_whitelist) {
+// How often (seconds) isAllowed checks whether the list file changed
+const time_t al_check_interval = 1;
 
+CIDRTrie::CIDRTrie() : _nodes(1) {
+}
+
+/******************************************************************************************************
+ * insert - adds a prefix of len bits. Anything under a prefix that's already in doesn't need to be
+ *          stored, and a shorter prefix simply marks its node so longer ones below it stop mattering.
+ ******************************************************************************************************/
+void CIDRTrie::insert(uint32_t prefix, unsigned int len) {
+	uint32_t cur = 0;
+	for (unsigned int bit = 0; bit < len; bit++) {
+		if (_nodes[cur].terminal)
+			return;
+		
+		unsigned int dir = (prefix >> (31 - bit)) & 1;
+		if (_nodes[cur].child[dir] == 0) {
+			_nodes[cur].child[dir] = _nodes.size();
+			_nodes.emplace_back();
+		}
+		cur = _nodes[cur].child[dir];
+	}
+	
+	if (!_nodes[cur].terminal)
+		_count++;
+	_nodes[cur].terminal = true;
+}
+
+bool CIDRTrie::contains(uint32_t addr) const {
+	uint32_t cur = 0;
+	for (unsigned int bit = 0; ; bit++) {
+		if (_nodes[cur].terminal)
+			return true;
+		if (bit == 32)
+			return false;
+		
+		cur = _nodes[cur].child[(addr >> (31 - bit)) & 1];
+		if (cur == 0)
+			return false;
+	}
+}
+
+/******************************************************************************************************
+ * ALMgr (constructor) - loads the access list
+ *
+ *    Throws: runtime_error if the list file can't be opened
+ ******************************************************************************************************/
+ALMgr::ALMgr(const char *al_file, bool is_whitelist) : _al_file(al_file), _is_whitelist(is_whitelist), _last_check(time(NULL)) {
+	struct stat sbuf;
+	bool have_stat = (stat(_al_file.c_str(), &sbuf) == 0);
+	
+	if (!load())
+		throw std::runtime_error("Unable to open white list file.");
+	if (have_stat)
+		markLoaded(sbuf);
 }
 
 
@@ -12,6 +68,74 @@ ALMgr::~ALMgr() {
 
 }
 
+/******************************************************************************************************
+ * load - parses the list file into a new trie and makes it the current one. Lines that aren't an
+ *        address or CIDR range are skipped.
+ *
+ *    Returns: false if the file couldn't be opened (the current list is kept)
+ ******************************************************************************************************/
+bool ALMgr::load() {
+	std::ifstream alfile(_al_file);
+	if (!alfile.is_open())
+		return false;
+	
+	auto trie = std::make_unique<CIDRTrie>();
+	std::string line, addr, bits;
+	while (std::getline(alfile, line)) {
+		auto comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+		clrNewlines(line);
+		if (line.find_first_not_of(' ') == std::string::npos)
+			continue;
+		clrSpaces(line);
+		
+		unsigned long len = 32;
+		if (split(line, addr, bits, '/'))
+			len = strtoul(bits.c_str(), NULL, 10);
+		else
+			addr = line;
+		
+		in_addr al_ip;
+		if ((inet_pton(AF_INET, addr.c_str(), &al_ip) != 1) || (len > 32))
+			continue;
+		
+		trie->insert(ntohl(al_ip.s_addr), len);
+	}
+	
+	std::atomic_store_explicit(&_trie, std::shared_ptr<const CIDRTrie>(std::move(trie)), std::memory_order_release);
+	return true;
+}
+
+void ALMgr::markLoaded(const struct stat &sbuf) {
+	if (sbuf.st_mtime >= time(NULL))
+		return;
+	
+	_mtime = sbuf.st_mtime;
+	_fsize = sbuf.st_size;
+}
+
+/******************************************************************************************************
+ * refresh - reloads the list if the file's modification time or size changed. Only one thread reloads at a
+ *           time; anyone else carries on with the current list. The new size and time are only
+ *           recorded once the file has loaded, so a failed or mid-edit load is tried again.
+ ******************************************************************************************************/
+bool ALMgr::refresh() {
+	std::unique_lock<std::mutex> lk(_reload_mutex, std::try_to_lock);
+	if (!lk.owns_lock())
+		return false;
+	
+	_last_check = time(NULL);
+	struct stat sbuf;
+	if ((stat(_al_file.c_str(), &sbuf) != 0) || ((sbuf.st_mtime == _mtime) && (sbuf.st_size == _fsize)))
+		return false;
+	
+	if (!load())
+		return false;
+	markLoaded(sbuf);
+	return true;
+}
+
 /******************************************************************************************************
  * isAllowed - checks to see if the IP address is in the list and allows/denies based off _is_whitelist
  *  
@@ -20,41 +144,16 @@ ALMgr::~ALMgr() {
 bool ALMgr::isAllowed(const char *ipaddr) {
 	in_addr testaddr;
 	
-	inet_pton(AF_INET, ipaddr, &testaddr);
+	if (inet_pton(AF_INET, ipaddr, &testaddr) != 1)
+		return !_is_whitelist;
 	return isAllowed(testaddr.s_addr);
 }
 
 bool ALMgr::isAllowed(unsigned long ipaddr) {
-	FILE *alfile;
-	
-	// First, find the IP address in the file
-	if ((alfile = fopen(_al_file.c_str(), "r")) == NULL) {
-		throw std::runtime_error("Unable to open white list file.");
-	}
+	if (time(NULL) - _last_check >= al_check_interval)
+		refresh();
 	
-	in_addr al_ip;
-	char strbuf[30];
-	strbuf[0] = '\0';
-	std::string ipstr;
-	
-	while (fgets(strbuf, 30, alfile) != NULL) {
-		ipstr = strbuf;
-		clrNewlines(ipstr);
-		inet_pton(AF_INET, ipstr.c_str(), &al_ip);
-		
-		if (al_ip.s_addr == ipaddr) {
-			fclose(alfile);
-			if (_is_whitelist)
-				return true;
-			else
-				return false;
-		}
-	}
-	
-	fclose(alfile);
-	
-	if (_is_whitelist)
-		return false;
-	return true;
+	std::shared_ptr<const CIDRTrie> trie = std::atomic_load_explicit(&_trie, std::memory_order_acquire);
+	bool found = trie->contains(ntohl(static_cast<uint32_t>(ipaddr)));
+	return found == _is_whitelist;
 }
-
@@ -1,139 +1,236 @@
 #include <iostream>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <chrono>
 #include "AntennaSim.h"
 #include "DronePlotDB.h"
+#include "Metrics.h"
 #include <unistd.h>
 
+// Generated drones start out somewhere in this range of lat/long and wander this far per sighting
+// (well past the dedup tolerance, so no two sightings of a drone look alike)
+const float gen_start_range = 60.0;
+const float gen_min_step = 0.0005;
+const float gen_max_step = 0.005;
+
+// How long adding a batch of injects to the database took, waiting on the lock included
+static Histogram &ingestTime() {
+	static Histogram &hist = MetricsRegistry::global().histogram("repl_antenna_ingest_seconds",
+	                                                             "Time for an antenna feed to add a batch of injects to the database, lock wait included", 1.0);
+	return hist;
+}
+
 /*****************************************************************************************
  * AntennaSim (constructor) - takes in a reference to the accessible database that will be
  *            populated by the simulator
  *
  *    Params:  dpdb - a reference to the operational database to inject into
- *             time_mult - how fast to run the injects (2.0 = 2x faster)
+ *             source_filename - if given, the first feed is loaded from this file
+ *             clock - the sim clock to inject on (shared with the ReplServer). Joins it
+ *                     until simulate() finishes
  *****************************************************************************************/
-AntennaSim::AntennaSim(DronePlotDB &dpdb, const char *source_filename, float time_mult, int verbosity) : _to_db(dpdb), _time_mult(time_mult), _time_offset(0), _verbosity(verbosity), _start_time(0) {
-	if (_verbosity == 3)
-		std::cout << "SIM: Loading source database: " << source_filename << "\n";
-	
-	if (_source_db.loadBinaryFile(source_filename) <= 0)
-		throw std::runtime_error("Source database could not be opened or was empty.");
-	
-	if (_verbosity >= 2)
-		std::cout << "SIM: Source database " << source_filename << " successfully loaded.\n";
-	if (_verbosity >= 1)
-		std::cout << "SIM: simulation started, time multiplier: " << _time_mult << "\n";
+AntennaSim::AntennaSim(DronePlotDB &dpdb, SimClock &clock, int verbosity) : _exiting(false), _to_db(dpdb), _clock(clock), _time_offset(0), _verbosity(verbosity) {
+	_clock.join();
+	_clock_joined = true;
 }
 
-// Constructor - no action right now
-AntennaSim::~AntennaSim() {
+AntennaSim::AntennaSim(DronePlotDB &dpdb, const char *source_filename, SimClock &clock, int verbosity) : AntennaSim(dpdb, clock, verbosity) {
+	loadSourceDB(source_filename);
+}
 
+AntennaSim::~AntennaSim() {
+	if (_clock_joined)
+		_clock.leave();
 }
 
 /*****************************************************************************************
- * loadSourceDB - Loads in the source file in binary format
+ * loadSourceDB - Loads in the source file in binary format as a new feed
  *
+ *    Throws: runtime_error if the file can't be read or is empty
  *****************************************************************************************/
 
 void AntennaSim::loadSourceDB(const char *filename) {
+	if (_verbosity == 3)
+		std::cout << "SIM: Loading source database: " << filename << "\n";
 	
 	// Load our drone plots to feed to the accessible database
-	int results = _source_db.loadBinaryFile(filename);
+	DronePlotDB source;
+	int results = source.loadBinaryFile(filename);
 	
 	if (results < 0)
 		throw std::runtime_error("Unable to load the source data file for the simulator.");
 	if (results == 0)
 		throw std::runtime_error("Source data file for simulator was empty.");
 	
+	std::vector<DronePlot> injects(source.begin(), source.end());
+	addFeed(filename, std::move(injects));
+	
+	if (_verbosity >= 2)
+		std::cout << "SIM: Source database " << filename << " successfully loaded.\n";
+}
+
+/*****************************************************************************************
+ * addGeneratedFeed - makes up a feed of drones on random walks. Drone IDs pick up where the
+ *                    previous generated feed's left off so feeds don't see the same drones.
+ *
+ *    Params:  node_id - the node the antenna belongs to
+ *             drones - how many drones it sees
+ *             rate - sightings per drone per sim second
+ *             duration - sim seconds of traffic
+ *
+ *    Throws: runtime_error if there'd be no traffic
+ *****************************************************************************************/
+
+void AntennaSim::addGeneratedFeed(unsigned int node_id, unsigned int drones, double rate, unsigned int duration) {
+	if ((drones == 0) || (rate <= 0.0) || (duration == 0))
+		throw std::runtime_error("Generated antenna feed needs at least one drone, a positive rate and a duration.");
+	
+	unsigned int first_drone = 1;
+	for (auto &feed : _feeds) {
+		for (auto &plot : feed.injects)
+			first_drone = std::max(first_drone, plot.drone_id + 1);
+	}
+	
+	std::mt19937 rng(node_id * 7919 + _feeds.size());
+	std::uniform_real_distribution<float> start(-gen_start_range, gen_start_range);
+	std::uniform_real_distribution<float> step(gen_min_step, gen_max_step);
+	std::bernoulli_distribution sign(0.5);
+	
+	std::vector<std::pair<float, float>> position(drones);
+	for (auto &pos : position)
+		pos = {start(rng), start(rng)};
+	
+	unsigned int total = (unsigned int) (duration * rate);
+	std::vector<DronePlot> injects;
+	injects.reserve((size_t) total * drones);
+	for (unsigned int i = 0; i < total; i++) {
+		int when = 1 + (int) (i / rate);
+		for (unsigned int drone = 0; drone < drones; drone++) {
+			auto &pos = position[drone];
+			pos.first += sign(rng) ? step(rng) : -step(rng);
+			pos.second += sign(rng) ? step(rng) : -step(rng);
+			injects.emplace_back(first_drone + drone, node_id, when, pos.first, pos.second);
+		}
+	}
+	
+	addFeed("generated" + std::to_string(_feeds.size() + 1), std::move(injects));
+	
+	if (_verbosity >= 2)
+		std::cout << "SIM: Generated feed of " << drones << " drones at " << rate << " plots/sec for " << duration << " secs.\n";
+}
+
+/*****************************************************************************************
+ * addFeed - sorts the injects into time order once, up front, and registers the feed
+ *****************************************************************************************/
+
+void AntennaSim::addFeed(const std::string &name, std::vector<DronePlot> &&injects) {
+	std::stable_sort(injects.begin(), injects.end(), [](const DronePlot &a, const DronePlot &b) { return a.timestamp < b.timestamp; });
+	
+	antenna_feed feed;
+	feed.name = name;
+	feed.injects = std::move(injects);
+	feed.injected = &MetricsRegistry::global().counter("repl_antenna_plots_total", "Plots injected by each antenna feed",
+	                                                   "feed=\"" + std::to_string(_feeds.size() + 1) + "\"");
+	_feeds.push_back(std::move(feed));
 }
 
 double AntennaSim::getAdjustedTime() {
-	return static_cast<double>(time(nullptr) - _start_time) * _time_mult;
+	return _clock.now();
 }
 
 /*****************************************************************************************
  * simulate - process that manages the simulation that feeds data into the student's database
- *            to simulate receiving drone data
+ *            to simulate receiving drone data. Starts a thread per feed and waits for them
+ *            all to finish.
  *
  *****************************************************************************************/
 
 void AntennaSim::simulate() {
 	
-	// Sort the database by time
-	_source_db.sortByTime();
-	
-	// Set up a random offset between 1 and 3 seconds from true
+	// Set up a random offset between 1 and 3 seconds from true. It's this node's clock, so
+	// every antenna shares it
 	srand(time(NULL));
 	_time_offset = (rand() % 6) - 3;
 	if (_verbosity >= 2)
 		std::cout << "SIM: Simulator time offset: " << _time_offset << " secs\n";
 	
+	for (auto &feed : _feeds) {
+		for (auto &plot : feed.injects)
+			plot.timestamp += _time_offset;
+	}
+	
 	if (_verbosity >= 1)
-		std::cout << "SIM: Delaying 3 seconds before starting sim to let servers come online.\n";
+		std::cout << "SIM: Delaying " << startup_delay << " seconds before starting sim to let servers come online.\n";
 	
-	// Provide a short 3 second delay before starting
-	for (unsigned int i = 3; i > 0; i--) {
+	// Count down to the clock's epoch, which main set startup_delay seconds out
+	for (unsigned int i = startup_delay; i > 0; i--) {
 		if (_verbosity >= 2)
 			std::cout << i << "\n";
-		usleep(1'000'000);
+		_clock.sleepUntil(-static_cast<double>(i - 1) * _clock.getTimeMult());
 	}
 	
-	// Initialize
-	_start_time = time(NULL);
+	if (_verbosity >= 1)
+		std::cout << "SIM: simulation started with " << _feeds.size() << " antenna feed(s), time multiplier: " << _clock.getTimeMult() << "\n";
+	
+	// Hand our place on the clock over to the feed threads (joining them first so the clock
+	// never sees nobody awake in between)
+	for (size_t i = 0; i < _feeds.size(); i++)
+		_clock.join();
+	_clock.leave();
+	_clock_joined = false;
 	
-	timespec sleeptime;
-	std::list<DronePlot>::iterator diter;
+	std::vector<std::thread> threads;
+	for (auto &feed : _feeds)
+		threads.emplace_back(&AntennaSim::runFeed, this, std::ref(feed));
+	for (auto &thread : threads)
+		thread.join();
 	
-	// Change all the inject timestamps to the offset time
-	for (diter = _source_db.begin(); diter != _source_db.end(); diter++) {
-		diter->timestamp += _time_offset;
+	if (_verbosity >= 2) {
+		std::cout << "SIM: Drone plot injections complete.\n";
 	}
+}
+
+/*****************************************************************************************
+ * runFeed - sleeps until the next inject is due, then adds everything that's due in one
+ *           batch. Leaves the clock when the feed runs out.
+ *
+ *****************************************************************************************/
+
+void AntennaSim::runFeed(antenna_feed &feed) {
+	Histogram &ingest_time = ingestTime();
 	
-	// Loop through the injects, sending them as their time arrives
-	while (_source_db.size() > 0) {
-		
-		// Get the time until our next inject
-		diter = _source_db.begin();
-		double adjusted_time = getAdjustedTime();
+	size_t next = 0;
+	while ((next < feed.injects.size()) && !_exiting) {
 		
 		// If the adjusted time is not past the timestamp on our next inject, sleep until it is
-		if (adjusted_time < (double) diter->timestamp) {
-			
-			// We need a more precise adjusted time
-			
-			// timespan = how long we need to sleep (add .55 secs to prevent rounding down issues
-			double timespan = ((double) diter->timestamp - adjusted_time) / _time_mult + .55;
-			sleeptime.tv_sec = (time_t) timespan;
-			sleeptime.tv_nsec = (long) (1000000000.0 * (timespan - (double) sleeptime.tv_sec));
-			
+		double adjusted_time = getAdjustedTime();
+		if (adjusted_time < (double) feed.injects[next].timestamp) {
 			if (_verbosity == 3)
-				std::cout << "SIM: Sim sleeping for " << sleeptime.tv_sec << " secs, " << sleeptime.tv_nsec << " nanosecs\n";
-			nanosleep(&sleeptime, NULL);
+				std::cout << "SIM: " << feed.name << " sleeping for " << (double) feed.injects[next].timestamp - adjusted_time << " sim secs\n";
+			_clock.sleepUntil((double) feed.injects[next].timestamp);
+			adjusted_time = getAdjustedTime();
 		}
 		
 		// Now inject all that have a timestamp less than the current time
-		adjusted_time = getAdjustedTime();
-		diter = _source_db.begin();
-		
-		if (_verbosity >= 2)
-			std::cout << "SIM: Cur systime: " << (time_t) getAdjustedTime() << "\n";
+		size_t end = next;
+		while ((end < feed.injects.size()) && (feed.injects[end].timestamp <= adjusted_time)) {
+			if (_verbosity >= 1) {
+				DronePlot &plot = feed.injects[end];
+				std::cout << "SIM: Injecting plot NodeID: " << plot.node_id << " DroneID: " << plot.drone_id << ", Time: " << plot.timestamp << " Lat: " << plot.latitude << ", Long: " << plot.longitude << "\n";
+			}
+			end++;
+		}
 		
-		while ((_source_db.size() > 0) && (diter->timestamp <= adjusted_time)) {
-			
-			if (_verbosity >= 1)
-				std::cout << "SIM: Injecting plot NodeID: " << diter->node_id << " DroneID: " << diter->drone_id << ", Time: " << diter->timestamp << " Lat: " << diter->latitude << ", Long: " << diter->longitude << "\n";
-			
-			_to_db.addPlot(diter->drone_id, diter->node_id, diter->timestamp, diter->latitude, diter->longitude);
-			diter = _to_db.end();
-			diter--;
-			diter->setFlags(DBFLAG_NEW | DBFLAG_USER1);
-			
-			_source_db.popFront();
-			diter = _source_db.begin();
+		if (end > next) {
+			auto start = std::chrono::steady_clock::now();
+			_to_db.addPlots(&feed.injects[next], end - next, DBFLAG_NEW | DBFLAG_USER1);
+			ingest_time.record(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			feed.injected->add(end - next);
+			next = end;
 		}
 	}
 	
-	if (_verbosity >= 2) {
-		std::cout << "SIM: Drone plot injections complete.\n";
-	}
-	
-	
+	// Nothing left for this feed to wait on, so don't hold the clock back
+	_clock.leave();
 }
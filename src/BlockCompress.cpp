@@ -0,0 +1,187 @@
+#include <stdexcept>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include "BlockCompress.h"
+
+// Matching parameters. Matches must be at least min_match long, reach back no further than
+// max_offset, and the last end_literals bytes of a block are always sent as literals.
+const size_t min_match = 4;
+const size_t max_offset = 65535;
+const size_t end_literals = 5;
+const size_t min_block = 13;
+const unsigned int hash_bits = 12;
+
+static uint32_t read32(const uint8_t *ptr) {
+	uint32_t val;
+	memcpy(&val, ptr, sizeof(val));
+	return val;
+}
+
+static uint32_t hashSeq(uint32_t seq) {
+	return (seq * 2654435761u) >> (32 - hash_bits);
+}
+
+// Extra length bytes past the 15 that fit in a token nibble: runs of 255 then the remainder
+static void putLength(std::vector<uint8_t> &out, size_t len) {
+	for (; len >= 255; len -= 255)
+		out.push_back(255);
+	out.push_back(static_cast<uint8_t>(len));
+}
+
+static size_t getLength(const uint8_t *&in, const uint8_t *end) {
+	size_t len = 0;
+	uint8_t byte;
+	do {
+		if (in >= end)
+			throw std::runtime_error("Compressed block ended in the middle of a length");
+		byte = *in++;
+		len += byte;
+	} while (byte == 255);
+	return len;
+}
+
+/*****************************************************************************************
+ * putSequence - writes one token/literals/match sequence. mlen of 0 means literals only
+ *               (the final sequence of a block).
+ *****************************************************************************************/
+static void putSequence(std::vector<uint8_t> &out, const uint8_t *lit, size_t lit_len, size_t offset, size_t mlen) {
+	size_t mcode = (mlen == 0) ? 0 : mlen - min_match;
+	out.push_back(static_cast<uint8_t>((std::min<size_t>(lit_len, 15) << 4) | std::min<size_t>(mcode, 15)));
+	
+	if (lit_len >= 15)
+		putLength(out, lit_len - 15);
+	out.insert(out.end(), lit, lit + lit_len);
+	
+	if (mlen == 0)
+		return;
+	
+	out.push_back(static_cast<uint8_t>(offset));
+	out.push_back(static_cast<uint8_t>(offset >> 8));
+	if (mcode >= 15)
+		putLength(out, mcode - 15);
+}
+
+/*****************************************************************************************
+ * compress - greedy single-probe LZ77 over the block. Each 4 byte sequence is hashed into a
+ *            table of recent positions; a hit that really matches is extended as far as it
+ *            goes and emitted as a match, otherwise we move on a byte.
+ *
+ *    Params:  in/len - the data to compress
+ *             out - replaced with the compressed block
+ *****************************************************************************************/
+void BlockCompress::compress(const uint8_t *in, size_t len, std::vector<uint8_t> &out) {
+	out.clear();
+	out.reserve(len + len / 255 + 16);
+	
+	// Uncompressed size up front as a varint so the receiver can size its buffer once
+	for (size_t val = len; ; val >>= 7) {
+		if (val < 0x80) {
+			out.push_back(static_cast<uint8_t>(val));
+			break;
+		}
+		out.push_back(static_cast<uint8_t>(val) | 0x80);
+	}
+	
+	size_t anchor = 0;
+	if (len >= min_block) {
+		std::array<int64_t, 1 << hash_bits> table;
+		table.fill(-1);
+		
+		size_t limit = len - min_block + 1;
+		size_t pos = 0;
+		while (pos < limit) {
+			uint32_t seq = read32(in + pos);
+			uint32_t h = hashSeq(seq);
+			int64_t ref = table[h];
+			table[h] = pos;
+			
+			if ((ref < 0) || (pos - ref > max_offset) || (read32(in + ref) != seq)) {
+				pos++;
+				continue;
+			}
+			
+			size_t mlen = min_match;
+			while ((pos + mlen < len - end_literals) && (in[ref + mlen] == in[pos + mlen]))
+				mlen++;
+			
+			putSequence(out, in + anchor, pos - anchor, pos - ref, mlen);
+			pos += mlen;
+			anchor = pos;
+		}
+	}
+	
+	// Whatever's left goes out as literals
+	putSequence(out, in + anchor, len - anchor, 0, 0);
+}
+
+/*****************************************************************************************
+ * decompress - expands a block made by compress
+ *
+ *    Params:  in/len - the compressed block
+ *             out - replaced with the original data
+ *             max_size - largest uncompressed size we're willing to allocate
+ *
+ *    Throws: runtime_error if the block is truncated, corrupt or too large
+ *****************************************************************************************/
+void BlockCompress::decompress(const uint8_t *in, size_t len, std::vector<uint8_t> &out, size_t max_size) {
+	const uint8_t *end = in + len;
+	
+	size_t size = 0;
+	for (unsigned int shift = 0; ; shift += 7) {
+		if ((in >= end) || (shift >= 64))
+			throw std::runtime_error("Compressed block has a bad size header");
+		uint8_t byte = *in++;
+		size |= static_cast<size_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
+	}
+	if (size > max_size)
+		throw std::runtime_error("Compressed block claims to be larger than allowed");
+	
+	out.resize(size);
+	size_t op = 0;
+	while (true) {
+		if (in >= end)
+			throw std::runtime_error("Compressed block ended without its final sequence");
+		uint8_t token = *in++;
+		
+		size_t lit_len = token >> 4;
+		if (lit_len == 15)
+			lit_len += getLength(in, end);
+		if ((lit_len > static_cast<size_t>(end - in)) || (lit_len > size - op))
+			throw std::runtime_error("Compressed block literals run past the end");
+		
+		if (lit_len > 0)
+			memcpy(out.data() + op, in, lit_len);
+		in += lit_len;
+		op += lit_len;
+		
+		// A sequence with nothing after it is the last one
+		if (in == end)
+			break;
+		
+		if (end - in < 2)
+			throw std::runtime_error("Compressed block ended in the middle of a match offset");
+		size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+		in += 2;
+		
+		size_t mlen = (token & 0x0f);
+		if (mlen == 15)
+			mlen += getLength(in, end);
+		mlen += min_match;
+		
+		if ((offset == 0) || (offset > op) || (mlen > size - op))
+			throw std::runtime_error("Compressed block has a match outside the data");
+		
+		// Byte at a time since a match may overlap the bytes it's producing
+		uint8_t *dst = out.data() + op;
+		const uint8_t *src = dst - offset;
+		for (size_t i = 0; i < mlen; i++)
+			dst[i] = src[i];
+		op += mlen;
+	}
+	
+	if (op != size)
+		throw std::runtime_error("Compressed block did not expand to its stated size");
+}
@@ -0,0 +1,114 @@
+#include "BufferPool.h"
+#include "Metrics.h"
+
+// Buffers each thread keeps for itself before handing released ones to the depot
+const size_t bufpool_thread_buffers = 8;
+
+// Limits for the global pool: buffers kept in the depot, and the biggest one worth keeping
+// (a full coalesced batch is under 400KB, a catch-up batch about 100KB)
+const size_t bufpool_global_buffers = 64;
+const size_t bufpool_global_capacity = 4 << 20;
+
+/*****************************************************************************************
+ * buffer_cache - a thread's stash of the global pool's buffers. When the thread exits its
+ *                buffers go back to the depot for the threads still running.
+ *****************************************************************************************/
+struct buffer_cache {
+	std::vector<std::vector<uint8_t>> buffers;
+	
+	~buffer_cache() {
+		if (buffers.empty())
+			return;
+		BufferPool &pool = BufferPool::global();
+		for (auto &buf : buffers)
+			pool.stash(buf);
+	}
+};
+
+static thread_local buffer_cache thread_buffers;
+
+/*****************************************************************************************
+ * BufferPool (constructor)
+ *
+ *    Params:  max_buffers - most released buffers to keep in the depot
+ *             max_capacity - buffers with more capacity than this are freed, not kept
+ *****************************************************************************************/
+BufferPool::BufferPool(size_t max_buffers, size_t max_capacity) : BufferPool(max_buffers, max_capacity, false) {
+}
+
+BufferPool::BufferPool(size_t max_buffers, size_t max_capacity, bool thread_cached) : _thread_cached(thread_cached), _max_buffers(max_buffers), _max_capacity(max_capacity),
+	_reused(MetricsRegistry::global().counter("repl_buffer_pool_reused_total", "Buffers handed out again by the buffer pool")),
+	_allocated(MetricsRegistry::global().counter("repl_buffer_pool_allocated_total", "Buffers the buffer pool had to allocate (or grow) to hand out")) {
+	_depot.reserve(max_buffers);
+}
+
+BufferPool &BufferPool::global() {
+	static BufferPool pool(bufpool_global_buffers, bufpool_global_capacity, true);
+	return pool;
+}
+
+/*****************************************************************************************
+ * acquire - hands out the thread's most recently released buffer, or one from the depot,
+ *           or a new one if there are none
+ *
+ *    Params:  reserve - capacity the caller needs (it'll grow past this as usual if needed)
+ *
+ *    Returns: an empty buffer
+ *****************************************************************************************/
+std::vector<uint8_t> BufferPool::acquire(size_t reserve) {
+	std::vector<uint8_t> buf;
+	bool found;
+	if (_thread_cached && !thread_buffers.buffers.empty()) {
+		buf.swap(thread_buffers.buffers.back());
+		thread_buffers.buffers.pop_back();
+		found = true;
+	} else
+		found = take(buf);
+	
+	if (found && (buf.capacity() >= reserve) && (buf.capacity() > 0))
+		_reused.add();
+	else
+		_allocated.add();
+	
+	buf.reserve(reserve);
+	return buf;
+}
+
+void BufferPool::release(std::vector<uint8_t> &buf) {
+	buf.clear();
+	if ((buf.capacity() == 0) || (buf.capacity() > _max_capacity)) {
+		std::vector<uint8_t>().swap(buf);
+		return;
+	}
+	
+	if (_thread_cached && (thread_buffers.buffers.size() < bufpool_thread_buffers)) {
+		thread_buffers.buffers.emplace_back();
+		thread_buffers.buffers.back().swap(buf);
+		return;
+	}
+	stash(buf);
+}
+
+size_t BufferPool::getDepotSize() {
+	std::unique_lock lk(_mutex);
+	return _depot.size();
+}
+
+void BufferPool::stash(std::vector<uint8_t> &buf) {
+	std::unique_lock lk(_mutex);
+	if (_depot.size() < _max_buffers) {
+		_depot.emplace_back();
+		_depot.back().swap(buf);
+	} else
+		std::vector<uint8_t>().swap(buf);
+}
+
+bool BufferPool::take(std::vector<uint8_t> &buf) {
+	std::unique_lock lk(_mutex);
+	if (_depot.empty())
+		return false;
+	
+	buf.swap(_depot.back());
+	_depot.pop_back();
+	return true;
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "ConnBackoff.h"
+
+ConnBackoff::ConnBackoff() : _rng(std::random_device{}()) {
+}
+
+/*********************************************************************************************
+ * setConfig - replaces the retry settings
+ *
+ *    Throws: runtime_error if the settings are inconsistent
+ *********************************************************************************************/
+void ConnBackoff::setConfig(const Config &config) {
+	if ((config.base_delay <= 0) || (config.max_delay < config.base_delay) || (config.trip_failures == 0) ||
+	    (config.open_time < 0) || (config.connect_timeout <= 0))
+		throw std::runtime_error("Invalid connection backoff settings.");
+	
+	_config = config;
+}
+
+/*********************************************************************************************
+ * canAttempt - a healthy peer can always be tried. A failing one has to wait out its delay,
+ *              and then only one connection gets to try while the rest wait on the result.
+ *              Whatever claim held before is let go first.
+ *********************************************************************************************/
+bool ConnBackoff::canAttempt(peer_id peer, clock::time_point now, Claim &claim) {
+	claim.release();
+	
+	auto it = _peers.find(peer);
+	if (it == _peers.end())
+		return true;
+	
+	peer_state &state = it->second;
+	if (state.in_flight || (now < state.next_attempt))
+		return false;
+	
+	state.in_flight = true;
+	state.claim = _next_claim++;
+	claim._backoff = this;
+	claim._peer = peer;
+	claim._id = state.claim;
+	return true;
+}
+
+void ConnBackoff::Claim::release() {
+	if (_backoff != nullptr)
+		_backoff->release(_peer, _id);
+	_backoff = nullptr;
+}
+
+// A claim reported through success() or failure(), or superseded, no longer holds anything
+void ConnBackoff::release(peer_id peer, uint64_t id) {
+	auto it = _peers.find(peer);
+	if ((it != _peers.end()) && it->second.in_flight && (it->second.claim == id))
+		it->second.in_flight = false;
+}
+
+void ConnBackoff::success(peer_id peer) {
+	_peers.erase(peer);
+}
+
+/*********************************************************************************************
+ * failure - pushes the peer's next attempt out. Ordinary retries wait base_delay * 2^(n-1),
+ *           capped at max_delay, jittered to between half and all of that. Once the circuit
+ *           opens, each failed probe holds it open for another open_time.
+ *
+ *    Returns: true if this failure is the one that opened the circuit
+ *********************************************************************************************/
+bool ConnBackoff::failure(peer_id peer, clock::time_point now) {
+	peer_state &state = _peers[peer];
+	state.failures++;
+	state.in_flight = false;
+	
+	double delay;
+	if (state.failures >= _config.trip_failures)
+		delay = _config.open_time;
+	else
+		delay = std::min(_config.max_delay, _config.base_delay * std::pow(2.0, state.failures - 1));
+	
+	std::uniform_real_distribution<double> jitter(0.5, 1.0);
+	delay *= jitter(_rng);
+	
+	state.next_attempt = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(delay));
+	return state.failures == _config.trip_failures;
+}
+
+ConnBackoff::clock::time_point ConnBackoff::nextAttempt(peer_id peer, clock::time_point now) {
+	auto it = _peers.find(peer);
+	if (it == _peers.end())
+		return clock::time_point();
+	if (it->second.in_flight)
+		return std::max(it->second.next_attempt, now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(_config.base_delay)));
+	return it->second.next_attempt;
+}
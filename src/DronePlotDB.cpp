@@ -1,15 +1,18 @@
 #include <stdexcept>
 #include <strings.h>
 #include <iostream>
-#include <fstream>
 #include <algorithm>
-#include <iomanip>
 #include <cassert>
 #include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "DronePlotDB.h"
 #include "strfuncts.h"
 #include "FileDesc.h"
+#include "PlotCodec.h"
+#include "PlotCSV.h"
+#include "PlotFile.h"
 
 
 // Short compare function for database sort by timestamp
@@ -27,18 +30,8 @@ bool compare_plot(const DronePlot &pp1, const DronePlot &pp2) {
  * DronePlot - Constructor for a drone plot object, initialized by parameters
  *****************************************************************************************/
 
-DronePlot::DronePlot(int in_droneid, int in_nodeid, int in_timestamp, float in_latitude, float in_longitude) : drone_id(in_droneid), node_id(in_nodeid), timestamp(in_timestamp), latitude(in_latitude), longitude(in_longitude), _flags(0) {
-
-}
-
-/*****************************************************************************************
- * getDataSize - returns the total size in bytes of all data stored in this object, minus
- *               the flags data. Helpful when reserving space in the vector to improve
- *               serialization efficiency.
- *****************************************************************************************/
-size_t DronePlot::getDataSize() {
+DronePlot::DronePlot(uint32_t in_droneid, uint32_t in_nodeid, int64_t in_timestamp, float in_latitude, float in_longitude) : drone_id(in_droneid), node_id(in_nodeid), timestamp(in_timestamp), latitude(in_latitude), longitude(in_longitude) {
 	
-	return sizeof(drone_id) + sizeof(node_id) + sizeof(timestamp) + sizeof(latitude) + sizeof(longitude);
 }
 
 /*****************************************************************************************
@@ -47,21 +40,14 @@ size_t DronePlot::getDataSize() {
  *
  *    Params:  buf - the vector to store the data in--in the following order:
  *             drone_id, node_id, timestamp, latitude, longitude (flags not serialized)
- *             Note: does not clear the vector, merely adds to the end.
+ *             Note: does not clear the vector, merely adds to the end. Use PlotCodec to
+ *             marshal a whole batch at once.
  *****************************************************************************************/
 void DronePlot::serialize(std::vector<uint8_t> &buf) {
+	size_t start = buf.size();
 	
-	uint8_t *dataptrs[5] = {(uint8_t *) &drone_id, (uint8_t *) &node_id, (uint8_t *) &timestamp, (uint8_t *) &latitude, (uint8_t *) &longitude};
-	uint8_t sizes[5] = {sizeof(drone_id), sizeof(node_id), sizeof(timestamp), sizeof(latitude), sizeof(longitude)};
-	
-	if (drone_id == 0)
-		throw std::runtime_error("Die");
-	// Loop through all our data variables and their sizes, and push to vector byte by byte
-	for (unsigned int i = 0; i < 5; i++) {
-		for (unsigned int j = 0; j < sizes[i]; j++, dataptrs[i]++) {
-			buf.push_back(*dataptrs[i]);
-		}
-	}
+	buf.resize(start + getDataSize());
+	PlotCodec::encodeOne(*this, buf.data() + start);
 }
 
 /*****************************************************************************************
@@ -77,19 +63,21 @@ void DronePlot::serialize(std::vector<uint8_t> &buf) {
  *****************************************************************************************/
 
 void DronePlot::deserialize(std::vector<uint8_t> &buf, unsigned int start_pt) {
-	uint8_t *dataptrs[5] = {(uint8_t *) &drone_id, (uint8_t *) &node_id, (uint8_t *) &timestamp, (uint8_t *) &latitude, (uint8_t *) &longitude};
-	uint8_t sizes[5] = {sizeof(drone_id), sizeof(node_id), sizeof(timestamp), sizeof(latitude), sizeof(longitude)};
-	
-	// Loop through all our data variables and their sizes, and read in the data
-	unsigned int vpos = start_pt;
-	for (unsigned int i = 0; i < 5; i++) {
-		for (unsigned int j = 0; j < sizes[i]; j++, dataptrs[i]++) {
-			if (vpos > buf.size())
-				throw std::runtime_error("DronePlot deserialize ran out of data in vector buffer prematurely");
-			*dataptrs[i] = buf[vpos++];
-		}
-	}
+	if (start_pt + getDataSize() > buf.size())
+		throw std::runtime_error("DronePlot deserialize ran out of data in vector buffer prematurely");
 	
+	deserialize(buf.data() + start_pt);
+}
+
+/*****************************************************************************************
+ * deserialize - same as above, but reads one record directly from a raw buffer with no
+ *               bounds checking, so a batch can be decoded in place
+ *
+ *    Params:  buf - points at the start of a record at least getDataSize() bytes long
+ *****************************************************************************************/
+
+void DronePlot::deserialize(const uint8_t *buf) {
+	PlotCodec::decodeOne(buf, *this);
 }
 
 /*****************************************************************************************
@@ -98,46 +86,7 @@ void DronePlot::deserialize(std::vector<uint8_t> &buf, unsigned int start_pt) {
  *    Returns: -1 for failure, 0 otherwise
  *****************************************************************************************/
 int DronePlot::readCSV(std::string &buf) {
-	std::string::size_type commapos;
-	std::string data;
-	unsigned int startpos = 0;
-	
-	// Loop and get the first four data points
-	for (unsigned int i = 0; i < 4; i++) {
-		
-		// Find the next comma
-		commapos = buf.find(',', startpos);
-		if (commapos == std::string::npos)
-			return -1;
-		
-		// Get the substring of our target variable
-		data = buf.substr(startpos, commapos - startpos);
-		
-		// Now load the data
-		switch (i) {
-			case 0:
-				drone_id = std::stoi(data);
-				break;
-			case 1:
-				node_id = std::stoi(data);
-				break;
-			case 2:
-				timestamp = (time_t) std::stoi(data);
-				break;
-			case 3:
-				latitude = std::stof(data);
-				break;
-			default:
-				throw std::runtime_error("This should not have happened");
-		}
-		startpos = commapos + 1;
-	}
-	
-	// Now get the final float
-	data = buf.substr(startpos, buf.size());
-	longitude = std::stof(data);
-	
-	return 0;
+	return PlotCSV::parseLine(buf.data(), buf.data() + buf.size(), *this) ? 0 : -1;
 }
 
 /*****************************************************************************************
@@ -145,34 +94,11 @@ int DronePlot::readCSV(std::string &buf) {
  *
  *****************************************************************************************/
 void DronePlot::writeCSV(std::string &buf) {
-	std::stringstream tmpbuf;
+	char line[PlotCSV::max_line];
 	
-	tmpbuf << drone_id << "," << node_id << "," << timestamp << "," << std::setprecision(10) << latitude << "," << longitude << "\n";
-	buf = tmpbuf.str();
+	buf.assign(line, PlotCSV::formatLine(*this, line));
 }
 
-/*****************************************************************************************
- * setFlags - turns on the indicated flags
- * clrFlags - disables the indicated flags
- * isFlagSet - returns true if the flag is set
- *
- *    Params: flags - a bit mask to indicate the desired flag, using defines.
- *                   so: clrFlags(DBFLAG_SYNCD);
- *****************************************************************************************/
-
-void DronePlot::setFlags(unsigned short flags) {
-	_flags |= flags;
-}
-
-void DronePlot::clrFlags(unsigned short flags) {
-	_flags &= (unsigned short) ~flags;
-}
-
-bool DronePlot::isFlagSet(unsigned short flags) {
-	return (bool) (_flags & flags);
-}
-
-
 /*****************************************************************************************
  * addPlot - Adds a plot object at the end of the doubly-linked list
  *
@@ -184,84 +110,110 @@ bool DronePlot::isFlagSet(unsigned short flags) {
  *             
  *****************************************************************************************/
 
-void DronePlotDB::addPlot(int drone_id, int node_id, time_t timestamp, float latitude, float longitude) {
+void DronePlotDB::addPlot(uint32_t drone_id, uint32_t node_id, int64_t timestamp, float latitude, float longitude) {
 	std::unique_lock lk(_mutex);
 	
 	_dbdata.emplace_back(drone_id, node_id, timestamp, latitude, longitude);
+	_add_count++;
+}
+
+/*****************************************************************************************
+ * addPlots - Adds a run of serialized plots (as produced by DronePlot::serialize) to the end
+ *            of the list, taking the lock once for the whole batch
+ *
+ *    Params:  data - points at the first record; must hold count * getDataSize() bytes
+ *             count - the number of records to add
+ *             flags - flags to set on each new plot
+ *
+ *****************************************************************************************/
+
+void DronePlotDB::addPlots(const uint8_t *data, size_t count, unsigned short flags) {
+	std::unique_lock lk(_mutex);
+	
+	PlotCodec::decode(data, count, [this, flags](DronePlot &plot) {
+		_dbdata.emplace_back(plot).setFlags(flags);
+	});
+	_add_count += count;
+}
+
+void DronePlotDB::addPlots(const DronePlot *plots, size_t count, unsigned short flags) {
+	std::unique_lock lk(_mutex);
+	
+	// Copies keep nothing of the originals' flags; they get exactly the ones passed in
+	for (size_t i = 0; i < count; i++) {
+		DronePlot &plot = _dbdata.emplace_back(plots[i]);
+		plot.clrFlags(UINT16_MAX);
+		plot.setFlags(flags);
+	}
+	_add_count += count;
 }
 
 /*****************************************************************************************
  * loadCSVFile - loads in a CSV file containing the plot entries in the right order. The
- *               order should be (no spaces around commas):
+ *               order should be:
  *               drone_id,node_id,timestamp,latitude,longitude
  *
  *    Params:  filename - the path/filename of the CSV file to load
+ *             threads - most threads to parse with (0 = one per core)
  *
- *    Returns: -1 if there was an issue reading the file, otherwise num read in
+ *    Returns: -1 if there was an issue reading the file or any line was malformed (nothing
+ *             is added in that case), otherwise num read in
  *
  *****************************************************************************************/
 
-int DronePlotDB::loadCSVFile(const char *filename) {
-	
-	std::ifstream cfile;
+int DronePlotDB::loadCSVFile(const char *filename, unsigned int threads) {
 	
-	// Open our file stream with default read settings
-	cfile.open(filename);
-	if (cfile.fail())
+	// Parse the whole file before touching the database, so a bad line leaves it as it was
+	std::vector<DronePlot> plots;
+	if (PlotCSV::parseFile(filename, plots, threads) < 0)
 		return -1;
 	
-	// Get line by line, parsing out our data
-	std::string buf, data;
-	int count = 0;
-	DronePlotDBIterator newplot;
-	
-	while (!cfile.eof()) {
-		std::getline(cfile, buf);
-		
-		if (buf.empty())
-			continue;
-		
-		// Add this to the end and get an iterator pointing to it
-		_dbdata.emplace_back(-1, -1, 0, 0.0, 0.0);
-		newplot = _dbdata.end();
-		newplot--;
-		
-		if (newplot->readCSV(buf) == -1)
-			return -1;
-		
-		// Add it to the database
-		count++;
-	}
-	cfile.close();
-	return count;
+	_dbdata.insert(_dbdata.end(), plots.begin(), plots.end());
+	return (int) plots.size();
 }
 
 /*****************************************************************************************
- * writeCSVFile - writes the database in order to a CSV text file. The order is:
- *               drone_id,node_id,timestamp,latitude,longitude
+ * writeCSVFile - writes the database in order to a CSV text file (replacing it). The order
+ *               is: drone_id,node_id,timestamp,latitude,longitude
  *
  *    Params:  filename - the path/filename of the CSV file to write to
+ *             threads - most threads to format with (0 = one per core)
  *
- *    Returns: -1 if there was an issue reading the file, otherwise num read in
+ *    Returns: -1 if there was an issue opening or writing the file, otherwise num written
  *
  *****************************************************************************************/
 
-int DronePlotDB::writeCSVFile(const char *filename) {
-	std::ofstream cfile;
-	int count = 0;
-	
-	cfile.open(filename);
-	if (cfile.fail())
+int DronePlotDB::writeCSVFile(const char *filename, unsigned int threads) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
 		return -1;
 	
-	std::string buf;
-	for (auto & data : _dbdata) {
-		data.writeCSV(buf);
-		cfile << buf;
+	long count = writeCSV(fd, threads);
+	if (close(fd) != 0)
+		return -1;
+	return (int) count;
+}
+
+/*****************************************************************************************
+ * writeCSV - copies the database out under the lock, then formats and writes the copy with
+ *            PlotCSV::write, so the antenna and replication threads are only held up for the
+ *            copy and not for the formatting or the disk
+ *
+ *    Params:  fd - an open, writable file descriptor (left open)
+ *             threads - most threads to format with (0 = one per core)
+ *
+ *    Returns: -1 if a write failed, otherwise num written
+ *
+ *****************************************************************************************/
+
+long DronePlotDB::writeCSV(int fd, unsigned int threads) {
+	std::vector<DronePlot> snapshot;
+	{
+		std::unique_lock lk(_mutex);
+		snapshot.assign(_dbdata.begin(), _dbdata.end());
 	}
 	
-	cfile.close();
-	return count;
+	return PlotCSV::write(fd, snapshot.data(), snapshot.size(), threads);
 }
 
 
@@ -282,64 +234,49 @@ int DronePlotDB::writeBinaryFile(const char *filename) {
 	if (!outfile.openFile(FileFD::writefd, true))
 		return -1;
 	
-	// Prep our vector that will be storing our plotpt data with exactly the right size
+	// Marshal the whole database in one pass into an exactly-sized buffer
 	std::vector<uint8_t> plot;
-	unsigned int ppsize = DronePlot::getDataSize() * _dbdata.size();
-	plot.reserve(ppsize);
-	
-	// Loop through all data points and write them to our binary vector
-	for (auto & data : _dbdata) {
-		data.serialize(plot);
-		count++;
-	}
+	count = PlotCodec::encode(_dbdata.begin(), _dbdata.end(), plot);
 	
 	// Write it to a file
 	std::cout << "Writing count: " << plot.size() << "\n";
-	outfile.writeBytes<uint8_t>(plot);
+	outfile.writeFD(reinterpret_cast<const char *>(plot.data()), plot.size());
 	
 	return count;
 }
 
 /*****************************************************************************************
- * loadBinaryFile - reads the contents of a binary dump of the data into the database
+ * loadBinaryFile - reads the contents of a binary dump of the data into the database. Takes
+ *                  any of the PlotFile layouts (raw, versioned or compressed)
  *
  *    Params:  filename - the path/filename of the input file
  *
- *    Returns: -1 if there was an issue opening the file, otherwise num read in 
+ *    Returns: -1 if there was an issue opening the file or it was corrupt (whatever came
+ *             before the bad spot stays loaded), otherwise num read in
  *
  *****************************************************************************************/
 
 int DronePlotDB::loadBinaryFile(const char *filename) {
-	std::vector<uint8_t> buf;
-	DronePlotDBIterator dptr;
-	
-	FileFD infile(filename);
+	PlotFileReader infile;
 	int count = 0;
 	
-	if (!infile.openFile(FileFD::readfd))
+	if (!infile.open(filename))
 		return -1;
 	
-	// Loop through grabbing the bytes of each plotpt
-	unsigned int size = 0;
-	unsigned int ppsize = DronePlot::getDataSize();
-	while ((size = infile.readBytes<uint8_t>(buf, ppsize)) == ppsize) {
-		_dbdata.emplace_back();
-		dptr = _dbdata.end();
-		dptr--;
-		
-		// Deserialize
-		dptr->deserialize(buf);
-		buf.clear();
-		
-		count++;
-	}
-	
-	// Final read should be size = 0 or this may be a corrupted file
-	if (size != 0) {
+	// Read the file a block of plots at a time and decode each block in bulk
+	std::vector<uint8_t> buf;
+	try {
+		while (infile.next(buf)) {
+			size_t nplots = buf.size() / DronePlot::getDataSize();
+			PlotCodec::decode(buf.data(), nplots, [this](DronePlot &plot) {
+				_dbdata.push_back(plot);
+			});
+			count += nplots;
+		}
+	} catch (std::runtime_error &) {
 		return -1;
 	}
 	
-	infile.closeFD();
 	return count;
 }
 
@@ -405,6 +342,40 @@ void DronePlotDB::removeNodeID(unsigned int node_id) {
 	}
 }
 
+/*****************************************************************************************
+ * evictBefore - takes a node's plots timestamped before horizon out of the database, so old
+ *               data can be archived and the database (and every pass over it) stays the size
+ *               of the retention window. Plots still flagged DBFLAG_NEW haven't gone out to
+ *               the other servers yet, so they stay until they have.
+ *
+ *               The walk stops at the first plot at or past the horizon, so it only costs
+ *               the old end of the list. The database is in time order after each dedup pass;
+ *               an old plot sitting behind a newer one just waits for a later pass.
+ *
+ *    Params:  horizon - plots with a timestamp before this are evicted
+ *             node_id - only this node's plots are evicted (ReplServer passes the leader,
+ *                       whose clock the skew corrected plots are on)
+ *             evicted - cleared, then filled with the evicted plots in database order
+ *
+ *    Returns: number of plots evicted
+ *
+ *****************************************************************************************/
+
+size_t DronePlotDB::evictBefore(int64_t horizon, unsigned int node_id, std::vector<DronePlot> &evicted) {
+	std::unique_lock lk(_mutex);
+	
+	evicted.clear();
+	auto evict_iter = _dbdata.begin();
+	while ((evict_iter != _dbdata.end()) && (evict_iter->timestamp < horizon)) {
+		if ((evict_iter->node_id == node_id) && !evict_iter->isFlagSet(DBFLAG_NEW)) {
+			evicted.push_back(*evict_iter);
+			evict_iter = _dbdata.erase(evict_iter);
+		} else
+			evict_iter++;
+	}
+	return evicted.size();
+}
+
 /*****************************************************************************************
  * sortByTime - sort the database from earliest timestamp to latest
  *
@@ -422,4 +393,5 @@ void DronePlotDB::sortByTime() {
 
 void DronePlotDB::clear() {
 	_dbdata.clear();
+	_pool.release();
 }
@@ -0,0 +1,140 @@
+#include <cstring>
+#include "EventLog.h"
+#include "exceptions.h"
+
+// Write out a batch once this many records have been pulled off the queue
+const size_t evlog_write_batch = 1024;
+
+static const char *event_names[ev_count] = {
+	"none", "connect_start", "connect_done", "connect_fail", "accept", "auth_start", "auth_ok",
+	"auth_fail", "resume_sent", "resume_ok", "resume_refused", "batch_sent", "batch_acked",
+	"batch_recv", "plots_added", "dropped"
+};
+
+EventLog::EventLog(size_t queue_size) : _queue(queue_size) {
+}
+
+
+EventLog::~EventLog() {
+	close();
+}
+
+/*******************************************************************************************
+ * open - truncates filename, writes the header and starts the writer thread
+ *
+ *    Throws: logfile_error if the file can't be opened or written
+ *******************************************************************************************/
+void EventLog::open(const char *filename) {
+	close();
+	
+	if ((_fptr = fopen(filename, "wb")) == NULL)
+		throw logfile_error("Unable to open event log file for writing.");
+	
+	evlog_header header;
+	memcpy(header.magic, evlog_magic, sizeof(header.magic));
+	header.version = evlog_version;
+	header.record_size = sizeof(event_record);
+	header.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	header.mono_ns = now();
+	if (fwrite(&header, sizeof(header), 1, _fptr) != 1) {
+		fclose(_fptr);
+		_fptr = NULL;
+		throw logfile_error("Unable to write event log header.");
+	}
+	
+	_write_buf.reserve(evlog_write_batch);
+	_stop = false;
+	_writer = std::thread(&EventLog::writerThread, this);
+	_open = true;
+}
+
+// Stops recording, writes out whatever is still queued and closes the file
+void EventLog::close() {
+	if (!_writer.joinable())
+		return;
+	
+	_open = false;
+	_stop = true;
+	_wake.notify_one();
+	_writer.join();
+	
+	fclose(_fptr);
+	_fptr = NULL;
+}
+
+/*******************************************************************************************
+ * record - queues one event. Safe to call from any thread.
+ *
+ *    Params:  peer - the server this is about, or no_peer
+ *             conn - the connection's serial number from newConnID, or 0
+ *             a0-a2 - event specific numbers (see event_type)
+ *******************************************************************************************/
+void EventLog::record(event_type event, peer_id peer, uint32_t conn, uint64_t a0, uint64_t a1, uint64_t a2) {
+	if (!_open.load(std::memory_order_relaxed))
+		return;
+	
+	event_record rec = {};
+	rec.ts_ns = now();
+	rec.conn = conn;
+	rec.peer = peer;
+	rec.event = event;
+	rec.args[0] = a0;
+	rec.args[1] = a1;
+	rec.args[2] = a2;
+	
+	if (!_queue.tryPush(std::move(rec))) {
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		_total_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+uint64_t EventLog::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *EventLog::eventName(uint16_t event) {
+	if (event >= ev_count)
+		return "unknown";
+	return event_names[event];
+}
+
+/*******************************************************************************************
+ * writerThread - writes out the queue every flush interval until close(), then once more
+ *******************************************************************************************/
+void EventLog::writerThread() {
+	while (!_stop) {
+		{
+			std::unique_lock<std::mutex> lk(_wake_mutex);
+			_wake.wait_for(lk, evlog_flush_interval, [this] { return _stop.load(); });
+		}
+		drain();
+	}
+	drain();
+}
+
+void EventLog::drain() {
+	event_record rec;
+	while (_queue.tryPop(rec)) {
+		_write_buf.push_back(rec);
+		if (_write_buf.size() >= evlog_write_batch) {
+			fwrite(_write_buf.data(), sizeof(event_record), _write_buf.size(), _fptr);
+			_write_buf.clear();
+		}
+	}
+	
+	unsigned long dropped = _dropped.exchange(0, std::memory_order_relaxed);
+	if (dropped > 0) {
+		event_record lost = {};
+		lost.ts_ns = now();
+		lost.peer = no_peer;
+		lost.event = ev_dropped;
+		lost.args[0] = dropped;
+		_write_buf.push_back(lost);
+	}
+	
+	if (!_write_buf.empty()) {
+		fwrite(_write_buf.data(), sizeof(event_record), _write_buf.size(), _fptr);
+		_write_buf.clear();
+	}
+	fflush(_fptr);
+}
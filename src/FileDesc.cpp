@@ -5,6 +5,7 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <cerrno>
 #include <unistd.h>
 
 #include "FileDesc.h"
@@ -143,10 +144,12 @@ bool FileDesc::isOpen() {
 }
 
 /***************************************************************************************
- * closeFD - closes the FD cleanly
+ * closeFD - closes the FD cleanly and marks it closed so it can't be closed twice
  ***************************************************************************************/
 void FileDesc::closeFD() {
-	close(_fd);
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
 }
 
 /****************************************************************************************
@@ -166,8 +169,9 @@ SocketFD::SocketFD() : FileDesc() {
 	bzero(&_fd_addr, sizeof(_fd_addr));
 }
 
+// Closes the socket if it's still open, so dropped connections don't leak their FD
 SocketFD::~SocketFD() {
-
+	closeFD();
 }
 
 /*****************************************************************************************
@@ -225,20 +229,87 @@ bool SocketFD::connectTo(const char *ip_addr, unsigned short port) {
 }
 
 bool SocketFD::connectTo(unsigned long ip_addr, unsigned short port) {
+	// Don't leak whatever socket we had before (the constructor's, or a failed attempt's)
+	closeFD();
 	if ((_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
 		throw socket_error("Socket creation failed.");
 	
 	// Load the socket information to prep for binding
+	setAddr(ip_addr, port);
+	
+	if (connect(_fd, (struct sockaddr *) &_fd_addr, sizeof(_fd_addr)) != 0)
+		return false;
+	
+	return true;
+	
+}
+
+/*****************************************************************************************
+ * setAddr - sets the address a later connectAsync will connect to
+ *
+ *    Params:  ip_addr - IP address in network format
+ *             port - port in network format
+ *****************************************************************************************/
+
+void SocketFD::setAddr(unsigned long ip_addr, unsigned short port) {
 	bzero(&_fd_addr, sizeof(_fd_addr));
 	_fd_addr.sin_family = AF_INET;
 	_fd_addr.sin_addr.s_addr = ip_addr;
 	_fd_addr.sin_port = port;
+}
+
+/*****************************************************************************************
+ * connectAsync - opens a fresh non-blocking socket and starts connecting it to the address
+ *                from setAddr, without waiting for the handshake to finish
+ *
+ *    Returns: true if it connected immediately, false if the connect is in progress
+ *
+ *    Throws: socket_error if the socket couldn't be created or the connect failed outright
+ *****************************************************************************************/
+
+bool SocketFD::connectAsync() {
+	closeFD();
+	if ((_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		throw socket_error("Socket creation failed.");
+	setNonBlocking();
 	
-	if (connect(_fd, (struct sockaddr *) &_fd_addr, sizeof(_fd_addr)) != 0)
+	if (connect(_fd, (struct sockaddr *) &_fd_addr, sizeof(_fd_addr)) == 0)
+		return true;
+	
+	if (errno != EINPROGRESS)
+		throw socket_error(std::string("Connect failed: ") + strerror(errno));
+	return false;
+}
+
+/*****************************************************************************************
+ * checkConnect - polls an in-progress connectAsync. The socket turns writable when the
+ *                connect finishes either way, and SO_ERROR says which way it went.
+ *
+ *    Returns: true if connected, false if still in progress
+ *
+ *    Throws: socket_error if the connect failed
+ *****************************************************************************************/
+
+bool SocketFD::checkConnect() {
+	fd_set write_fds;
+	timeval timeout = {0, 0};
+	
+	FD_ZERO(&write_fds);
+	FD_SET(_fd, &write_fds);
+	
+	int n;
+	if ((n = select(_fd + 1, NULL, &write_fds, NULL, &timeout)) == -1)
+		throw socket_error("Select error on connecting socket.");
+	if (n == 0)
 		return false;
 	
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+		throw socket_error("getsockopt failure reading SO_ERROR");
+	if (err != 0)
+		throw socket_error(std::string("Connect failed: ") + strerror(err));
 	return true;
-	
 }
 
 /*****************************************************************************************
@@ -267,6 +338,7 @@ void SocketFD::listenFD(int backlog) {
 bool SocketFD::acceptFD(SocketFD &server) {
 	socklen_t len = sizeof(_fd_addr);
 	
+	closeFD();
 	_fd = accept(server.getFD(), (struct sockaddr *) &_fd_addr, &len);
 	if (_fd == -1)
 		return false;
@@ -7,14 +7,23 @@
 #include "strfuncts.h"
 #include "exceptions.h"
 
+// Write out a batch once it gets this big rather than growing the buffer further
+const size_t log_write_batch = 64 * 1024;
 
-// Log manager, supports log_lvl for verbosity control
-LogMgr::LogMgr(const char *log_file, unsigned int log_lvl) : _log_file(log_file), _log_lvl(log_lvl) {
 
+// Log manager, supports log_lvl for verbosity control
+LogMgr::LogMgr(const char *log_file, unsigned int log_lvl, size_t queue_size) : _log_file(log_file), _log_lvl(log_lvl), _queue(queue_size) {
+	_write_buf.reserve(log_write_batch);
+	_writer = std::thread(&LogMgr::writerThread, this);
 }
 
 
 LogMgr::~LogMgr() {
+	_stop = true;
+	_wake.notify_one();
+	if (_writer.joinable())
+		_writer.join();
+	
 	closeLog();
 }
 
@@ -35,10 +44,12 @@ void LogMgr::createTimestamp(std::string &buf) {
 }
 
 /***************************************************************************************************
- * writeLog - Writes a string to a log with the timestamp
+ * writeLog - Queues a string to be written to the log with the timestamp
  *
  *    Params:  str - string to write to the log in const char * or std::string format
  *             lvl - the "importance" of this log - can be used to set verbosity
+ *
+ *    Throws: logfile_error if the writer couldn't open the log file since the last call
  ***************************************************************************************************/
 
 void LogMgr::writeLog(const char *str, unsigned int lvl) {
@@ -47,25 +58,24 @@ void LogMgr::writeLog(const char *str, unsigned int lvl) {
 	if (lvl > _log_lvl)
 		return;
 	
-	// If the file is not open yet, open it
-	if (_lfptr == NULL) {
-		if ((_lfptr = fopen(_log_file.c_str(), "a+")) == NULL) {
-			throw logfile_error("Unable to open log file to append.");
-		}
-	}
-	
-	// Put together our timestamp and start the log with the stamp
-	std::string logstr;
-	createTimestamp(logstr);
+	if (_open_failed.exchange(false, std::memory_order_relaxed))
+		throw logfile_error("Unable to open log file to append.");
 	
-	// Now add on the text to log
-	logstr += " ";
-	logstr += str;
-	logstr += "\n";
+	log_record rec;
+	rec.when = time(NULL);
+	size_t len = strnlen(str, log_record_text);
+	memcpy(rec.text, str, len);
+	rec.len = len;
 	
-	fputs(logstr.c_str(), _lfptr);
-	fflush(_lfptr);
+	if (!_queue.tryPush(std::move(rec))) {
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		_total_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
 	
+	// Getting full - wake the writer early instead of waiting out the flush interval
+	if ((_queue.sizeApprox() >= _queue.capacity() / 4) && !_wake_pending.exchange(true))
+		_wake.notify_one();
 }
 
 void LogMgr::writeLog(std::string &str, unsigned int lvl) {
@@ -91,8 +101,97 @@ void LogMgr::strerrLog(const char *str, unsigned int lvl) {
 	return writeLog(logstr.c_str(), lvl);
 }
 
-// self-explanatory
+/***************************************************************************************************
+ * writerThread - sleeps for the flush interval (or until a producer says the queue is filling)
+ *                and writes out whatever has been queued. Drains once more on the way out.
+ ***************************************************************************************************/
+void LogMgr::writerThread() {
+	while (!_stop) {
+		{
+			std::unique_lock<std::mutex> lk(_wake_mutex);
+			_wake.wait_for(lk, _flush_interval.load(), [this] { return _stop || _wake_pending; });
+		}
+		_wake_pending = false;
+		
+		std::lock_guard<std::mutex> lk(_file_mutex);
+		drain();
+	}
+	
+	std::lock_guard<std::mutex> lk(_file_mutex);
+	drain();
+}
+
+/***************************************************************************************************
+ * drain - empties the queue into the log file in batches. Only one thread drains at a time (the
+ *         one holding _file_mutex) so lines stay in the order they were queued.
+ ***************************************************************************************************/
+void LogMgr::drain() {
+	log_record rec;
+	while (_queue.tryPop(rec)) {
+		_write_buf += stamp(rec.when);
+		_write_buf += " ";
+		_write_buf.append(rec.text, rec.len);
+		_write_buf += "\n";
+		
+		if (_write_buf.size() >= log_write_batch)
+			writeOut();
+	}
+	
+	unsigned long dropped = _dropped.exchange(0, std::memory_order_relaxed);
+	if (dropped > 0) {
+		_write_buf += stamp(time(NULL));
+		_write_buf += " Log queue full, dropped ";
+		_write_buf += std::to_string(dropped);
+		_write_buf += " log entries.\n";
+	}
+	
+	if (!_write_buf.empty())
+		writeOut();
+}
+
+/***************************************************************************************************
+ * writeOut - writes the batch buffer to the file, opening it first if needed. If it can't be
+ *            opened the batch is lost and the next writeLog call finds out. _file_mutex must be held.
+ ***************************************************************************************************/
+void LogMgr::writeOut() {
+	// If the file is not open yet, open it
+	if (_lfptr == NULL) {
+		if ((_lfptr = fopen(_log_file.c_str(), "a+")) == NULL) {
+			_open_failed = true;
+			_write_buf.clear();
+			return;
+		}
+	}
+	
+	fwrite(_write_buf.data(), 1, _write_buf.size(), _lfptr);
+	fflush(_lfptr);
+	_write_buf.clear();
+}
+
+// The timestamp text for when - ctime_r is only worth calling when the second changes
+const std::string &LogMgr::stamp(time_t when) {
+	if ((when != _stamp_time) || _stamp.empty()) {
+		char timestr[27];
+		if (ctime_r(&when, timestr) != NULL) {
+			_stamp = timestr;
+			clrNewlines(_stamp);
+			_stamp_time = when;
+		}
+	}
+	return _stamp;
+}
+
+// Writes out everything queued so far before returning
+void LogMgr::flush() {
+	std::lock_guard<std::mutex> lk(_file_mutex);
+	drain();
+}
+
+// self-explanatory (writes out anything still queued first)
 void LogMgr::closeLog() {
+	std::lock_guard<std::mutex> lk(_file_mutex);
+	drain();
+	
 	if (_lfptr != NULL) {
 		fclose(_lfptr);
 		_lfptr = NULL;
@@ -101,11 +200,18 @@ void LogMgr::closeLog() {
 
 
 /***************************************************************************************************
- * changeFilename - Changes the filename the log file is set to write to
+ * changeFilename - Changes the filename the log file is set to write to. Anything already queued
+ *                  goes to the old file.
  *
  ***************************************************************************************************/
 
 void LogMgr::changeFilename(const char *filename) {
-	closeLog();
+	std::lock_guard<std::mutex> lk(_file_mutex);
+	drain();
+	
+	if (_lfptr != NULL) {
+		fclose(_lfptr);
+		_lfptr = NULL;
+	}
 	_log_file = filename;
 }
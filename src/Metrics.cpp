@@ -0,0 +1,135 @@
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include "Metrics.h"
+
+// One bucket past the range catches everything bigger
+Histogram::Histogram(double max_seconds) : _buckets(bucketFor(static_cast<uint64_t>(max_seconds * 1e6)) + 2) {
+	if (max_seconds <= 0)
+		throw std::runtime_error("Histogram range must be greater than zero");
+}
+
+/*******************************************************************************************
+ * bucketFor - which bucket a value goes in. Values below hist_sub_buckets get one each;
+ *             past that, a value whose highest set bit is b goes in one of the sub-buckets
+ *             for b, picked by the hist_sub_bits just below it.
+ *******************************************************************************************/
+size_t Histogram::bucketFor(uint64_t usec) {
+	if (usec < hist_sub_buckets)
+		return usec;
+	
+	unsigned int top = 63 - __builtin_clzll(usec);
+	uint64_t sub = (usec >> (top - hist_sub_bits)) & (hist_sub_buckets - 1);
+	return (top - hist_sub_bits + 1) * hist_sub_buckets + sub;
+}
+
+uint64_t Histogram::bucketLimit(size_t bucket) {
+	if (bucket < hist_sub_buckets)
+		return bucket;
+	
+	unsigned int top = bucket / hist_sub_buckets + hist_sub_bits - 1;
+	uint64_t sub = bucket % hist_sub_buckets;
+	return ((hist_sub_buckets + sub + 1) << (top - hist_sub_bits)) - 1;
+}
+
+// Rounds up so a bucket's limit is a true upper bound on everything in it
+void Histogram::record(double seconds) {
+	recordUsec((seconds > 0) ? static_cast<uint64_t>(std::ceil(seconds * 1e6)) : 0);
+}
+
+void Histogram::recordUsec(uint64_t usec) {
+	size_t bucket = std::min(bucketFor(usec), _buckets.size() - 1);
+	_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	_sum_usec.fetch_add(usec, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+MetricsRegistry &MetricsRegistry::global() {
+	static MetricsRegistry registry;
+	return registry;
+}
+
+// Finds or adds the family for name. _mutex must be held
+MetricsRegistry::family &MetricsRegistry::getFamily(const std::string &name, const std::string &help) {
+	for (auto &fam : _families) {
+		if (fam->name == name)
+			return *fam;
+	}
+	
+	_families.push_back(std::make_unique<family>());
+	_families.back()->name = name;
+	_families.back()->help = help;
+	return *_families.back();
+}
+
+/*******************************************************************************************
+ * counter/histogram - registers a metric (or finds the one already registered)
+ *
+ *    Throws: runtime_error if name is already in use by the other kind of metric
+ *******************************************************************************************/
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help, const std::string &labels) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	family &fam = getFamily(name, help);
+	if (fam.histogram)
+		throw std::runtime_error("Metric '" + name + "' is already registered as a histogram");
+	
+	for (auto &counter : fam.counters) {
+		if (counter.first == labels)
+			return *counter.second;
+	}
+	
+	fam.counters.emplace_back(labels, std::make_unique<Counter>());
+	return *fam.counters.back().second;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help, double max_seconds) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	family &fam = getFamily(name, help);
+	if (!fam.counters.empty())
+		throw std::runtime_error("Metric '" + name + "' is already registered as a counter");
+	
+	if (!fam.histogram)
+		fam.histogram = std::make_unique<Histogram>(max_seconds);
+	return *fam.histogram;
+}
+
+/*******************************************************************************************
+ * render - writes every metric in the Prometheus text exposition format. Histogram buckets
+ *          are cumulative with their upper bounds in seconds, as Prometheus expects. The
+ *          values are read without stopping the writers, so a histogram's count can be a
+ *          hair ahead of its buckets.
+ *******************************************************************************************/
+void MetricsRegistry::render(std::string &out) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	std::ostringstream text;
+	
+	for (auto &fam : _families) {
+		text << "# HELP " << fam->name << " " << fam->help << "\n";
+		
+		if (!fam->histogram) {
+			text << "# TYPE " << fam->name << " counter\n";
+			for (auto &counter : fam->counters) {
+				text << fam->name;
+				if (!counter.first.empty())
+					text << "{" << counter.first << "}";
+				text << " " << counter.second->get() << "\n";
+			}
+			continue;
+		}
+		
+		Histogram &hist = *fam->histogram;
+		text << "# TYPE " << fam->name << " histogram\n";
+		uint64_t cumulative = 0;
+		for (size_t bucket = 0; bucket + 1 < hist.numBuckets(); bucket++) {
+			cumulative += hist.bucketCount(bucket);
+			text << fam->name << "_bucket{le=\"" << std::setprecision(15) << Histogram::bucketLimit(bucket) / 1e6 << "\"} " << cumulative << "\n";
+		}
+		cumulative += hist.bucketCount(hist.numBuckets() - 1);
+		text << fam->name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+		text << fam->name << "_sum " << std::setprecision(9) << hist.getSumUsec() / 1e6 << "\n";
+		text << fam->name << "_count " << cumulative << "\n";
+	}
+	
+	out = text.str();
+}
@@ -0,0 +1,104 @@
+#include <unistd.h>
+#include <cerrno>
+#include <sys/socket.h>
+#include "MetricsServer.h"
+
+// Scrapers get this long to send their request, and requests can't be bigger than this
+const std::chrono::seconds metrics_client_timeout(5);
+const size_t max_metrics_request = 8192;
+const size_t max_metrics_clients = 16;
+
+MetricsServer::MetricsServer(MetricsRegistry &registry) : _registry(registry) {
+}
+
+/*******************************************************************************************
+ * bindSvr - binds the listening socket (non-blocking, so accepts never wait) and listens
+ *
+ *    Throws: socket_error if the bind or listen fails
+ *******************************************************************************************/
+void MetricsServer::bindSvr(const char *ip_addr, unsigned short port) {
+	_sockfd.setNonBlocking();
+	_sockfd.setReusable();
+	_sockfd.bindFD(ip_addr, port);
+	_sockfd.listenFD(5);
+	_listening = true;
+}
+
+void MetricsServer::handle() {
+	if (!_listening)
+		return;
+	
+	// Take any new connections, as long as we're not already swamped
+	while ((_clients.size() < max_metrics_clients) && _sockfd.hasData(0)) {
+		client conn;
+		conn.fd = std::make_unique<SocketFD>();
+		if (!conn.fd->acceptFD(_sockfd))
+			break;
+		conn.fd->setNonBlocking();
+		conn.start = std::chrono::steady_clock::now();
+		_clients.push_back(std::move(conn));
+	}
+	
+	auto it = _clients.begin();
+	while (it != _clients.end()) {
+		if (service(*it))
+			it++;
+		else
+			it = _clients.erase(it);
+	}
+}
+
+/*******************************************************************************************
+ * service - reads whatever a client has sent until its request is complete, then writes as
+ *           much of the response as the socket will take
+ *
+ *    Returns: false once the client is finished with (or given up on) and should be closed
+ *******************************************************************************************/
+bool MetricsServer::service(client &conn) {
+	if (std::chrono::steady_clock::now() - conn.start > metrics_client_timeout)
+		return false;
+	
+	if (conn.response.empty()) {
+		char buf[1024];
+		ssize_t got;
+		while ((got = read(conn.fd->getFD(), buf, sizeof(buf))) > 0) {
+			conn.request.append(buf, got);
+			if (conn.request.size() > max_metrics_request)
+				return false;
+		}
+		
+		// Headers are done at the blank line--that's all we need
+		if ((conn.request.find("\r\n\r\n") == std::string::npos) && (conn.request.find("\n\n") == std::string::npos))
+			return got != 0;
+		
+		respond(conn);
+	}
+	
+	// MSG_NOSIGNAL so a scraper that hangs up early doesn't take the server down with SIGPIPE
+	ssize_t wrote = send(conn.fd->getFD(), conn.response.data(), conn.response.size(), MSG_NOSIGNAL);
+	if (wrote > 0)
+		conn.response.erase(0, wrote);
+	else if ((wrote < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+		return false;
+	
+	return !conn.response.empty();
+}
+
+/*******************************************************************************************
+ * respond - builds the response: the metrics for GET /metrics and a 404 for anything else
+ *******************************************************************************************/
+void MetricsServer::respond(client &conn) {
+	std::string body, status = "200 OK";
+	if ((conn.request.compare(0, 13, "GET /metrics ") == 0) || (conn.request.compare(0, 13, "GET /metrics?") == 0))
+		_registry.render(body);
+	else {
+		status = "404 Not Found";
+		body = "Try /metrics\n";
+	}
+	
+	conn.response = "HTTP/1.0 " + status + "\r\n";
+	conn.response += "Content-Type: text/plain; version=0.0.4\r\n";
+	conn.response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+	conn.response += "Connection: close\r\n\r\n";
+	conn.response += body;
+}
@@ -0,0 +1,110 @@
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "PlotArchive.h"
+
+/*****************************************************************************************
+ * PlotArchive (constructor)
+ *
+ *    Params:  dir - directory the partition files go in
+ *             partition_secs - how much time (in plot timestamp seconds) each partition covers
+ *****************************************************************************************/
+PlotArchive::PlotArchive(const char *dir, int64_t partition_secs) : _dir(dir), _partition_secs(partition_secs) {
+	if (_partition_secs <= 0)
+		throw std::runtime_error("Archive partitions must cover at least one second");
+}
+
+PlotArchive::~PlotArchive() {
+	try {
+		close();
+	} catch (std::runtime_error &) {
+	}
+}
+
+void PlotArchive::open() {
+	if ((mkdir(_dir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0) && (errno != EEXIST))
+		throw std::runtime_error("Unable to create archive directory " + _dir);
+	
+	struct stat info;
+	if ((stat(_dir.c_str(), &info) != 0) || !S_ISDIR(info.st_mode))
+		throw std::runtime_error("Archive path " + _dir + " is not a directory");
+}
+
+/*****************************************************************************************
+ * add - writes each plot to the partition its timestamp falls in, opening the partition
+ *       if need be. Plots mostly come in time order, so the last partition is kept handy
+ *
+ *    Params:  plots - the plots to archive
+ *             clock_node - the node whose clock their timestamps are on. A change seals
+ *                          what's open so no file mixes clocks
+ *
+ *    Throws: runtime_error if a partition can't be opened or written
+ *****************************************************************************************/
+void PlotArchive::add(const std::vector<DronePlot> &plots, unsigned int clock_node) {
+	if (clock_node != _clock_node) {
+		close();
+		_clock_node = clock_node;
+	}
+	
+	PlotFileWriter *last_out = NULL;
+	int64_t last_start = 0;
+	
+	for (auto &plot : plots) {
+		int64_t start = partitionStart(plot.timestamp);
+		if ((last_out == NULL) || (start != last_start)) {
+			auto &out = _open[start];
+			if (!out)
+				out = openPartition(start);
+			last_out = out.get();
+			last_start = start;
+		}
+		last_out->write(&plot, 1);
+	}
+	_count += plots.size();
+}
+
+/*****************************************************************************************
+ * sealBefore - flushes and closes the partitions that can't get any more on-time plots
+ *
+ *    Params:  before - partitions ending at or before this time are sealed
+ *
+ *    Throws: runtime_error if a partition couldn't be written out (it's dropped either way)
+ *****************************************************************************************/
+void PlotArchive::sealBefore(int64_t before) {
+	while (!_open.empty() && (_open.begin()->first + _partition_secs <= before)) {
+		std::unique_ptr<PlotFileWriter> out = std::move(_open.begin()->second);
+		_open.erase(_open.begin());
+		out->close();
+	}
+}
+
+void PlotArchive::close() {
+	while (!_open.empty()) {
+		std::unique_ptr<PlotFileWriter> out = std::move(_open.begin()->second);
+		_open.erase(_open.begin());
+		out->close();
+	}
+}
+
+// Rounds down, so plots from before the epoch still land in the right partition
+int64_t PlotArchive::partitionStart(int64_t timestamp) {
+	int64_t start = timestamp - (timestamp % _partition_secs);
+	if (start > timestamp)
+		start -= _partition_secs;
+	return start;
+}
+
+std::unique_ptr<PlotFileWriter> PlotArchive::openPartition(int64_t start) {
+	std::string base = _dir + "/plots_" + std::to_string(start) + "_n" + std::to_string(_clock_node) + "_";
+	std::string filename;
+	unsigned int segment = 0;
+	do {
+		filename = base + std::to_string(segment++) + ".bin";
+	} while (access(filename.c_str(), F_OK) == 0);
+	
+	std::unique_ptr<PlotFileWriter> out(new PlotFileWriter);
+	if (!out->open(filename.c_str(), PlotFile::compressed))
+		throw std::runtime_error("Unable to open archive partition " + filename);
+	return out;
+}
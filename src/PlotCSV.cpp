@@ -0,0 +1,371 @@
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "PlotCSV.h"
+
+// Don't bother splitting the work into chunks smaller than this
+const size_t csv_min_chunk = 1 << 20;
+
+// Rough bytes per CSV line, for sizing the output up front
+const size_t csv_line_estimate = 40;
+
+// How much of a stream to read and parse at a time. No line may be longer than this
+const size_t csv_stream_chunk = 16 << 20;
+
+// Plots per block handed to a formatting thread when writing (about 2.5MB of text)
+const size_t csv_write_block = 1 << 16;
+
+// Significant digits written for latitude/longitude
+const int csv_float_digits = 10;
+
+static const char *skipSpace(const char *p, const char *end) {
+	while ((p < end) && ((*p == ' ') || (*p == '\t')))
+		p++;
+	return p;
+}
+
+/*****************************************************************************************
+ * parseField - converts the field at p and steps past it and the comma after it (or, for
+ *              the last field, checks that nothing but whitespace follows)
+ *
+ *    Returns: false if the field isn't a number of type T or isn't followed properly
+ *****************************************************************************************/
+template<typename T>
+static bool parseField(const char *&p, const char *end, T &value, bool last) {
+	p = skipSpace(p, end);
+	if ((p < end) && (*p == '+'))
+		p++;
+	
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		return false;
+	
+	p = skipSpace(result.ptr, end);
+	if (last)
+		return p == end;
+	if ((p == end) || (*p != ','))
+		return false;
+	p++;
+	return true;
+}
+
+bool PlotCSV::parseLine(const char *begin, const char *end, DronePlot &plot) {
+	if ((end > begin) && (*(end - 1) == '\r'))
+		end--;
+	
+	int drone_id, node_id;
+	long long timestamp;
+	float latitude, longitude;
+	const char *p = begin;
+	if (!parseField(p, end, drone_id, false) || !parseField(p, end, node_id, false) || !parseField(p, end, timestamp, false) ||
+	    !parseField(p, end, latitude, false) || !parseField(p, end, longitude, true))
+		return false;
+	
+	plot.drone_id = drone_id;
+	plot.node_id = node_id;
+	plot.timestamp = (int64_t) timestamp;
+	plot.latitude = latitude;
+	plot.longitude = longitude;
+	return true;
+}
+
+bool PlotCSV::parseBlock(const char *begin, const char *end, std::vector<DronePlot> &plots) {
+	plots.reserve(plots.size() + (end - begin) / csv_line_estimate);
+	
+	DronePlot plot;
+	while (begin < end) {
+		const char *eol = static_cast<const char *>(memchr(begin, '\n', end - begin));
+		if (eol == NULL)
+			eol = end;
+		
+		// Skip blank lines
+		const char *text = skipSpace(begin, eol);
+		if ((text < eol) && !((text == eol - 1) && (*text == '\r'))) {
+			if (!parseLine(begin, eol, plot))
+				return false;
+			plots.push_back(plot);
+		}
+		
+		begin = eol + 1;
+	}
+	return true;
+}
+
+/*****************************************************************************************
+ * parse - splits [begin, end) into one chunk per thread, each ending on a newline, parses
+ *         them concurrently and appends the results in order
+ *****************************************************************************************/
+bool PlotCSV::parse(const char *begin, const char *end, std::vector<DronePlot> &plots, unsigned int threads) {
+	size_t size = end - begin;
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = (unsigned int) std::min<size_t>(threads, std::max<size_t>(1, size / csv_min_chunk));
+	
+	if (threads <= 1)
+		return parseBlock(begin, end, plots);
+	
+	std::vector<const char *> bounds = {begin};
+	for (unsigned int i = 1; i < threads; i++) {
+		const char *split = std::max(bounds.back(), begin + size * i / threads);
+		const char *eol = static_cast<const char *>(memchr(split, '\n', end - split));
+		bounds.push_back((eol == NULL) ? end : eol + 1);
+	}
+	bounds.push_back(end);
+	
+	std::vector<std::vector<DronePlot>> chunks(threads);
+	std::vector<char> ok(threads, 0);
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.emplace_back([&, i]() { ok[i] = parseBlock(bounds[i], bounds[i + 1], chunks[i]); });
+	}
+	for (auto &worker : workers)
+		worker.join();
+	
+	if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+		return false;
+	
+	size_t total = plots.size();
+	for (auto &chunk : chunks)
+		total += chunk.size();
+	plots.reserve(total);
+	for (auto &chunk : chunks)
+		plots.insert(plots.end(), chunk.begin(), chunk.end());
+	return true;
+}
+
+long PlotCSV::parseFile(const char *filename, std::vector<DronePlot> &plots, unsigned int threads) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return -1;
+	}
+	if (info.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	
+	void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, info.st_size, MADV_SEQUENTIAL);
+	
+	const char *text = static_cast<const char *>(map);
+	std::vector<DronePlot> parsed;
+	bool ok = parse(text, text + info.st_size, parsed, threads);
+	munmap(map, info.st_size);
+	
+	if (!ok)
+		return -2;
+	
+	long count = (long) parsed.size();
+	if (plots.empty())
+		plots.swap(parsed);
+	else
+		plots.insert(plots.end(), parsed.begin(), parsed.end());
+	return count;
+}
+
+/*****************************************************************************************
+ * parseStream - reads fd into a fixed buffer and parses up to the last newline in it,
+ *               carrying the partial line at the end over to the next read. The final line
+ *               doesn't need a newline.
+ *
+ *    Params:  fd - an open, readable file descriptor (not closed)
+ *             sink - gets each buffer's plots, in order; it may take them (swap/move)
+ *             threads - most threads to parse each buffer with (0 = one per core)
+ *
+ *    Returns: plots parsed, -1 if a read failed, -2 on a malformed or overlong line
+ *****************************************************************************************/
+long PlotCSV::parseStream(int fd, const std::function<void(std::vector<DronePlot> &)> &sink, unsigned int threads) {
+	std::vector<char> buf(csv_stream_chunk);
+	std::vector<DronePlot> plots;
+	size_t filled = 0;
+	long count = 0;
+	
+	while (true) {
+		ssize_t got = read(fd, buf.data() + filled, buf.size() - filled);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		filled += got;
+		
+		// Parse the whole lines, or everything once the input has run out
+		const char *stop = buf.data() + filled;
+		if (got > 0) {
+			const char *eol = static_cast<const char *>(memrchr(buf.data(), '\n', filled));
+			if (eol == NULL) {
+				if (filled == buf.size())
+					return -2;
+				continue;
+			}
+			stop = eol + 1;
+		}
+		
+		plots.clear();
+		if (!parse(buf.data(), stop, plots, threads))
+			return -2;
+		count += plots.size();
+		if (!plots.empty())
+			sink(plots);
+		
+		size_t used = stop - buf.data();
+		memmove(buf.data(), stop, filled - used);
+		filled -= used;
+		
+		if (got == 0)
+			return count;
+	}
+}
+
+/*****************************************************************************************
+ * formatLine - writes plot as drone_id,node_id,timestamp,latitude,longitude plus a newline
+ *
+ *    Params:  out - where to put it; needs max_line bytes of room
+ *
+ *    Returns: the number of characters written
+ *****************************************************************************************/
+size_t PlotCSV::formatLine(const DronePlot &plot, char *out) {
+	char *p = out;
+	char *end = out + max_line;
+	
+	p = std::to_chars(p, end, plot.drone_id).ptr;
+	*p++ = ',';
+	p = std::to_chars(p, end, plot.node_id).ptr;
+	*p++ = ',';
+	p = std::to_chars(p, end, (long long) plot.timestamp).ptr;
+	*p++ = ',';
+	p = std::to_chars(p, end, plot.latitude, std::chars_format::general, csv_float_digits).ptr;
+	*p++ = ',';
+	p = std::to_chars(p, end, plot.longitude, std::chars_format::general, csv_float_digits).ptr;
+	*p++ = '\n';
+	return p - out;
+}
+
+void PlotCSV::formatBlock(const DronePlot *plots, size_t count, std::vector<char> &buf) {
+	buf.resize(count * max_line);
+	
+	char *p = buf.data();
+	for (size_t i = 0; i < count; i++)
+		p += formatLine(plots[i], p);
+	buf.resize(p - buf.data());
+}
+
+// Writes all of [data, data + len) to fd, riding out partial writes and signals
+static bool writeAll(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t written = ::write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+/*****************************************************************************************
+ * write - formats the plots in blocks of csv_write_block and writes them to fd in order.
+ *         Worker threads pull blocks off a shared counter and format each into one of a
+ *         ring of buffers (two per thread); this thread writes the buffers out in block
+ *         order as they fill, so formatting runs ahead of the disk without holding the
+ *         whole file in memory.
+ *
+ *    Params:  fd - an open, writable file descriptor (not closed)
+ *             plots, count - what to write
+ *             threads - most formatting threads (0 = one per core)
+ *
+ *    Returns: count, or -1 if a write failed (what went out before that is left as is)
+ *****************************************************************************************/
+long PlotCSV::write(int fd, const DronePlot *plots, size_t count, unsigned int threads) {
+	size_t blocks = (count + csv_write_block - 1) / csv_write_block;
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = (unsigned int) std::min<size_t>(threads, blocks);
+	
+	auto blockSize = [&](size_t block) { return std::min(csv_write_block, count - block * csv_write_block); };
+	
+	if (threads <= 1) {
+		std::vector<char> buf;
+		for (size_t block = 0; block < blocks; block++) {
+			formatBlock(plots + block * csv_write_block, blockSize(block), buf);
+			if (!writeAll(fd, buf.data(), buf.size()))
+				return -1;
+		}
+		return (long) count;
+	}
+	
+	// Block b always goes in slot b % nslots, once block b - nslots has been written out
+	size_t nslots = threads * 2;
+	std::vector<std::vector<char>> slots(nslots);
+	std::vector<size_t> filled(nslots, 0);   // Block number + 1 of what's waiting in each slot
+	size_t written = 0;                      // Blocks written so far
+	bool failed = false;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::atomic<size_t> next_block(0);
+	
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.emplace_back([&]() {
+			for (size_t block = next_block++; block < blocks; block = next_block++) {
+				size_t slot = block % nslots;
+				{
+					std::unique_lock lk(mutex);
+					changed.wait(lk, [&]() { return failed || (written + nslots > block); });
+					if (failed)
+						return;
+				}
+				
+				formatBlock(plots + block * csv_write_block, blockSize(block), slots[slot]);
+				
+				{
+					std::unique_lock lk(mutex);
+					filled[slot] = block + 1;
+				}
+				changed.notify_all();
+			}
+		});
+	}
+	
+	for (size_t block = 0; block < blocks; block++) {
+		size_t slot = block % nslots;
+		{
+			std::unique_lock lk(mutex);
+			changed.wait(lk, [&]() { return filled[slot] == block + 1; });
+		}
+		
+		bool ok = writeAll(fd, slots[slot].data(), slots[slot].size());
+		{
+			std::unique_lock lk(mutex);
+			if (ok)
+				written = block + 1;
+			else
+				failed = true;
+		}
+		changed.notify_all();
+		if (!ok)
+			break;
+	}
+	
+	for (auto &worker : workers)
+		worker.join();
+	return failed ? -1 : (long) count;
+}
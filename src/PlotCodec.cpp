@@ -0,0 +1,234 @@
+#include <stdexcept>
+#include <unordered_map>
+#include "PlotCodec.h"
+
+void PlotColumns::resize(size_t n) {
+	drone_id.resize(n);
+	node_id.resize(n);
+	timestamp.resize(n);
+	latitude.resize(n);
+	longitude.resize(n);
+}
+
+void PlotColumns::clear() {
+	resize(0);
+}
+
+/*****************************************************************************************
+ * encodeColumns - scatters the column store into wire-format rows appended to buf. The
+ *                 loop is a plain gather of five arrays into one struct, which the
+ *                 compiler is free to vectorize.
+ *****************************************************************************************/
+void PlotCodec::encodeColumns(const PlotColumns &cols, std::vector<uint8_t> &buf) {
+	size_t start = buf.size();
+	size_t count = cols.size();
+	
+	buf.resize(start + count * sizeof(PlotRecord));
+	uint8_t *out = buf.data() + start;
+	for (size_t i = 0; i < count; i++, out += sizeof(PlotRecord)) {
+		PlotRecord rec = {cols.drone_id[i], cols.node_id[i], cols.timestamp[i], cols.latitude[i], cols.longitude[i]};
+		memcpy(out, &rec, sizeof(rec));
+	}
+}
+
+/*****************************************************************************************
+ * decodeColumns - splits count wire-format rows from in into the column store
+ *
+ *    Params:  in - must hold count * sizeof(PlotRecord) bytes
+ *             cols - resized to count and overwritten
+ *****************************************************************************************/
+void PlotCodec::decodeColumns(const uint8_t *in, size_t count, PlotColumns &cols) {
+	cols.resize(count);
+	for (size_t i = 0; i < count; i++, in += sizeof(PlotRecord)) {
+		PlotRecord rec;
+		memcpy(&rec, in, sizeof(rec));
+		cols.drone_id[i] = rec.drone_id;
+		cols.node_id[i] = rec.node_id;
+		cols.timestamp[i] = rec.timestamp;
+		cols.latitude[i] = rec.latitude;
+		cols.longitude[i] = rec.longitude;
+	}
+}
+
+/*****************************************************************************************
+ * putVarint - appends val to buf as an unsigned LEB128 varint (7 bits per byte, high bit
+ *             set on all but the last byte)
+ *
+ * getVarint - reads a varint from in, advancing in past it
+ *
+ *    Throws: runtime_error if the varint runs past end or is longer than 64 bits
+ *****************************************************************************************/
+void PlotCodec::putVarint(std::vector<uint8_t> &buf, uint64_t val) {
+	while (val >= 0x80) {
+		buf.push_back(static_cast<uint8_t>(val) | 0x80);
+		val >>= 7;
+	}
+	buf.push_back(static_cast<uint8_t>(val));
+}
+
+uint64_t PlotCodec::getVarint(const uint8_t *&in, const uint8_t *end) {
+	uint64_t val = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (in >= end)
+			throw std::runtime_error("Compact plot batch ended in the middle of a varint");
+		
+		uint8_t byte = *in++;
+		val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return val;
+	}
+	throw std::runtime_error("Compact plot batch contained an oversized varint");
+}
+
+// Float bit patterns, so lat/lon can be XOR'd against the previous value
+static uint32_t floatBits(float val) {
+	uint32_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	return bits;
+}
+
+static float bitsFloat(uint32_t bits) {
+	float val;
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+/*****************************************************************************************
+ * compactBatch - converts a replication batch (uint32 count followed by wire-format records)
+ *                into the compact encoding. Batches are time-ordered and only a handful of
+ *                drones and nodes show up, so the layout is:
+ *
+ *                varint count
+ *                varint #drones, then each drone ID as a varint (the drone dictionary)
+ *                varint #nodes, then each node ID as a varint (the node dictionary)
+ *                per plot:
+ *                   varint  drone index * #nodes + node index
+ *                   varint  zigzag(timestamp - previous plot's timestamp)
+ *                   varint  latitude bits XOR that drone's previous latitude bits
+ *                   varint  longitude bits XOR that drone's previous longitude bits
+ *
+ *                The XOR step is Gorilla-style: successive positions of one drone share
+ *                their sign, exponent and high mantissa bits, so the XOR is a small number
+ *                and the varint drops the zero bytes. Typically ~8-10 bytes per plot vs 24.
+ *
+ *    Params:  batch - the raw replication batch
+ *             compact - cleared and filled with the compact encoding
+ *
+ *    Throws: runtime_error if batch is not a whole number of records
+ *****************************************************************************************/
+void PlotCodec::compactBatch(const std::vector<uint8_t> &batch, std::vector<uint8_t> &compact) {
+	uint32_t count;
+	if ((batch.size() < sizeof(count)) || ((batch.size() - sizeof(count)) % sizeof(PlotRecord) != 0))
+		throw std::runtime_error("compactBatch passed a batch that was not a whole number of plots");
+	
+	memcpy(&count, batch.data(), sizeof(count));
+	if (count != (batch.size() - sizeof(count)) / sizeof(PlotRecord))
+		throw std::runtime_error("compactBatch plot count did not match the batch size");
+	
+	PlotColumns cols;
+	decodeColumns(batch.data() + sizeof(count), count, cols);
+	
+	// Build the dictionaries in order of first appearance
+	std::unordered_map<uint32_t, uint32_t> drone_idx, node_idx;
+	std::vector<uint32_t> drones, nodes;
+	for (size_t i = 0; i < count; i++) {
+		if (drone_idx.emplace(cols.drone_id[i], drones.size()).second)
+			drones.push_back(cols.drone_id[i]);
+		if (node_idx.emplace(cols.node_id[i], nodes.size()).second)
+			nodes.push_back(cols.node_id[i]);
+	}
+	
+	compact.clear();
+	compact.reserve(count * 10 + (drones.size() + nodes.size()) * 5 + 16);
+	
+	putVarint(compact, count);
+	putVarint(compact, drones.size());
+	for (auto id : drones)
+		putVarint(compact, id);
+	putVarint(compact, nodes.size());
+	for (auto id : nodes)
+		putVarint(compact, id);
+	
+	// Per-drone previous positions for the XOR step
+	std::vector<uint32_t> prev_lat(drones.size(), 0), prev_lon(drones.size(), 0);
+	int64_t prev_ts = 0;
+	
+	for (size_t i = 0; i < count; i++) {
+		uint32_t d = drone_idx[cols.drone_id[i]];
+		uint32_t n = node_idx[cols.node_id[i]];
+		putVarint(compact, static_cast<uint64_t>(d) * nodes.size() + n);
+		
+		putVarint(compact, zigzag(cols.timestamp[i] - prev_ts));
+		prev_ts = cols.timestamp[i];
+		
+		uint32_t lat = floatBits(cols.latitude[i]);
+		uint32_t lon = floatBits(cols.longitude[i]);
+		putVarint(compact, lat ^ prev_lat[d]);
+		putVarint(compact, lon ^ prev_lon[d]);
+		prev_lat[d] = lat;
+		prev_lon[d] = lon;
+	}
+}
+
+/*****************************************************************************************
+ * expandBatch - reverses compactBatch, producing the raw replication batch
+ *
+ *    Params:  compact/len - the compact encoding
+ *             batch - cleared and filled with the uint32 count and wire-format records
+ *
+ *    Throws: runtime_error if the compact data is truncated or inconsistent
+ *****************************************************************************************/
+void PlotCodec::expandBatch(const uint8_t *compact, size_t len, std::vector<uint8_t> &batch) {
+	const uint8_t *in = compact;
+	const uint8_t *end = compact + len;
+	
+	// Every plot takes at least four bytes, which bounds a corrupt count before we allocate
+	uint64_t count = getVarint(in, end);
+	if (count > len / 4)
+		throw std::runtime_error("Compact plot batch count is larger than the data received");
+	
+	std::vector<uint32_t> drones, nodes;
+	uint64_t ndrones = getVarint(in, end);
+	if (ndrones > len)
+		throw std::runtime_error("Compact plot batch drone dictionary is larger than the data received");
+	for (uint64_t i = 0; i < ndrones; i++)
+		drones.push_back(static_cast<uint32_t>(getVarint(in, end)));
+	
+	uint64_t nnodes = getVarint(in, end);
+	if (nnodes > len)
+		throw std::runtime_error("Compact plot batch node dictionary is larger than the data received");
+	for (uint64_t i = 0; i < nnodes; i++)
+		nodes.push_back(static_cast<uint32_t>(getVarint(in, end)));
+	
+	PlotColumns cols;
+	cols.resize(count);
+	
+	std::vector<uint32_t> prev_lat(drones.size(), 0), prev_lon(drones.size(), 0);
+	int64_t prev_ts = 0;
+	
+	for (size_t i = 0; i < count; i++) {
+		uint64_t key = getVarint(in, end);
+		if (nodes.empty() || (key / nodes.size() >= drones.size()))
+			throw std::runtime_error("Compact plot batch referenced a drone or node outside the dictionary");
+		
+		uint32_t d = static_cast<uint32_t>(key / nodes.size());
+		cols.drone_id[i] = drones[d];
+		cols.node_id[i] = nodes[key % nodes.size()];
+		
+		prev_ts += unzigzag(getVarint(in, end));
+		cols.timestamp[i] = prev_ts;
+		
+		prev_lat[d] ^= static_cast<uint32_t>(getVarint(in, end));
+		prev_lon[d] ^= static_cast<uint32_t>(getVarint(in, end));
+		cols.latitude[i] = bitsFloat(prev_lat[d]);
+		cols.longitude[i] = bitsFloat(prev_lon[d]);
+	}
+	
+	if (in != end)
+		throw std::runtime_error("Compact plot batch had trailing data");
+	
+	uint32_t count32 = static_cast<uint32_t>(count);
+	batch.resize(sizeof(count32));
+	memcpy(batch.data(), &count32, sizeof(count32));
+	encodeColumns(cols, batch);
+}
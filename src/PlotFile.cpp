@@ -0,0 +1,243 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "PlotFile.h"
+#include "PlotCodec.h"
+#include "BlockCompress.h"
+
+// Plots per compressed frame, and per block read from a raw or versioned file
+const size_t plotfile_frame_plots = 1 << 16;
+
+// Largest frame a reader will take, compressed or expanded. A full frame of compact plots is
+// at most ~2.6MB, so this only ever turns away corrupt lengths
+const size_t plotfile_max_frame = 8 << 20;
+
+bool PlotFile::formatFromName(const char *name, file_format &format) {
+	if (strcmp(name, "raw") == 0)
+		format = raw;
+	else if (strcmp(name, "versioned") == 0)
+		format = versioned;
+	else if (strcmp(name, "compressed") == 0)
+		format = compressed;
+	else
+		return false;
+	return true;
+}
+
+// Reads until len bytes are in or the file ends, riding out signals. Returns the bytes read
+static size_t readUpTo(int fd, uint8_t *data, size_t len) {
+	size_t filled = 0;
+	while (filled < len) {
+		ssize_t got = read(fd, data + filled, len - filled);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Read error on plot file");
+		}
+		if (got == 0)
+			break;
+		filled += got;
+	}
+	return filled;
+}
+
+/*****************************************************************************************
+ * PlotFileWriter - the destructor closes the file if close() wasn't called, but can only
+ *                  report a failed final write by dropping it, so call close()
+ *****************************************************************************************/
+PlotFileWriter::~PlotFileWriter() {
+	try {
+		close();
+	} catch (std::runtime_error &) {
+	}
+}
+
+/*****************************************************************************************
+ * open - creates or truncates filename and writes the header for the chosen format
+ *
+ *    Returns: false if the file couldn't be opened or the header written
+ *****************************************************************************************/
+bool PlotFileWriter::open(const char *filename, PlotFile::file_format format) {
+	if ((_fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+		return false;
+	
+	_format = format;
+	_count = 0;
+	_pending.assign(sizeof(uint32_t), 0);
+	_pending_plots = 0;
+	
+	if (_format != PlotFile::raw) {
+		plotfile_header header = {};
+		memcpy(header.magic, plotfile_magic, sizeof(header.magic));
+		header.version = plotfile_version;
+		header.record_size = sizeof(PlotRecord);
+		header.encoding = (_format == PlotFile::compressed) ? plotfile_frames : plotfile_records;
+		try {
+			writeAll(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+		} catch (std::runtime_error &) {
+			::close(_fd);
+			_fd = -1;
+			return false;
+		}
+	}
+	return true;
+}
+
+void PlotFileWriter::write(const DronePlot *plots, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		size_t at = _pending.size();
+		_pending.resize(at + sizeof(PlotRecord));
+		PlotCodec::encodeOne(plots[i], _pending.data() + at);
+		if (++_pending_plots == plotfile_frame_plots)
+			flush();
+	}
+	_count += count;
+}
+
+void PlotFileWriter::close() {
+	if (_fd < 0)
+		return;
+	
+	int fd = _fd;
+	try {
+		flush();
+	} catch (std::runtime_error &) {
+		::close(fd);
+		_fd = -1;
+		throw;
+	}
+	_fd = -1;
+	if (::close(fd) != 0)
+		throw std::runtime_error("Unable to close plot file");
+}
+
+/*****************************************************************************************
+ * flush - writes the buffered plots: as they are for raw and versioned files, or as one
+ *         compact, block compressed frame
+ *****************************************************************************************/
+void PlotFileWriter::flush() {
+	if (_pending_plots == 0)
+		return;
+	
+	if (_format == PlotFile::compressed) {
+		uint32_t count = (uint32_t) _pending_plots;
+		memcpy(_pending.data(), &count, sizeof(count));
+		PlotCodec::compactBatch(_pending, _compact);
+		BlockCompress::compress(_compact.data(), _compact.size(), _frame);
+		
+		uint32_t len = (uint32_t) _frame.size();
+		writeAll(reinterpret_cast<const uint8_t *>(&len), sizeof(len));
+		writeAll(_frame.data(), _frame.size());
+	} else
+		writeAll(_pending.data() + sizeof(uint32_t), _pending.size() - sizeof(uint32_t));
+	
+	_pending.resize(sizeof(uint32_t));
+	_pending_plots = 0;
+}
+
+void PlotFileWriter::writeAll(const uint8_t *data, size_t len) {
+	while (len > 0) {
+		ssize_t written = ::write(_fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Write error on plot file");
+		}
+		data += written;
+		len -= written;
+	}
+}
+
+PlotFileReader::~PlotFileReader() {
+	close();
+}
+
+/*****************************************************************************************
+ * open - opens filename and reads far enough to tell the layouts apart. A file that doesn't
+ *        start with a full header is raw, and whatever was read is kept for next()
+ *
+ *    Returns: false if the file couldn't be opened or read, or has a header from a
+ *             version or record size we don't know
+ *****************************************************************************************/
+bool PlotFileReader::open(const char *filename) {
+	if ((_fd = ::open(filename, O_RDONLY)) < 0)
+		return false;
+	
+	plotfile_header header;
+	size_t got;
+	try {
+		got = readUpTo(_fd, reinterpret_cast<uint8_t *>(&header), sizeof(header));
+	} catch (std::runtime_error &) {
+		close();
+		return false;
+	}
+	
+	if ((got < sizeof(header)) || (memcmp(header.magic, plotfile_magic, sizeof(header.magic)) != 0)) {
+		_format = PlotFile::raw;
+		_carry.assign(reinterpret_cast<uint8_t *>(&header), reinterpret_cast<uint8_t *>(&header) + got);
+		return true;
+	}
+	
+	if ((header.version != plotfile_version) || (header.record_size != sizeof(PlotRecord)) ||
+	    ((header.encoding != plotfile_records) && (header.encoding != plotfile_frames))) {
+		close();
+		return false;
+	}
+	_format = (header.encoding == plotfile_frames) ? PlotFile::compressed : PlotFile::versioned;
+	_carry.clear();
+	return true;
+}
+
+bool PlotFileReader::next(std::vector<uint8_t> &records) {
+	if (_fd < 0)
+		return false;
+	
+	if (_format == PlotFile::compressed) {
+		uint32_t len;
+		if (!readAll(reinterpret_cast<uint8_t *>(&len), sizeof(len)))
+			return false;
+		if (len > plotfile_max_frame)
+			throw std::runtime_error("Plot file frame is larger than any writer would produce");
+		
+		_frame.resize(len);
+		if (!readAll(_frame.data(), len))
+			throw std::runtime_error("Plot file ended partway through a frame");
+		BlockCompress::decompress(_frame.data(), _frame.size(), _batch, plotfile_max_frame);
+		PlotCodec::expandBatch(_batch.data(), _batch.size(), records);
+		
+		// Drop the batch's plot count, leaving just the records
+		records.erase(records.begin(), records.begin() + sizeof(uint32_t));
+		return true;
+	}
+	
+	// Records back to back: fill a block, starting with anything left over from open()
+	records.resize(plotfile_frame_plots * sizeof(PlotRecord));
+	size_t filled = _carry.size();
+	if (filled > 0)
+		memcpy(records.data(), _carry.data(), filled);
+	_carry.clear();
+	filled += readUpTo(_fd, records.data() + filled, records.size() - filled);
+	
+	if (filled % sizeof(PlotRecord) != 0)
+		throw std::runtime_error("Plot file ended partway through a record");
+	records.resize(filled);
+	return filled > 0;
+}
+
+void PlotFileReader::close() {
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+}
+
+bool PlotFileReader::readAll(uint8_t *data, size_t len) {
+	size_t got = readUpTo(_fd, data, len);
+	if (got == 0)
+		return false;
+	if (got < len)
+		throw std::runtime_error("Plot file ended partway through a frame");
+	return true;
+}
@@ -1,12 +1,27 @@
 #include <fstream>
 #include <arpa/inet.h>
-#include <tuple>
+#include <sys/stat.h>
+#include <algorithm>
 #include <sstream>
+#include <cstring>
 #include <crypto++/filters.h>
 #include <crypto++/files.h>
 #include "strfuncts.h"
 #include "ReplServer.h"
 #include "TCPConn.h"
+#include "BufferPool.h"
+
+// Weight given to each new ACK round trip sample in the per-server average
+const double rtt_smoothing = 0.25;
+
+// Largest batch we'll build by merging pending sends to one server. Past this a new batch
+// is started behind it.
+const uint32_t max_coalesced_plots = 16384;
+
+// How often (seconds) to look at servers.txt's modification time
+const time_t server_list_check = 1;
+
+volatile std::sig_atomic_t QueueMgr::_reload_requested = 0;
 
 /********************************************************************************************
  * QueueMgr (constructor) - loads a hard-coded server.txt that contains a comma-separated list
@@ -32,17 +47,16 @@ void QueueMgr::runServer() {
 }
 
 /*********************************************************************************************
- * loadServerList - loads the list of other replication servers from the file given in
- *                  the parameter. Deconflicts the local server
+ * parseServerList - reads the list of replication servers from the file given in the
+ *                   parameter
  *
  *    Params:  filename - the path/filename to the server file in the following format:
  *                   <server_id>, <ip_addr>, <port>
+ *             servers - loaded with the servers found, in file order
  *
- *    Returns: -1 for failure, # of servers opened for success
- *
- *    Throws: socket_error for any network issues
+ *    Returns: -1 for failure (including duplicate server IDs), # of servers read for success
  *********************************************************************************************/
-int QueueMgr::loadServerList(const char *filename) {
+int QueueMgr::parseServerList(const char *filename, std::vector<peer_info> &servers) {
 	std::ifstream sfile;
 	unsigned int count = 0;
 	
@@ -77,12 +91,184 @@ int QueueMgr::loadServerList(const char *filename) {
 		port = (unsigned short) strtol(right.c_str(), NULL, 10);
 		port = htons(port);
 		
-		_server_list.push_back(std::tuple<std::string, unsigned long, unsigned long>(svrid, ipaddr.s_addr, port));
+		for (auto &server : servers) {
+			if (server.server_id == svrid)
+				return -1;
+		}
+		servers.push_back(peer_info{svrid, ipaddr.s_addr, port});
 		count++;
 	}
 	return count;
 }
 
+/*********************************************************************************************
+ * loadServerList - loads the list of replication servers and interns them--each server's
+ *                  peer ID is its position in the file
+ *
+ *    Returns: -1 for failure, # of servers opened for success
+ *********************************************************************************************/
+int QueueMgr::loadServerList(const char *filename) {
+	struct stat sbuf;
+	if (stat(filename, &sbuf) == 0) {
+		_server_mtime = sbuf.st_mtime;
+		_server_size = sbuf.st_size;
+	}
+	_server_file = filename;
+	_last_check = time(NULL);
+	
+	int count = parseServerList(filename, _peers);
+	if (count <= 0)
+		return count;
+	
+	for (peer_id peer = 0; peer < _peers.size(); peer++) {
+		_peer_by_name.emplace(_peers[peer].server_id, peer);
+		registerPeerMetrics(_peers[peer]);
+	}
+	rebuildAddrMap();
+	
+	_ack_rtt.assign(_peers.size(), -1.0);
+	return count;
+}
+
+void QueueMgr::rebuildAddrMap() {
+	_peer_by_addr.clear();
+	for (peer_id peer = 0; peer < _peers.size(); peer++) {
+		if (_peers[peer].active || !_peer_by_addr.count(addrKey(_peers[peer].ip_addr, _peers[peer].port)))
+			_peer_by_addr[addrKey(_peers[peer].ip_addr, _peers[peer].port)] = peer;
+	}
+}
+
+/*********************************************************************************************
+ * checkServerList - cheap enough to call every loop. Reloads the server list if a reload was
+ *                   requested or the file's modification time or size changed.
+ *
+ *    Params:  added - loaded with the servers that joined
+ *
+ *    Returns: true if the membership changed
+ *********************************************************************************************/
+bool QueueMgr::checkServerList(std::vector<peer_id> &added) {
+	added.clear();
+	
+	bool reload = _reload_requested;
+	if (!reload) {
+		time_t now = time(NULL);
+		if (now - _last_check < server_list_check)
+			return false;
+		_last_check = now;
+		
+		struct stat sbuf;
+		if ((stat(_server_file.c_str(), &sbuf) != 0) || ((sbuf.st_mtime == _server_mtime) && (sbuf.st_size == _server_size)))
+			return false;
+		_server_mtime = sbuf.st_mtime;
+		_server_size = sbuf.st_size;
+	}
+	_reload_requested = 0;
+	
+	return reloadServerList(added);
+}
+
+/*********************************************************************************************
+ * reloadServerList - re-reads the server list and applies the differences. Known servers keep
+ *                    their peer IDs (connections and queued data refer to them); new ones are
+ *                    appended. Servers no longer listed are marked inactive: sendToAll skips
+ *                    them, but what's already pending for them still goes out. A bad file is
+ *                    logged and ignored so a half-saved edit can't empty the cluster.
+ *
+ *    Params:  added - loaded with the servers that joined or rejoined
+ *
+ *    Returns: true if the membership changed
+ *********************************************************************************************/
+bool QueueMgr::reloadServerList(std::vector<peer_id> &added) {
+	std::vector<peer_info> servers;
+	if (parseServerList(_server_file.c_str(), servers) <= 0) {
+		std::string msg = "Could not reload ";
+		msg += _server_file;
+		msg += ", keeping the current server list.";
+		_server_log.writeLog(msg);
+		return false;
+	}
+	
+	bool changed = false;
+	std::vector<bool> listed(_peers.size(), false);
+	for (auto &server : servers) {
+		auto peer_it = _peer_by_name.find(server.server_id);
+		
+		// Brand new server
+		if (peer_it == _peer_by_name.end()) {
+			peer_id peer = _peers.size();
+			_peer_by_name.emplace(server.server_id, peer);
+			_peers.push_back(server);
+			registerPeerMetrics(_peers.back());
+			listed.push_back(true);
+			added.push_back(peer);
+			changed = true;
+			continue;
+		}
+		
+		peer_id peer = peer_it->second;
+		peer_info &known = _peers[peer];
+		listed[peer] = true;
+		if ((known.ip_addr != server.ip_addr) || (known.port != server.port)) {
+			known.ip_addr = server.ip_addr;
+			known.port = server.port;
+			changed = true;
+		}
+		if (!known.active) {
+			known.active = true;
+			added.push_back(peer);
+			changed = true;
+		}
+	}
+	
+	// Anyone missing from the file drains out. We never drop ourselves.
+	for (peer_id peer = 0; peer < _peers.size(); peer++) {
+		if (!listed[peer] && _peers[peer].active && (peer != _self_id)) {
+			_peers[peer].active = false;
+			changed = true;
+			
+			std::string msg = "Server ID '";
+			msg += _peers[peer].server_id;
+			msg += "' removed from the server list, draining.";
+			_server_log.writeLog(msg);
+		}
+	}
+	
+	for (peer_id peer : added) {
+		std::string msg = "Server ID '";
+		msg += _peers[peer].server_id;
+		msg += "' added to the server list.";
+		_server_log.writeLog(msg);
+	}
+	
+	rebuildAddrMap();
+	_ack_rtt.resize(_peers.size(), -1.0);
+	
+	if (changed && (_verbosity >= 1))
+		std::cout << "Server list reloaded: " << getNumServers() << " servers to replicate to.\n";
+	return changed;
+}
+
+/*********************************************************************************************
+ * registerPeerMetrics - hooks a server up to its traffic counters, labeled by server ID
+ *********************************************************************************************/
+void QueueMgr::registerPeerMetrics(peer_info &peer) {
+	MetricsRegistry &registry = MetricsRegistry::global();
+	std::string label = "peer=\"" + peer.server_id + "\"";
+	peer.bytes_sent = &registry.counter("repl_peer_bytes_sent_total", "Replication batch bytes (before encoding) sent to and acknowledged by each server", label);
+	peer.bytes_recv = &registry.counter("repl_peer_bytes_received_total", "Replication batch bytes (after decoding) received from each server", label);
+	peer.batches_sent = &registry.counter("repl_peer_batches_sent_total", "Replication batches sent to and acknowledged by each server", label);
+	peer.batches_recv = &registry.counter("repl_peer_batches_received_total", "Replication batches received from each server", label);
+}
+
+unsigned int QueueMgr::getNumServers() {
+	unsigned int count = 0;
+	for (peer_id peer = 0; peer < _peers.size(); peer++) {
+		if (_peers[peer].active && (peer != _self_id))
+			count++;
+	}
+	return count;
+}
+
 /**********************************************************************************************
  * getClientID - Gets the server ID based on the IP address and port in the lookup table
  *
@@ -93,13 +279,17 @@ int QueueMgr::loadServerList(const char *filename) {
  **********************************************************************************************/
 
 const char *QueueMgr::getClientID(unsigned long ip_addr, short unsigned int port) {
-	auto sl_iter = _server_list.begin();
-	for (; sl_iter != _server_list.end(); sl_iter++) {
-		if ((std::get<1>(*sl_iter) == ip_addr) && (std::get<2>(*sl_iter) == port)) {
-			return std::get<0>(*sl_iter).c_str();
-		}
-	}
-	return NULL;
+	auto peer_it = _peer_by_addr.find(addrKey(ip_addr, port));
+	if (peer_it == _peer_by_addr.end())
+		return NULL;
+	return _peers[peer_it->second].server_id.c_str();
+}
+
+peer_id QueueMgr::getPeerID(const char *server_id) {
+	auto peer_it = _peer_by_name.find(server_id);
+	if (peer_it == _peer_by_name.end())
+		return no_peer;
+	return peer_it->second;
 }
 
 
@@ -113,27 +303,18 @@ const char *QueueMgr::getClientID(unsigned long ip_addr, short unsigned int port
 void QueueMgr::bindSvr(const char *ip_addr, short unsigned int port) {
 	// Call the parent function
 	TCPServer::bindSvr(ip_addr, port);
-	bool found = false;
 	
-	// Now remove this server from the server list (if it's in there)
-	auto sliter = _server_list.begin();
-	while (sliter != _server_list.end()) {
-		
-		// If we found our server, clear it from the list
-		if ((std::get<1>(*sliter) == getIPAddr()) && (std::get<2>(*sliter) == htons(getPort()))) {
-			_server_ID = std::get<0>(*sliter);
-			sliter = _server_list.erase(sliter);
-			found = true;
-		} else
-			sliter++;
-	}
+	// Now find this server in the server list so we don't replicate to ourselves
+	auto peer_it = _peer_by_addr.find(addrKey(getIPAddr(), htons(getPort())));
 	
 	// If we never found our server, that's a problem--crash out
-	if (!found) {
+	if (peer_it == _peer_by_addr.end()) {
 		std::stringstream msg;
 		msg << "Server at " << ip_addr << " port " << port << " not listed in servers.txt file.";
 		throw std::runtime_error(msg.str().c_str());
 	}
+	_self_id = peer_it->second;
+	_server_ID = _peers[_self_id].server_id;
 	
 	// Now re-open the server log with the server ID info
 	std::string logname = getServerID();
@@ -161,6 +342,9 @@ void QueueMgr::handleQueue() {
 	// Get data from input buffers on connections and add to the queue
 	populateQueue();
 	
+	// Send anything waiting on servers whose last connection has finished
+	launchPending();
+	
 }
 
 /**********************************************************************************************
@@ -175,6 +359,20 @@ void QueueMgr::populateQueue() {
 	auto conn_it = _connlist.begin();
 	for (; conn_it != _connlist.end(); conn_it++) {
 		
+		// Outgoing connections that just got their ACK report how long the round trip took. Only
+		// then does the batch count as sent, so retries and dropped batches don't inflate it
+		double rtt = (*conn_it)->getAckRTT();
+		peer_id peer = (*conn_it)->getPeerID();
+		if ((rtt >= 0) && (peer < _ack_rtt.size())) {
+			if (_ack_rtt[peer] < 0)
+				_ack_rtt[peer] = rtt;
+			else
+				_ack_rtt[peer] += rtt_smoothing * (rtt - _ack_rtt[peer]);
+			_peers[peer].batches_sent->add();
+			_peers[peer].bytes_sent->add((*conn_it)->getAckedBytes());
+			(*conn_it)->clrAckRTT();
+		}
+		
 		// If the connection has data marked ready, get it and handle it based on the
 		// command at the beginning
 		if (((*conn_it)->getStatus() == TCPConn::s_hasdata) && (*conn_it)->isInputDataReady()) {
@@ -186,6 +384,18 @@ void QueueMgr::populateQueue() {
 				throw std::runtime_error("TCPConn claimed replication data but none existed.");
 			}
 			
+			// Now we know who sent it, label the connection for the event log
+			if ((*conn_it)->getPeerID() == no_peer)
+				(*conn_it)->setPeerID(getPeerID((*conn_it)->getNodeID()));
+			uint32_t count = 0;
+			memcpy(&count, buf.data(), std::min(sizeof(count), buf.size()));
+			(*conn_it)->recordEvent(ev_batch_recv, count, buf.size());
+			peer = (*conn_it)->getPeerID();
+			if (peer < _peers.size()) {
+				_peers[peer].batches_recv->add();
+				_peers[peer].bytes_recv->add(buf.size());
+			}
+			
 			// Add this data to the queue
 			_queue.emplace(recv, (*conn_it)->getNodeID(), buf);
 			if (_verbosity >= 3) {
@@ -195,6 +405,17 @@ void QueueMgr::populateQueue() {
 	}
 }
 
+/*********************************************************************************************
+ * getMaxAckRTT - returns the slowest smoothed ACK round trip among the servers, in real
+ *                seconds, or 0 if no replication has completed yet
+ *********************************************************************************************/
+double QueueMgr::getMaxAckRTT() {
+	double max_rtt = 0.0;
+	for (double rtt : _ack_rtt)
+		max_rtt = std::max(max_rtt, rtt);
+	return max_rtt;
+}
+
 /*********************************************************************************************
  * replToAll - places data into the queue for each server (calls replToServer). Replication 
                will happen on its own
@@ -204,15 +425,17 @@ void QueueMgr::populateQueue() {
  *    Throws: socket_error for any network issues
  *********************************************************************************************/
 void QueueMgr::sendToAll(std::vector<uint8_t> &data) {
-	for (unsigned int i = 0; i < _server_list.size(); i++) {
-		sendToServer(std::get<0>(_server_list[i]).c_str(), data);
+	for (peer_id peer = 0; peer < _peers.size(); peer++) {
+		if (_peers[peer].active && (peer != _self_id))
+			sendToServer(peer, data);
 	}
 	
 }
 
 /*********************************************************************************************
- * sendToServer - places data into the queue to be sent to the server indicated by
- *                server_id. Transmission will happen on its own
+ * sendToServer - queues data to be sent to the server indicated by server_id. If earlier
+ *                data for that server is still waiting, the two are merged into one batch.
+ *                Transmission will happen on its own (see launchPending)
  *
  *    Params:  server_id - string of the server's name (will be mapped automatically to IP)
  *             data - the data in binary form to send to the server
@@ -220,87 +443,124 @@ void QueueMgr::sendToAll(std::vector<uint8_t> &data) {
  *    Throws: socket_error for any network issues
  *********************************************************************************************/
 void QueueMgr::sendToServer(const char *server_id, std::vector<uint8_t> &data) {
-	_queue.emplace(send, server_id, data);
+	peer_id peer = getPeerID(server_id);
+	if (peer == no_peer)
+		throw std::runtime_error("Attempt to send data to server ID not in the server list.");
+	sendToServer(peer, data);
+}
+
+// Same as above, but by peer ID
+void QueueMgr::sendToServer(peer_id peer, std::vector<uint8_t> &data) {
+	auto &pending = _pending_out[peer];
+	if (pending.empty() || !mergeBatch(pending.back(), data)) {
+		pending.push_back(BufferPool::global().acquire(data.size()));
+		pending.back().assign(data.begin(), data.end());
+	}
+}
+
+/*********************************************************************************************
+ * mergeBatch - appends the plots in batch onto into. Both are replication batches (uint32
+ *              plot count followed by the plots).
+ *
+ *    Returns: true if merged, false if either batch is malformed or the result would be
+ *             larger than max_coalesced_plots (into is left untouched)
+ *********************************************************************************************/
+bool QueueMgr::mergeBatch(std::vector<uint8_t> &into, const std::vector<uint8_t> &batch) {
+	uint32_t into_count, batch_count;
+	if ((into.size() < sizeof(into_count)) || (batch.size() < sizeof(batch_count)))
+		return false;
+	
+	memcpy(&into_count, into.data(), sizeof(into_count));
+	memcpy(&batch_count, batch.data(), sizeof(batch_count));
+	if ((into.size() != sizeof(into_count) + into_count * DronePlot::getDataSize()) ||
+	    (batch.size() != sizeof(batch_count) + batch_count * DronePlot::getDataSize()))
+		return false;
+	
+	if (into_count + batch_count > max_coalesced_plots)
+		return false;
+	
+	into_count += batch_count;
+	memcpy(into.data(), &into_count, sizeof(into_count));
+	into.insert(into.end(), batch.begin() + sizeof(batch_count), batch.end());
+	return true;
+}
+
+/*********************************************************************************************
+ * launchPending - hands the oldest pending batch for each server to a new connection, unless
+ *                 an outgoing connection to that server is still connecting, backing off or
+ *                 sending. One connection per server keeps a recovering site from being
+ *                 hit by a reconnect storm.
+ *
+ *    Throws: socket_error for any network issues
+ *********************************************************************************************/
+void QueueMgr::launchPending() {
+	if (_pending_out.empty())
+		return;
+	
+	std::vector<bool> busy(_peers.size(), false);
+	for (auto &conn : _connlist) {
+		if (conn->isOutgoing() && (conn->getPeerID() < busy.size()) &&
+		    ((conn->getStatus() == TCPConn::s_connecting) || conn->isConnected()))
+			busy[conn->getPeerID()] = true;
+	}
 	
+	auto pend_it = _pending_out.begin();
+	while (pend_it != _pending_out.end()) {
+		if (!busy[pend_it->first]) {
+			launchDataConn(pend_it->first, pend_it->second.front());
+			pend_it->second.pop_front();
+		}
+		
+		if (pend_it->second.empty())
+			pend_it = _pending_out.erase(pend_it);
+		else
+			pend_it++;
+	}
 }
 
 /*********************************************************************************************
  * pop - removes the next received data element sitting in the queue and returns the data 
- *       loaded into the parameters. Also assigns outgoing queue elements to a connection
- *       automatically and starts that connection going
+ *       loaded into the parameters
  *
  *    Params:  sid - pop action places the first recv'd pop server id into this attribute
  *             data - data received gets loaded into this vector
  *
- *    Returns: true for an incoming element found, false otherwise. Returns false even if
- *             outgoing connections are found in the process 
+ *    Returns: true for an incoming element found, false otherwise
  *
  *    Throws: socket_error for any network issues
  *********************************************************************************************/
 bool QueueMgr::pop(std::string &sid, std::vector<uint8_t> &data) {
-	while (_queue.size() > 0) {
-		auto next_qe = _queue.front();
-		
-		// If this a send item, create a connection and start sending
-		if (next_qe.type == send) {
-			
-			// Set up the connection and attempt to establish link (will retry if failure)
-			launchDataConn(next_qe.server_id.c_str(), next_qe.data);
-			
-			_queue.pop();
-			continue;
-		}
-		
-		sid = next_qe.server_id;
-		data = std::move(next_qe.data);
-		_queue.pop();
-		return true;
-	}
-	return false;
+	if (_queue.empty())
+		return false;
+	
+	auto &next_qe = _queue.front();
+	sid = next_qe.server_id;
+	data = std::move(next_qe.data);
+	_queue.pop();
+	return true;
 }
 
 /*********************************************************************************************
  * launchDataConn - launches a connection and starts the process of sending the queue data to
  *                  the target server
  *
- *    Params:  sid - pop action places the first recv'd pop server id into this attribute
- *             data - data received gets loaded into this vector
+ *    Params:  peer - the server to send to
+ *             data - the replication data to send (handed to the connection, leaving it empty)
  *
  *********************************************************************************************/
-void QueueMgr::launchDataConn(const char *sid, std::vector<uint8_t> &data) {
-	
-	unsigned long ip_addr;
-	unsigned short port;
-	
-	// Find the IP address of the destination server
-	unsigned int i;
-	for (i = 0; i < _server_list.size(); i++) {
-		if (!std::get<0>(_server_list[i]).compare(sid)) {
-			ip_addr = std::get<1>(_server_list[i]);
-			port = std::get<2>(_server_list[i]);
-			break;
-		}
-	}
-	
-	if (i == _server_list.size()) {
+void QueueMgr::launchDataConn(peer_id peer, std::vector<uint8_t> &data) {
+	if (peer >= _peers.size())
 		throw std::runtime_error("Attempt to send data to server ID not in the server list.");
-	}
 	
-	// Try to connect to the server and if there's an issue, delete and re-throw socket_error
-	TCPConn *new_conn = new TCPConn(_server_log, _aes_key, _verbosity);
-	new_conn->setNodeID(sid);
+	// Start connecting to the server. Failures (now or once the connect finishes) are retried
+	// by handleConnections on the peer's backoff schedule
+	TCPConn *new_conn = new TCPConn(_server_log, _aes_key, _tickets, _events, _verbosity);
+	new_conn->setNodeID(_peers[peer].server_id.c_str());
+	new_conn->setPeerID(peer);
 	new_conn->setSvrID(getServerID());
+	new_conn->setTarget(_peers[peer].ip_addr, _peers[peer].port);
 	
-	try {
-		new_conn->connect(ip_addr, port);
-	} catch (socket_error &e) {
-		std::stringstream msg;
-		msg << "Connect to SID " << sid << " failed when trying to send data. Retrying. Msg: " << e.what();
-		_server_log.writeLog(msg.str().c_str());
-		new_conn->disconnect();
-		new_conn->reconnect = time(NULL) + reconnect_delay;  // Try again in 5 seconds, real-world
-	}
-	
+	tryConnect(*new_conn);
 	
 	new_conn->assignOutgoingData(data);
 	_connlist.push_back(std::unique_ptr<TCPConn>(new_conn));
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <stdexcept>
+#include "ReplScheduler.h"
+
+// How fast the deadline shrinks after a full batch and recovers after a light one
+const double interval_shrink = 0.5;
+const double interval_grow = 1.5;
+
+/*********************************************************************************************
+ * ReplScheduler (constructor) - starts with the deadline at max_latency, then adapts from there
+ *********************************************************************************************/
+ReplScheduler::ReplScheduler() : _interval(_config.max_latency) {
+}
+
+ReplScheduler::ReplScheduler(const Config &config) : _config(config), _interval(config.max_latency) {
+}
+
+/*********************************************************************************************
+ * setConfig - replaces the scheduler settings and resets the adapted deadline
+ *
+ *    Throws: runtime_error if the settings are inconsistent
+ *********************************************************************************************/
+void ReplScheduler::setConfig(const Config &config) {
+	if ((config.batch_size == 0) || (config.min_interval < 0) || (config.max_latency < config.min_interval) ||
+	    (config.max_interval < config.max_latency))
+		throw std::runtime_error("Invalid replication scheduler settings.");
+	
+	_config = config;
+	_interval = _config.max_latency;
+}
+
+/*********************************************************************************************
+ * updatePending - records the current queue depth. The deadline clock starts when the first
+ *                 plot shows up after an empty queue.
+ *
+ *    Params:  pending - number of plots waiting for replication
+ *             now - current time
+ *********************************************************************************************/
+void ReplScheduler::updatePending(unsigned int pending, double now) {
+	if ((_pending == 0) && (pending > 0))
+		_first_pending = now;
+	_pending = pending;
+}
+
+/*********************************************************************************************
+ * observeAckRTT - records the slowest peer round trip. A slow peer raises the floor between
+ *                 flushes and pushes the deadline out (up to max_interval).
+ *********************************************************************************************/
+void ReplScheduler::observeAckRTT(double rtt) {
+	_peer_rtt = std::max(0.0, rtt);
+	_interval = std::clamp(std::max(_interval, getFloor()), _config.min_interval, _config.max_interval);
+}
+
+double ReplScheduler::getFloor() {
+	return std::max(_config.min_interval, _config.rtt_mult * _peer_rtt);
+}
+
+/*********************************************************************************************
+ * shouldFlush - true if a full batch is waiting or the oldest plot has hit the deadline, and
+ *               enough time has passed since the last flush for the peers to keep up
+ *********************************************************************************************/
+bool ReplScheduler::shouldFlush(double now) {
+	if (_pending == 0)
+		return false;
+	
+	if (now - _last_flush < std::min(getFloor(), _config.max_interval))
+		return false;
+	
+	return (_pending >= _config.batch_size) || (now - _first_pending >= _interval);
+}
+
+/*********************************************************************************************
+ * flushed - adapts the deadline based on how deep the queue was when it was flushed. A full
+ *           batch means we're falling behind ingest so the deadline shrinks; a light batch
+ *           lets it drift back toward max_latency.
+ *
+ *    Params:  count - number of plots that were sent
+ *             now - current time
+ *********************************************************************************************/
+void ReplScheduler::flushed(unsigned int count, double now) {
+	if (count >= _config.batch_size)
+		_interval *= interval_shrink;
+	else if (count < _config.batch_size / 4)
+		_interval = std::min(_interval * interval_grow, _config.max_latency);
+	
+	_interval = std::clamp(std::max(_interval, getFloor()), _config.min_interval, _config.max_interval);
+	
+	_last_flush = now;
+	_pending = 0;
+}
@@ -1,37 +1,100 @@
 #include <iostream>
 #include <exception>
+#include <cstring>
+#include <chrono>
 #include "ReplServer.h"
+#include "BufferPool.h"
+#include "PlotCodec.h"
 
-const time_t secs_between_repl = 20;
-const unsigned int max_servers = 10;
+// How many replication batches can sit between the network and database threads before the
+// network side stops pulling more off its connections
+const size_t handoff_depth = 64;
+
+// Most servers that can be waiting on a catch-up at once, and how many plots go in each
+// catch-up batch
+const size_t catchup_depth = 256;
+const uint32_t catchup_batch_plots = 4096;
+
+// Sim seconds between retention passes. Partitions are only sealed once they're a whole
+// partition behind the horizon, so plots that show up late still land in the open one
+const double eviction_interval = 1.0;
+const int64_t archive_partition_secs = 3600;
+
+// The replication counters and timings we publish, registered on first use
+struct repl_metrics {
+	Counter &ingested = MetricsRegistry::global().counter("repl_plots_ingested_total", "Plots from the local antenna picked up for replication");
+	Counter &replicated = MetricsRegistry::global().counter("repl_plots_replicated_total", "Plots received from other servers and applied");
+	Counter &deduplicated = MetricsRegistry::global().counter("repl_plots_deduplicated_total", "Plots removed as duplicates by the dedup pass");
+	Counter &skew_corrected = MetricsRegistry::global().counter("repl_plots_skew_corrected_total", "Plot timestamps shifted to correct for clock skew");
+	Counter &archived = MetricsRegistry::global().counter("repl_plots_archived_total", "Plots moved past the retention horizon into the archive");
+	Histogram &apply_time = MetricsRegistry::global().histogram("repl_batch_apply_seconds", "Time to apply a received batch, dedup pass included", 60.0);
+	Histogram &update_time = MetricsRegistry::global().histogram("repl_update_plots_seconds", "Time spent in ReplicationManager::updatePlots", 60.0);
+	Histogram &plot_age = MetricsRegistry::global().histogram("repl_plot_age_seconds",
+	                                                          "Age of replicated plots on arrival in real seconds (whole sim seconds, before skew correction)", 3600.0);
+};
+
+static repl_metrics &replMetrics() {
+	static repl_metrics metrics;
+	return metrics;
+}
 
 /*********************************************************************************************
  * ReplServer (constructor) - creates our ReplServer. Initializes:
  *
  *    verbosity - passes this value into QueueMgr and local, plus each connection
- *    _time_mult - how fast to run the simulation - 2.0 = 2x faster
+ *    clock - the sim clock, shared with the antenna. The server joins it until replicate() ends
  *    ip_addr - which ip address to bind the server to
  *    port - bind the server here
  *
  *********************************************************************************************/
-ReplServer::ReplServer(DronePlotDB &plotdb, float time_mult) : _queue(1), _plotdb(plotdb), _shutdown(false), _time_mult(time_mult), _verbosity(1), _ip_addr("127.0.0.1"), _port(9999) {
+ReplServer::ReplServer(DronePlotDB &plotdb, SimClock &clock) : _queue(1), _metrics_http(MetricsRegistry::global()), _inbound(handoff_depth), _outbound(handoff_depth), _catchup(catchup_depth), _plotdb(plotdb), _shutdown(false), _clock(clock), _verbosity(1), _ip_addr("127.0.0.1"), _port(9999) {
+	_clock.join();
+	_clock_joined = true;
 }
 
-ReplServer::ReplServer(DronePlotDB &plotdb, const char *ip_addr, unsigned short port, float time_mult, unsigned int verbosity) : _queue(verbosity), _plotdb(plotdb), _shutdown(false), _time_mult(time_mult), _verbosity(verbosity), _ip_addr(ip_addr), _port(port) {
+ReplServer::ReplServer(DronePlotDB &plotdb, SimClock &clock, const char *ip_addr, unsigned short port, unsigned int verbosity) : _queue(verbosity), _metrics_http(MetricsRegistry::global()), _inbound(handoff_depth), _outbound(handoff_depth), _catchup(catchup_depth), _plotdb(plotdb), _shutdown(false), _clock(clock), _verbosity(verbosity), _ip_addr(ip_addr), _port(port) {
+	_clock.join();
+	_clock_joined = true;
 }
 
 ReplServer::~ReplServer() {
-
+	if (_clock_joined)
+		_clock.leave();
+	_shutdown = true;
+	_net_stop = true;
+	if (_net_thread.joinable())
+		_net_thread.join();
 }
 
 
 /**********************************************************************************************
- * getAdjustedTime - gets the time since the replication server started up in seconds, modified
- *                   by _time_mult to speed up or slow down
+ * configureRetention - turns on time-based retention: plots older than horizon get moved from
+ *                      the database into a time-partitioned, compressed archive on disk
+ *
+ *    Params:  horizon - how many sim seconds of plots to keep in the database. Needs to be
+ *                       well past the dedup window and the replication latency, or late
+ *                       duplicates can end up archived twice
+ *             archive_dir - directory for the archive partitions (created if need be)
+ *
+ *    Throws: runtime_error if the directory can't be created
+ **********************************************************************************************/
+
+void ReplServer::configureRetention(double horizon, const char *archive_dir) {
+	std::unique_ptr<PlotArchive> archive(new PlotArchive(archive_dir, archive_partition_secs));
+	archive->open();
+	
+	_archive = std::move(archive);
+	_retention = horizon;
+	_next_eviction = 0.0;
+}
+
+/**********************************************************************************************
+ * getAdjustedTime - gets the sim time in seconds from the shared clock (already sped up or
+ *                   slowed down by the time multiplier)
  **********************************************************************************************/
 
 double ReplServer::getAdjustedTime() {
-	return static_cast<double>(time(nullptr) - _start_time) * _time_mult;
+	return _clock.now();
 }
 
 /**********************************************************************************************
@@ -52,10 +115,22 @@ void ReplServer::replicate(const char *ip_addr, unsigned short port) {
 }
 
 void ReplServer::replicate() {
+	try {
+		runReplication();
+	} catch (...) {
+		// Nobody else on a virtual clock can move on while we're still counted as awake
+		if (_clock_joined) {
+			_clock.leave();
+			_clock_joined = false;
+		}
+		throw;
+	}
+}
+
+void ReplServer::runReplication() {
 	
-	// Track when we started the server
-	_start_time = time(NULL);
-	_last_repl = 0;
+	_repl_added = 0;
+	_local_queued = _plotdb.getAddCount();
 	
 	// Set up our queue's listening socket
 	_queue.bindSvr(_ip_addr.c_str(), _port);
@@ -64,97 +139,384 @@ void ReplServer::replicate() {
 	if (_verbosity >= 2)
 		std::cout << "Server bound to " << _ip_addr << ", port: " << _port << " and listening\n";
 	
+	if (_metrics_port != 0) {
+		_metrics_http.bindSvr(_ip_addr.c_str(), _metrics_port);
+		if (_verbosity >= 1)
+			std::cout << "Serving metrics at http://" << _ip_addr << ":" << _metrics_port << "/metrics\n";
+	}
+	
+	
+	// Sockets get handled on their own thread from here on out
+	_net_thread = std::thread(&ReplServer::networkLoop, this);
 	
 	// Replicate until we get the shutdown signal
 	while (!_shutdown) {
 		
-		// Check for new connections, process existing connections, and populate the queue as applicable
-		_queue.handleQueue();
+		// Let the scheduler know how backed up we are and how slow the peers are (their round trips
+		// are in real seconds, so scale them onto the sim clock)
+		double now = getAdjustedTime();
+		_scheduler.observeAckRTT(_peer_rtt * _clock.getTimeMult());
+		_scheduler.updatePending(countPendingPlots(), now);
 		
 		// See if it's time to replicate and, if so, go through the database, identifying new plots
-		// that have not been replicated yet and adding them to the queue for replication
-//      fprintf(stdout, "Time: %f\n", getAdjustedTime() - _last_repl);
-		if (getAdjustedTime() - _last_repl > secs_between_repl) {
+		// that have not been replicated yet and handing them to the network thread
+		if (_scheduler.shouldFlush(now)) {
+			unsigned int pending = countPendingPlots();
+			_local_queued = _plotdb.getAddCount() - _repl_added;
+			_scheduler.flushed(queueNewPlots(pending), now);
 			
-			queueNewPlots();
-			_last_repl = getAdjustedTime();
+			if (_verbosity >= 3)
+				std::cout << "Next replication deadline: " << _scheduler.getInterval() << " secs\n";
 		}
 		
-		// Check the queue for updates and pop them until the queue is empty. The pop command only returns
-		// incoming replication information--outgoing replication in the queue gets turned into a TCPConn
-		// object and automatically removed from the queue by pop
-		std::string sid;
+		// Send the whole database to any server that just joined
+		peer_id joined;
+		while (_catchup.tryPop(joined))
+			queueCatchUp(joined);
+		
+		// Keep the database down to the retention window
+		if (_archive && (now >= _next_eviction)) {
+			archiveOldPlots(now);
+			_next_eviction = now + eviction_interval;
+		}
+		
+		// Apply whatever replication data the network thread has received, waiting briefly if
+		// there's none so we don't chew up CPU. On a virtual clock the wait is in sim time
+		// instead, which is what lets the clock skip ahead (min_interval is the finest the
+		// scheduler ever flushes at anyway)
 		std::vector<uint8_t> data;
-		while (_queue.pop(sid, data)) {
-			
-			// Incoming replication--add it to this server's local database
-			addReplDronePlots(data);
+		bool received;
+		if (_clock.isVirtual()) {
+			_clock.sleepUntil(now + _scheduler.getConfig().min_interval);
+			received = _inbound.tryPop(data);
+		} else {
+			received = _inbound.pop(data, std::chrono::milliseconds(1));
 		}
 		
-		usleep(1000);
+		if (received) {
+			do {
+				// Incoming replication--add it to this server's local database
+				addReplDronePlots(data);
+				BufferPool::global().release(data);
+			} while (_inbound.tryPop(data));
+		}
+	}
+	
+	// Done waiting on sim time
+	_clock.leave();
+	_clock_joined = false;
+	
+	// Stop the network side now we won't queue anything more for it--it passes on what's left
+	// in _outbound on the way out--then apply anything it received before the final pass
+	_net_stop = true;
+	_net_thread.join();
+	_inbound.close();
+	_outbound.close();
+	_catchup.close();
+	
+	if (_net_error)
+		std::rethrow_exception(_net_error);
+	
+	std::vector<uint8_t> data;
+	while (_inbound.tryPop(data)) {
+		addReplDronePlots(data);
+		BufferPool::global().release(data);
+	}
+	for (auto &leftover : _net_leftover) {
+		addReplDronePlots(leftover);
+		BufferPool::global().release(leftover);
 	}
+	_net_leftover.clear();
 	
 	replicationManager.updatePlots(_plotdb);
 	replicationManager.updateLeaderNodeIds(_plotdb);
+	
+	// Whatever is still in the database stays there for the final dump; just finish the files
+	if (_archive) {
+		try {
+			_archive->close();
+		} catch (std::runtime_error &e) {
+			std::cerr << "Archive: " << e.what() << "\n";
+		}
+		if (_verbosity >= 1)
+			std::cout << "Archived " << _archive->getCount() << " plots past the retention horizon.\n";
+	}
+}
+
+/**********************************************************************************************
+ * networkLoop - runs on its own thread. Handles the sockets through the QueueMgr, passes our
+ *               outgoing batches to it and hands received batches over to the database thread.
+ *               If the database side falls behind and _inbound fills up, we stop pulling data
+ *               off the connections (they sit in s_hasdata) until there's room again.
+ *
+ *               Runs until the database thread sets _net_stop. On the way out, whatever is
+ *               still in _outbound gets handed to the QueueMgr for one last pass and anything
+ *               received but not yet handed over is left in _net_leftover. If the QueueMgr
+ *               throws, the exception is kept in _net_error for replicate() to rethrow and the
+ *               server shuts down.
+ **********************************************************************************************/
+
+void ReplServer::networkLoop() {
+	std::vector<uint8_t> held;   // A received batch waiting for room in _inbound
+	bool holding = false;
+	
+	try {
+		runNetwork(held, holding);
+		
+		sendOutbound();
+		_queue.handleQueue();
+		
+		std::string sid;
+		if (holding)
+			_net_leftover.push_back(std::move(held));
+		while (_queue.pop(sid, held))
+			_net_leftover.push_back(std::move(held));
+	} catch (...) {
+		_net_error = std::current_exception();
+		_shutdown = true;
+	}
+}
+
+// Hands everything waiting in _outbound to the QueueMgr
+void ReplServer::sendOutbound() {
+	outbound_batch outgoing;
+	while (_outbound.tryPop(outgoing)) {
+		if (outgoing.target == no_peer)
+			_queue.sendToAll(outgoing.data);
+		else
+			_queue.sendToServer(outgoing.target, outgoing.data);
+		BufferPool::global().release(outgoing.data);
+	}
+}
+
+void ReplServer::runNetwork(std::vector<uint8_t> &held, bool &holding) {
+	while (!_net_stop) {
+		
+		// Check for new connections, process existing connections, and populate the queue as applicable
+		_queue.handleQueue();
+		
+		// Pick up servers.txt changes and ask the database thread to catch up anyone new
+		std::vector<peer_id> added;
+		if (_queue.checkServerList(added)) {
+			for (peer_id peer : added) {
+				if (!_catchup.tryPush(std::move(peer)))
+					std::cerr << "Too many servers waiting on a catch-up, skipping one.\n";
+			}
+		}
+		
+		// Queue up anything the database thread wants sent out
+		sendOutbound();
+		
+		// Check the queue for updates and pop them until the queue is empty or the database thread
+		// can't take any more. The pop command only returns incoming replication information--outgoing
+		// replication is handed to TCPConn objects by handleQueue
+		std::string sid;
+		while (true) {
+			if (holding) {
+				if (!_inbound.tryPush(std::move(held)))
+					break;
+				holding = false;
+			}
+			if (!_queue.pop(sid, held))
+				break;
+			holding = true;
+		}
+		
+		_peer_rtt = _queue.getMaxAckRTT();
+		
+		_metrics_http.handle();
+		
+		usleep(1000);
+	}
+}
+
+/**********************************************************************************************
+ * countPendingPlots - cheap check of how many plots came in from the antenna since the last
+ *                     flush, without walking the database
+ **********************************************************************************************/
+
+unsigned int ReplServer::countPendingPlots() {
+	return static_cast<unsigned int>(_plotdb.getAddCount() - _repl_added - _local_queued);
+}
+
+/**********************************************************************************************
+ * archiveOldPlots - evicts the plots that are past the retention horizon (and have already
+ *                   been replicated) from the database and files them in the archive. If the
+ *                   archive can't be written the plots go back in the database and retention
+ *                   is turned off, so nothing is lost, though some may end up in both.
+ *
+ *                   Only plots already moved onto the leader's clock (relabeled with its node
+ *                   ID) are archived, so the archive never mixes raw and corrected timestamps.
+ *                   Plots whose skew isn't known yet stay in the database until it is.
+ *
+ *    Params:  now - the current sim time
+ **********************************************************************************************/
+
+void ReplServer::archiveOldPlots(double now) {
+	// Plots only get corrected by a dedup pass, and a server nobody replicates to never has
+	// one, so run it here until there's a leader
+	if (!replicationManager.hasLeader())
+		replicationManager.updatePlots(_plotdb);
+	if (!replicationManager.hasLeader())
+		return;
+	
+	int64_t horizon = (int64_t) (now - _retention);
+	unsigned int leader = replicationManager.getLeader();
+	if (_plotdb.evictBefore(horizon, leader, _evicted) > 0) {
+		try {
+			_archive->add(_evicted, leader);
+		} catch (std::runtime_error &e) {
+			std::cerr << "Archive: " << e.what() << ". Keeping all plots in memory from here on.\n";
+			
+			// Back in as if replicated in, so they don't count as new local plots
+			_plotdb.addPlots(_evicted.data(), _evicted.size());
+			_repl_added += _evicted.size();
+			_archive.reset();
+			return;
+		}
+		
+		replMetrics().archived.add(_evicted.size());
+		if (_verbosity >= 2)
+			std::cout << "Archived " << _evicted.size() << " plots older than " << horizon << "\n";
+	}
+	
+	try {
+		_archive->sealBefore(horizon - archive_partition_secs);
+	} catch (std::runtime_error &e) {
+		std::cerr << "Archive: " << e.what() << "\n";
+	}
 }
 
 /**********************************************************************************************
  * queueNewPlots - looks at the database and grabs the new plots, marshalling them and
- *                 sending them to the queue manager
+ *                 handing them to the network thread for the queue manager
+ *
+ *    Params:  expected - roughly how many new plots to expect, used to size the buffer once
  *
  *    Returns: number of new plots sent to the QueueMgr
  *
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
-unsigned int ReplServer::queueNewPlots() {
-	std::vector<uint8_t> marshall_data;
-	unsigned int count = 0;
+unsigned int ReplServer::queueNewPlots(unsigned int expected) {
+	uint32_t count = 0;
 	
 	if (_verbosity >= 3)
 		std::cout << "Replicating plots.\n";
 	
-	// Loop through the drone plots, looking for new ones
-	std::list<DronePlot>::iterator dpit = _plotdb.begin();
-	for (; dpit != _plotdb.end(); dpit++) {
-		
-		// If this is a new one, marshall it and clear the flag
-		if (dpit->isFlagSet(DBFLAG_NEW)) {
-			
-			dpit->serialize(marshall_data);
-			dpit->clrFlags(DBFLAG_NEW);
-			
+	// Leave room for the count up front and size the buffer for the plots we expect to find
+	std::vector<uint8_t> marshall_data = BufferPool::global().acquire(sizeof(count) + expected * DronePlot::getDataSize());
+	marshall_data.resize(sizeof(count));
+	
+	// Loop through the drone plots (under the lock, as the antenna may be adding), marshalling
+	// the new ones. Their flags are only cleared once the batch has been handed over, so if
+	// that fails they go out next time
+	_plotdb.walk([&](DronePlot &plot) {
+		if (plot.isFlagSet(DBFLAG_NEW)) {
+			plot.serialize(marshall_data);
 			count++;
 		}
-		if (marshall_data.size() % DronePlot::getDataSize() != 0)
-			throw std::runtime_error("Issue with marshalling!");
-		
-	}
+		return true;
+	});
 	
 	if (count == 0) {
 		if (_verbosity >= 3)
 			std::cout << "No new plots found to replicate.\n";
 		
+		BufferPool::global().release(marshall_data);
 		return 0;
 	}
 	
-	// Add the count onto the front
+	// Fill in the count at the front
 	if (_verbosity >= 3)
 		std::cout << "Adding in count: " << count << "\n";
-	uint8_t *ctptr_begin = (uint8_t *) &count;
-	marshall_data.insert(marshall_data.begin(), ctptr_begin, ctptr_begin + sizeof(unsigned int));
+	memcpy(marshall_data.data(), &count, sizeof(count));
 	
-	// Send to the queue manager
-	if (marshall_data.size() > 0) {
-		_queue.sendToAll(marshall_data);
-	}
+	// Hand it to the network thread to send out, waiting if it's backed up
+	if (!pushOutbound(no_peer, marshall_data))
+		return 0;
+	
+	// The first count new plots are the ones we marshalled (only the antenna adds plots
+	// meanwhile, and it adds them at the end)
+	uint32_t cleared = 0;
+	_plotdb.walk([&](DronePlot &plot) {
+		if (plot.isFlagSet(DBFLAG_NEW)) {
+			plot.clrFlags(DBFLAG_NEW);
+			cleared++;
+		}
+		return cleared < count;
+	});
 	
+	replMetrics().ingested.add(count);
 	if (_verbosity >= 2)
 		std::cout << "Queued up " << count << " plots to be replicated.\n";
 	
 	return count;
 }
 
+/**********************************************************************************************
+ * queueCatchUp - sends every plot we have to a server that just joined the cluster, in
+ *                batches of catchup_batch_plots. The new server's dedup sorts out anything
+ *                it already had.
+ *
+ *    Params:  peer - the server that joined
+ **********************************************************************************************/
+
+void ReplServer::queueCatchUp(peer_id peer) {
+	uint32_t count = 0;
+	size_t total = 0;
+	
+	// Each batch is marshalled under the lock, which is let go while we wait to hand it over.
+	// Only this thread erases plots, so where we stopped is still good for the next batch
+	DronePlotDBIterator dpit;
+	bool started = false;
+	while (!started || (dpit != _plotdb.end())) {
+		std::vector<uint8_t> marshall_data = BufferPool::global().acquire(sizeof(count) + catchup_batch_plots * DronePlot::getDataSize());
+		marshall_data.resize(sizeof(count));
+		
+		count = 0;
+		auto marshall = [&](DronePlot &plot) {
+			plot.serialize(marshall_data);
+			return ++count < catchup_batch_plots;
+		};
+		dpit = started ? _plotdb.walk(dpit, marshall) : _plotdb.walk(marshall);
+		started = true;
+		
+		if (count == 0) {
+			BufferPool::global().release(marshall_data);
+			break;
+		}
+		
+		memcpy(marshall_data.data(), &count, sizeof(count));
+		if (!pushOutbound(peer, marshall_data))
+			return;
+		total += count;
+	}
+	
+	if (_verbosity >= 2)
+		std::cout << "Queued up " << total << " plots to catch up a new server.\n";
+}
+
+/**********************************************************************************************
+ * pushOutbound - hands a batch to the network thread, waiting if it's backed up
+ *
+ *    Params:  target - the server to send to, or no_peer for all of them
+ *             data - the batch (moved from)
+ *
+ *    Returns: false if we're shutting down and it wasn't handed over
+ **********************************************************************************************/
+
+bool ReplServer::pushOutbound(peer_id target, std::vector<uint8_t> &data) {
+	outbound_batch batch;
+	batch.target = target;
+	batch.data = std::move(data);
+	while (!_outbound.push(std::move(batch), std::chrono::milliseconds(100))) {
+		if (_shutdown)
+			return false;
+	}
+	return true;
+}
+
 /**********************************************************************************************
  * addReplDronePlots - Adds drone plots to the database from data that was replicated in. 
  *                     Deconflicts issues between plot points.
@@ -174,39 +536,48 @@ void ReplServer::addReplDronePlots(std::vector<uint8_t> &data) {
 	}
 	
 	// Get the number of plot points
-	unsigned int *numptr = (unsigned int *) data.data();
-	unsigned int count = *numptr;
-	
-	// Store sub-vectors for efficiency
-	std::vector<uint8_t> plot;
-	auto dptr = data.begin() + sizeof(unsigned int);
+	uint32_t count;
+	memcpy(&count, data.data(), sizeof(count));
 	
-	for (unsigned int i = 0; i < count; i++) {
-		plot.clear();
-		plot.assign(dptr, dptr + DronePlot::getDataSize());
-		addSingleDronePlot(plot);
-		dptr += DronePlot::getDataSize();
+	if (count != (data.size() - 4) / DronePlot::getDataSize()) {
+		throw std::runtime_error("Plot count in replication data did not match the amount of data received");
 	}
+	
+	repl_metrics &metrics = replMetrics();
+	auto start = std::chrono::steady_clock::now();
+	
+	// Decode the batch once, noting how stale each plot is by the time it gets here
+	double now = getAdjustedTime();
+	_received.clear();
+	PlotCodec::decode(data.data() + sizeof(count), count, [&](DronePlot &plot) {
+		metrics.plot_age.record((now - plot.timestamp) / _clock.getTimeMult());
+		_received.push_back(plot);
+	});
+	
+	// Then copy them into the database in one locked batch
+	size_t before = _plotdb.size();
+	size_t adds_before = _plotdb.getAddCount();
+	size_t corrected_before = replicationManager.getCorrectedCount();
+	_plotdb.addPlots(_received.data(), count, DBFLAG_USER1);
+	_repl_added += count;
+	
+	auto update_start = std::chrono::steady_clock::now();
 	replicationManager.updatePlots(_plotdb);
-	if (_verbosity >= 2)
-		std::cout << "Replicated in " << count << " plots\n";
-}
-
-
-/**********************************************************************************************
- * addSingleDronePlot - Takes in binary serialized drone data and adds it to the database. 
- *
- **********************************************************************************************/
-
-void ReplServer::addSingleDronePlot(std::vector<uint8_t> &data) {
-	DronePlot tmp_plot;
+	auto done = std::chrono::steady_clock::now();
 	
-	tmp_plot.deserialize(data);
+	// Whatever the antenna added meanwhile counts toward the growth too
+	size_t grown = before + (_plotdb.getAddCount() - adds_before);
+	size_t after = _plotdb.size();
+	size_t removed = (grown > after) ? grown - after : 0;
+	_queue.getEventLog().record(ev_plots_added, no_peer, 0, count, removed);
 	
-	_plotdb.addPlot(tmp_plot.drone_id, tmp_plot.node_id, tmp_plot.timestamp, tmp_plot.latitude, tmp_plot.longitude);
-	auto last = _plotdb.end();
-	last--;
-	last->setFlags(DBFLAG_USER1);
+	metrics.replicated.add(count);
+	metrics.deduplicated.add(removed);
+	metrics.skew_corrected.add(replicationManager.getCorrectedCount() - corrected_before);
+	metrics.update_time.record(std::chrono::duration<double>(done - update_start).count());
+	metrics.apply_time.record(std::chrono::duration<double>(done - start).count());
+	if (_verbosity >= 2)
+		std::cout << "Replicated in " << count << " plots\n";
 }
 
 
@@ -48,6 +48,8 @@ void ReplicationManager::convertTimeSkews(DronePlotDBIterator begin, DronePlotDB
 	for (auto it = begin; it != end; it++) {
 		const auto adjustment = getSkew(it->node_id, newLeader);
 		if (adjustment) {
+			if (*adjustment != 0)
+				corrected++;
 			it->timestamp += *adjustment;
 			it->node_id = leader;
 		}
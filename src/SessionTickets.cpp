@@ -0,0 +1,86 @@
+#include "SessionTickets.h"
+
+/*****************************************************************************************
+ * issue - records a ticket handed to node_id. Each node only ever holds its latest ticket,
+ *         so any older one outstanding for that node is dropped.
+ *****************************************************************************************/
+void SessionTickets::issue(const std::string &node_id, const ticket_id &id, const ticket_secret &secret) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	time_t now = time(NULL);
+	
+	auto it = _issued.begin();
+	while (it != _issued.end()) {
+		if (it->second.node_id == node_id)
+			it = _issued.erase(it);
+		else
+			it++;
+	}
+	
+	if (_issued.size() >= max_issued_tickets)
+		purgeIssued(now);
+	
+	_issued[id] = issued_ticket{node_id, secret, now + ticket_lifetime};
+}
+
+/*****************************************************************************************
+ * redeem - looks up a ticket presented by node_id and uses it up
+ *
+ *    Params:  secret - loaded with the ticket's secret if found
+ *
+ *    Returns: true if the ticket was issued to node_id and hasn't expired
+ *****************************************************************************************/
+bool SessionTickets::redeem(const std::string &node_id, const ticket_id &id, ticket_secret &secret) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	
+	auto it = _issued.find(id);
+	if (it == _issued.end())
+		return false;
+	
+	bool valid = (it->second.node_id == node_id) && (it->second.expires > time(NULL));
+	secret = it->second.secret;
+	_issued.erase(it);
+	return valid;
+}
+
+void SessionTickets::store(const std::string &node_id, const SessionTicket &ticket) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	_held[node_id] = ticket;
+}
+
+/*****************************************************************************************
+ * take - removes and returns the ticket we hold for node_id, if it's still good to use
+ *
+ *    Returns: true if a usable ticket was found
+ *****************************************************************************************/
+bool SessionTickets::take(const std::string &node_id, SessionTicket &ticket) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	
+	auto it = _held.find(node_id);
+	if (it == _held.end())
+		return false;
+	
+	ticket = it->second;
+	_held.erase(it);
+	return ticket.expires > time(NULL);
+}
+
+/*****************************************************************************************
+ * purgeIssued - makes room in a full table. Expired tickets go first; if that doesn't free
+ *               anything, the ticket closest to expiring is sacrificed.
+ *****************************************************************************************/
+void SessionTickets::purgeIssued(time_t now) {
+	auto oldest = _issued.end();
+	auto it = _issued.begin();
+	while (it != _issued.end()) {
+		if (it->second.expires <= now) {
+			it = _issued.erase(it);
+			continue;
+		}
+		if ((oldest == _issued.end()) || (it->second.expires < oldest->second.expires))
+			oldest = it;
+		it++;
+	}
+	
+	if ((_issued.size() >= max_issued_tickets) && (oldest != _issued.end()))
+		_issued.erase(oldest);
+}
@@ -0,0 +1,103 @@
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <string>
+#include "SimClock.h"
+
+// Shortest real sleep while waiting on a whole-second clock to tick over
+const double real_clock_min_sleep = 0.01;
+
+std::unique_ptr<SimClock> SimClock::create(const std::string &type, float time_mult) {
+	if (time_mult <= 0.0)
+		throw std::runtime_error("Clock time multiplier must be greater than zero.");
+	
+	if (type == "real")
+		return std::make_unique<RealClock>(time_mult);
+	if (type == "scaled")
+		return std::make_unique<ScaledClock>(time_mult);
+	if (type == "virtual")
+		return std::make_unique<VirtualClock>(time_mult);
+	throw std::runtime_error("Unknown clock type '" + type + "'. Use real, scaled or virtual.");
+}
+
+void RealClock::start(double lead) {
+	_start_time = time(NULL);
+	_lead = lead;
+}
+
+double RealClock::now() {
+	return static_cast<double>(time(NULL) - _start_time) * _time_mult - _lead;
+}
+
+/*****************************************************************************************
+ * sleepUntil - now() only moves once a second, so sleep for the remaining time and then
+ *              keep checking in short naps until the second ticks over
+ *****************************************************************************************/
+void RealClock::sleepUntil(double when) {
+	double remaining;
+	while ((remaining = (when - now()) / _time_mult) > 0)
+		std::this_thread::sleep_for(std::chrono::duration<double>(std::max(remaining, real_clock_min_sleep)));
+}
+
+void ScaledClock::start(double lead) {
+	_start_time = std::chrono::steady_clock::now();
+	_lead = lead;
+}
+
+double ScaledClock::now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start_time).count() * _time_mult - _lead;
+}
+
+void ScaledClock::sleepUntil(double when) {
+	double remaining;
+	while ((remaining = (when - now()) / _time_mult) > 0)
+		std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+}
+
+void VirtualClock::start(double lead) {
+	std::lock_guard<std::mutex> lk(_mutex);
+	_now = -lead;
+}
+
+double VirtualClock::now() {
+	std::lock_guard<std::mutex> lk(_mutex);
+	return _now;
+}
+
+/*****************************************************************************************
+ * sleepUntil - parks the caller until sim time reaches when. If that makes everyone
+ *              asleep, time jumps forward to whoever wakes first.
+ *****************************************************************************************/
+void VirtualClock::sleepUntil(double when) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	if (when <= _now)
+		return;
+	
+	auto wakeup = _wakeups.insert(when);
+	advance();
+	_moved.wait(lk, [this, when] { return _now >= when; });
+	_wakeups.erase(wakeup);
+}
+
+void VirtualClock::join() {
+	std::lock_guard<std::mutex> lk(_mutex);
+	_participants++;
+}
+
+void VirtualClock::leave() {
+	std::lock_guard<std::mutex> lk(_mutex);
+	if (_participants > 0)
+		_participants--;
+	advance();
+}
+
+void VirtualClock::advance() {
+	if (_wakeups.empty() || (_wakeups.size() < _participants))
+		return;
+	
+	double next = *_wakeups.begin();
+	if (next > _now) {
+		_now = next;
+		_moved.notify_all();
+	}
+}
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include "SlabPool.h"
+
+size_t SlabPool::blockSize(size_t size, size_t align) {
+	align = std::max(align, alignof(free_block));
+	size = std::max(size, sizeof(free_block));
+	return (size + align - 1) / align * align;
+}
+
+/*****************************************************************************************
+ * allocate - hands out a block: off the free list if there is one, else carved from the
+ *            newest slab (starting a new slab when that one is used up)
+ *
+ *    Params:  size - bytes needed. The first call sets the pool's block size; later sizes
+ *                    that don't fit a block go to operator new instead
+ *             align - alignment needed, at most alignof(std::max_align_t) (slabs start
+ *                     there)
+ *
+ *    Throws: bad_alloc if a new slab can't be had
+ *****************************************************************************************/
+void *SlabPool::allocate(size_t size, size_t align) {
+	if (_block_size == 0)
+		_block_size = blockSize(size, align);
+	if ((blockSize(size, align) > _block_size) || (_block_size % align != 0))
+		return ::operator new(size);
+	
+	_in_use++;
+	if (_free != nullptr) {
+		free_block *block = _free;
+		_free = block->next;
+		return block;
+	}
+	
+	if ((size_t) (_carve_end - _carve) < _block_size) {
+		size_t slab_size = std::max(_slab_size, _block_size);
+		_slabs.emplace_back(new char[slab_size]);
+		_carve = _slabs.back().get();
+		_carve_end = _carve + slab_size;
+	}
+	
+	void *block = _carve;
+	_carve += _block_size;
+	return block;
+}
+
+void SlabPool::deallocate(void *block, size_t size, size_t align) {
+	if ((_block_size == 0) || (blockSize(size, align) > _block_size) || (_block_size % align != 0)) {
+		::operator delete(block);
+		return;
+	}
+	
+	free_block *freed = static_cast<free_block *>(block);
+	freed->next = _free;
+	_free = freed;
+	_in_use--;
+}
+
+void SlabPool::release() {
+	_slabs.clear();
+	_carve = _carve_end = nullptr;
+	_free = nullptr;
+	_in_use = 0;
+}
@@ -1,16 +1,24 @@
 #include <stdexcept>
 #include <unistd.h>
 #include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <random>
+#include <arpa/inet.h>
 #include "TCPConn.h"
 #include "strfuncts.h"
+#include "PlotCodec.h"
+#include "BlockCompress.h"
+#include "Metrics.h"
+#include "BufferPool.h"
 #include <crypto++/secblock.h>
 #include <crypto++/osrng.h>
 #include <crypto++/filters.h>
 #include <crypto++/rijndael.h>
 #include <crypto++/gcm.h>
 #include <crypto++/aes.h>
+#include <crypto++/hmac.h>
+#include <crypto++/sha.h>
+#include <crypto++/misc.h>
 
 using namespace CryptoPP;
 
@@ -19,16 +27,67 @@ const unsigned int iv_size = AES::BLOCKSIZE;
 const unsigned int key_size = AES::DEFAULT_KEYLENGTH;
 const unsigned int auth_size = 16;
 
+// First byte of a negotiated replication payload, saying how the batch is encoded. The high
+// bit means the rest of the payload is block compressed on top of that encoding.
+const uint8_t payload_raw = 0;
+const uint8_t payload_compact = 1;
+const uint8_t payload_compressed = 0x80;
+
+// Payloads smaller than this aren't worth compressing, and we refuse to expand past the max
+const size_t min_compress_size = 512;
+const size_t max_payload_size = 64 * 1024 * 1024;
+
+// Separates the server ID from its advertised capabilities in a SID message, and marks a SID
+// that is followed straight away by a session ticket and data
+const std::string caps_tag = ";caps=";
+const std::string resume_tag = ";resume";
+
+const size_t ticket_mac_size = HMAC<SHA256>::DIGESTSIZE;
+
+// Most bytes pulled off the socket per read
+const size_t conn_read_size = 16 * 1024;
+
+// Seeding a generator is the expensive part, so each thread keeps one around
+static AutoSeededRandomPool &randomPool() {
+	thread_local AutoSeededRandomPool pool;
+	return pool;
+}
+
+// HMAC over the client's ID and its replication payload, keyed by the ticket's secret. Ties
+// the data in a resumed first flight to whoever was actually given the ticket.
+static void ticketMAC(const ticket_secret &secret, const std::string &node_id, const std::vector<uint8_t> &payload, uint8_t *mac) {
+	HMAC<SHA256> hmac(secret.data(), secret.size());
+	hmac.Update(reinterpret_cast<const uint8_t *>(node_id.data()), node_id.size());
+	hmac.Update(payload.data(), payload.size());
+	hmac.Final(mac);
+}
+
+// Full handshake time, from our SID (client) or theirs (server) to verifying the other side
+static Histogram &handshakeTime() {
+	static Histogram &hist = MetricsRegistry::global().histogram("repl_handshake_seconds", "Time to complete the full authentication handshake", 30.0);
+	return hist;
+}
+
+// Plot count from the front of a raw replication batch, for the event log
+static uint32_t batchPlots(const std::vector<uint8_t> &batch) {
+	uint32_t count = 0;
+	if (batch.size() >= sizeof(count))
+		memcpy(&count, batch.data(), sizeof(count));
+	return count;
+}
+
 /**********************************************************************************************
  * TCPConn (constructor) - creates the connector and initializes - creates the command strings
  *                         to wrap around network commands
  *
  *    Params: key - reference to the pre-loaded AES key
+ *            tickets - the server's session ticket store
+ *            events - the server's binary event log
  *            verbosity - stdout verbosity - 3 = max
  *
  **********************************************************************************************/
 
-TCPConn::TCPConn(LogMgr &server_log, CryptoPP::SecByteBlock &key, unsigned int verbosity) : _data_ready(false), _aes_key(key), _verbosity(verbosity), _server_log(server_log) {
+TCPConn::TCPConn(LogMgr &server_log, CryptoPP::SecByteBlock &key, SessionTickets &tickets, EventLog &events, unsigned int verbosity) : _data_ready(false), _aes_key(key), _tickets(tickets), _verbosity(verbosity), _server_log(server_log), _events(events), _conn_id(events.newConnID()) {
 	// prep some tools to search for command sequences in data
 	auto slash = (uint8_t) '/';
 	c_rep.push_back((uint8_t) '<');
@@ -64,6 +123,26 @@ TCPConn::TCPConn(LogMgr &server_log, CryptoPP::SecByteBlock &key, unsigned int v
 	
 	c_endsid = c_sid;
 	c_endsid.insert(c_endsid.begin() + 1, 1, slash);
+	
+	c_tkt.push_back((uint8_t) '<');
+	c_tkt.push_back((uint8_t) 'T');
+	c_tkt.push_back((uint8_t) 'K');
+	c_tkt.push_back((uint8_t) 'T');
+	c_tkt.push_back((uint8_t) '>');
+	
+	c_endtkt = c_tkt;
+	c_endtkt.insert(c_endtkt.begin() + 1, 1, slash);
+	
+	// Start with a recycled receive buffer so it's likely already big enough
+	_buf = BufferPool::global().acquire();
+}
+
+// Hands the connection's buffers back for the next connection to use
+TCPConn::~TCPConn() {
+	BufferPool &pool = BufferPool::global();
+	pool.release(_buf);
+	pool.release(_inputbuf);
+	pool.release(_outputbuf);
 }
 
 /**********************************************************************************************
@@ -103,7 +182,9 @@ bool TCPConn::sendData(std::vector<uint8_t> &buf) {
 }
 
 /**********************************************************************************************
- * encryptData - block encrypts data and places the results in the buffer in <ID><Data> format
+ * encryptData - block encrypts data and places the results in the buffer in <ID><Data> format.
+ *               CFB is a stream mode (no padding), so the data is encrypted in place and the
+ *               IV slid in front of it, with no temporary copies
  *
  *    Params:  buf - where to place the <IV><Data> stream
  *
@@ -113,22 +194,17 @@ bool TCPConn::sendData(std::vector<uint8_t> &buf) {
 void TCPConn::encryptData(std::vector<uint8_t> &buf) {
 	// For the initialization vector
 	SecByteBlock init_vector(iv_size);
-	AutoSeededRandomPool rnd;
 	
 	// Generate our random init vector
-	rnd.GenerateBlock(init_vector, init_vector.size());
+	randomPool().GenerateBlock(init_vector, init_vector.size());
 	
 	// Encrypt the data
 	CFB_Mode<AES>::Encryption encryptor;
 	encryptor.SetKeyWithIV(_aes_key, _aes_key.size(), init_vector);
-	
-	std::string cipher;
-	ArraySource as(buf.data(), buf.size(), true, new StreamTransformationFilter(encryptor, new StringSink(cipher)));
+	encryptor.ProcessData(buf.data(), buf.data(), buf.size());
 	
 	// Now add the IV to the stream we will be sending out
-	std::vector<uint8_t> enc_data(init_vector.begin(), init_vector.end());
-	enc_data.insert(enc_data.end(), cipher.begin(), cipher.end());
-	buf = enc_data;
+	buf.insert(buf.begin(), init_vector.begin(), init_vector.end());
 }
 
 /**********************************************************************************************
@@ -172,12 +248,28 @@ void TCPConn::handleConnection() {
 				case s_auth4:
 					handleAuth4(*packet);
 					break;
+					// Client: sent a ticket with our data, ACK means it was accepted
+				case s_resumewait:
+					awaitAck(*packet);
+					break;
+					// Server: resuming client sends its ticket proof, then its data
+				case s_tktrx:
+					receiveTicket(*packet);
+					break;
+				case s_resumerx:
+					receiveResumed(*packet);
+					break;
+					// Client: data was ACK'd, now collect the ticket for next time
+				case s_tktwait:
+					storeTicket(*packet);
+					break;
 					// Server: Data received and conn disconnected, but waiting for the data to be retrieved
 				case s_hasdata:
 					break;
 				default:
 					throw std::runtime_error("Invalid connection status!");
 			}
+			BufferPool::global().release(*packet);
 		}
 	} catch (socket_error &e) {
 		std::cout << "Socket error, disconnecting.\n";
@@ -188,15 +280,23 @@ void TCPConn::handleConnection() {
 }
 
 /**********************************************************************************************
- * sendSID()  - Client: after a connection, client sends its Server ID to the server
+ * sendSID()  - Client: after a connection, client sends its Server ID to the server. If we
+ *              hold a ticket from this server we skip the handshake and send everything now.
  *
  *    Throws: socket_error for network issues, runtime_error for unrecoverable issues
  **********************************************************************************************/
 
 void TCPConn::sendSID(const std::vector<uint8_t> &recvBuf) {
-	std::vector<uint8_t> buf(_svr_id.begin(), _svr_id.end());
-	wrapCmd(buf, c_sid, c_endsid);
+	SessionTicket ticket;
+	if (_tickets.take(_node_id, ticket)) {
+		sendResume(ticket);
+		return;
+	}
+	
+	std::vector<uint8_t> buf = makeSID(true);
 	sendData(buf);
+	recordEvent(ev_auth_start);
+	_auth_start = std::chrono::steady_clock::now();
 	
 	_status = s_auth2;
 }
@@ -208,9 +308,15 @@ void TCPConn::sendSID(const std::vector<uint8_t> &recvBuf) {
  **********************************************************************************************/
 
 void TCPConn::receiveSID(const std::vector<uint8_t> &recvBuf) {
-	std::string node(recvBuf.begin(), recvBuf.end());
-	setNodeID(node.c_str());
+	parseSID(recvBuf);
 	
+	// A resuming client sends its ticket next instead of waiting for our challenge
+	if (_resuming) {
+		_status = s_tktrx;
+		return;
+	}
+	
+	_auth_start = std::chrono::steady_clock::now();
 	sendRandomBytes();
 	_status = s_auth3;
 }
@@ -223,11 +329,17 @@ void TCPConn::receiveSID(const std::vector<uint8_t> &recvBuf) {
  **********************************************************************************************/
 
 void TCPConn::transmitData(const std::vector<uint8_t> &recvBuf) {
-	std::string node(recvBuf.begin(), recvBuf.end());
-	setNodeID(node.c_str());
+	parseSID(recvBuf);
 	
-	// Send the replication data
-	sendData(_outputbuf);
+	// Encode the replication data however the server can take it and send it
+	std::vector<uint8_t> buf = BufferPool::global().acquire();
+	encodePayload(_outputbuf, buf);
+	size_t wire_size = buf.size();
+	wrapCmd(buf, c_rep, c_endrep);
+	sendData(buf);
+	BufferPool::global().release(buf);
+	_tx_time = std::chrono::steady_clock::now();
+	recordEvent(ev_batch_sent, batchPlots(_outputbuf), _outputbuf.size(), wire_size);
 	
 	if (_verbosity >= 3)
 		std::cout << "Successfully authenticated connection with " << getNodeID() << " and sending replication data.\n";
@@ -245,11 +357,24 @@ void TCPConn::transmitData(const std::vector<uint8_t> &recvBuf) {
  **********************************************************************************************/
 
 void TCPConn::waitForData(const std::vector<uint8_t> &recvBuf) {
-	_inputbuf = recvBuf;
+	try {
+		decodePayload(recvBuf, _inputbuf);
+	} catch (std::runtime_error &e) {
+		std::string msg = "Bad replication data from node '";
+		msg += getNodeID();
+		msg += "', disconnecting. Msg: ";
+		msg += e.what();
+		_server_log.writeLog(msg);
+		disconnect();
+		return;
+	}
 	_data_ready = true;
 	
-	// Send the acknowledgement and disconnect
-	sendData(c_ack);
+	// Send the acknowledgement (plus a ticket for next time, if they take them) and disconnect
+	std::vector<uint8_t> buf = c_ack;
+	if ((_peer_caps >= 0) && (local_caps & (unsigned int) _peer_caps & cap_ticket))
+		appendTicket(buf);
+	sendData(buf);
 	
 	if (_verbosity >= 2)
 		std::cout << "Successfully received replication data from " << getNodeID() << "\n";
@@ -265,12 +390,152 @@ void TCPConn::waitForData(const std::vector<uint8_t> &recvBuf) {
  **********************************************************************************************/
 
 void TCPConn::awaitAck(const std::vector<uint8_t> &recvBuf) {
+	auto rtt = std::chrono::steady_clock::now() - _tx_time;
+	_ack_rtt = std::chrono::duration<double>(rtt).count();
+	_acked_bytes = _outputbuf.size();
+	recordEvent(ev_batch_acked, std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+	
+	// A server that issues tickets sends one right behind the ACK
+	if ((_peer_caps >= 0) && (local_caps & (unsigned int) _peer_caps & cap_ticket)) {
+		_status = s_tktwait;
+		return;
+	}
+	
 	if (_verbosity >= 3)
 		std::cout << "Data ack received from " << getNodeID() << ". Disconnecting.\n";
 	
 	disconnect();
 }
 
+/**********************************************************************************************
+ * sendResume - Client: sends our SID, the ticket proof and the replication data in one flight.
+ *              The proof is the ticket ID followed by an HMAC (keyed by the ticket secret)
+ *              over our ID and the payload. If the server refuses it, it answers with the
+ *              usual auth challenge and we fall back to the full handshake.
+ *
+ *    Throws: socket_error for network issues, runtime_error for unrecoverable issues
+ **********************************************************************************************/
+
+void TCPConn::sendResume(const SessionTicket &ticket) {
+	// We haven't seen the server's SID, so encode for what it supported when it gave us the ticket
+	_peer_caps = (int) ticket.peer_caps;
+	
+	std::vector<uint8_t> payload;
+	encodePayload(_outputbuf, payload);
+	
+	std::vector<uint8_t> proof(ticket_id_size + ticket_mac_size);
+	std::copy(ticket.id.begin(), ticket.id.end(), proof.begin());
+	ticketMAC(ticket.secret, _svr_id, payload, proof.data() + ticket_id_size);
+	wrapCmd(proof, c_tkt, c_endtkt);
+	wrapCmd(payload, c_rep, c_endrep);
+	
+	std::vector<uint8_t> buf = makeSID(true, true);
+	buf.insert(buf.end(), proof.begin(), proof.end());
+	buf.insert(buf.end(), payload.begin(), payload.end());
+	sendData(buf);
+	_tx_time = std::chrono::steady_clock::now();
+	recordEvent(ev_resume_sent);
+	recordEvent(ev_batch_sent, batchPlots(_outputbuf), _outputbuf.size(), payload.size());
+	
+	if (_verbosity >= 3)
+		std::cout << "Resuming session with " << getNodeID() << " and sending replication data.\n";
+	
+	_status = s_resumewait;
+}
+
+/**********************************************************************************************
+ * receiveTicket - Server: holds on to the resuming client's ticket proof until its data arrives
+ *
+ * receiveResumed - Server: checks the ticket proof against the data. If it holds up, the data
+ *                  is taken just as after a full handshake. Otherwise we send the auth
+ *                  challenge and the client starts over with the full handshake.
+ *
+ *    Throws: socket_error for network issues, runtime_error for unrecoverable issues
+ **********************************************************************************************/
+
+void TCPConn::receiveTicket(const std::vector<uint8_t> &recvBuf) {
+	_ticket_proof = recvBuf;
+	_status = s_resumerx;
+}
+
+void TCPConn::receiveResumed(const std::vector<uint8_t> &recvBuf) {
+	bool valid = false;
+	if (_ticket_proof.size() == ticket_id_size + ticket_mac_size) {
+		ticket_id id;
+		ticket_secret secret;
+		std::copy(_ticket_proof.begin(), _ticket_proof.begin() + ticket_id_size, id.begin());
+		
+		if (_tickets.redeem(_node_id, id, secret)) {
+			std::array<uint8_t, ticket_mac_size> mac;
+			ticketMAC(secret, _node_id, recvBuf, mac.data());
+			valid = VerifyBufsEqual(mac.data(), _ticket_proof.data() + ticket_id_size, ticket_mac_size);
+		}
+	}
+	_ticket_proof.clear();
+	_resuming = false;
+	
+	if (!valid) {
+		std::string msg = "Session ticket from node '";
+		msg += getNodeID();
+		msg += "' refused, falling back to the full handshake.";
+		_server_log.writeLog(msg);
+		recordEvent(ev_resume_refused);
+		
+		sendRandomBytes();
+		_status = s_auth3;
+		return;
+	}
+	
+	recordEvent(ev_resume_ok);
+	if (_verbosity >= 3)
+		std::cout << "Resumed session with " << getNodeID() << ".\n";
+	
+	waitForData(recvBuf);
+}
+
+/**********************************************************************************************
+ * appendTicket - Server: issues a new single-use ticket to the other side and appends the
+ *                encrypted <TKT> message to buf
+ *
+ * storeTicket - Client: decrypts the ticket the server sent and keeps it for the next
+ *               connection to that server
+ *
+ *    Throws: socket_error for network issues, runtime_error for unrecoverable issues
+ **********************************************************************************************/
+
+void TCPConn::appendTicket(std::vector<uint8_t> &buf) {
+	ticket_id id;
+	ticket_secret secret;
+	randomPool().GenerateBlock(id.data(), id.size());
+	randomPool().GenerateBlock(secret.data(), secret.size());
+	_tickets.issue(_node_id, id, secret);
+	
+	std::vector<uint8_t> tkt(id.begin(), id.end());
+	tkt.insert(tkt.end(), secret.begin(), secret.end());
+	encryptData(tkt);
+	wrapCmd(tkt, c_tkt, c_endtkt);
+	buf.insert(buf.end(), tkt.begin(), tkt.end());
+}
+
+void TCPConn::storeTicket(const std::vector<uint8_t> &recvBuf) {
+	std::vector<uint8_t> buf = recvBuf;
+	if (buf.size() == iv_size + ticket_id_size + ticket_secret_size) {
+		decryptData(buf);
+		
+		SessionTicket ticket;
+		std::copy(buf.begin(), buf.begin() + ticket_id_size, ticket.id.begin());
+		std::copy(buf.begin() + ticket_id_size, buf.end(), ticket.secret.begin());
+		ticket.peer_caps = (unsigned int) _peer_caps;
+		ticket.expires = time(NULL) + ticket_lifetime - ticket_margin;
+		_tickets.store(_node_id, ticket);
+	}
+	
+	if (_verbosity >= 3)
+		std::cout << "Data ack and session ticket received from " << getNodeID() << ". Disconnecting.\n";
+	
+	disconnect();
+}
+
 void TCPConn::handleAuth2(const std::vector<uint8_t> &recvBuf) {
 	// TODO: RX random bytes
 	auto rxRandomBytes = std::array<uint8_t, RANDOM_BYTE_COUNT>{};
@@ -293,14 +558,18 @@ void TCPConn::handleAuth3(const std::vector<uint8_t> &recvBuf) {
 	// TODO: verify encrypted bytes
 	if (!std::equal(_authstr.begin(), _authstr.end(), rxEncryptedBytes.begin())) {
 		std::cerr << "Failed authentication check. Disconnecting..." << std::endl;
+		recordEvent(ev_auth_fail, 1);
 		disconnect();
 		return;
 	}
+	recordEvent(ev_auth_ok, 1);
+	handshakeTime().record(std::chrono::duration<double>(std::chrono::steady_clock::now() - _auth_start).count());
 	sendEncryptedBytes(rxRandomBytes);
 	
 	_status = s_datarx;
-	std::vector<uint8_t> sidBuffer(_svr_id.begin(), _svr_id.end());
-	wrapCmd(sidBuffer, c_sid, c_endsid);
+	
+	// Only advertise our capabilities back to a client that advertised its own
+	std::vector<uint8_t> sidBuffer = makeSID(_peer_caps >= 0);
 	sendData(sidBuffer);
 }
 
@@ -313,9 +582,12 @@ void TCPConn::handleAuth4(const std::vector<uint8_t> &recvBuf) {
 	// TODO: verify encrypted bytes
 	if (!std::equal(_authstr.begin(), _authstr.end(), rxEncryptedBytes.begin())) {
 		std::cerr << "Failed authentication check. Disconnecting..." << std::endl;
+		recordEvent(ev_auth_fail);
 		disconnect();
 		return;
 	}
+	recordEvent(ev_auth_ok);
+	handshakeTime().record(std::chrono::duration<double>(std::chrono::steady_clock::now() - _auth_start).count());
 	_status = s_datatx;
 }
 
@@ -347,11 +619,7 @@ void TCPConn::sendRandomAndEncryptedBytes(const std::array<uint8_t, RANDOM_BYTE_
 }
 
 void TCPConn::createRandomBytes() {
-	std::default_random_engine generator{std::random_device{}()};
-	std::uniform_int_distribution<uint8_t> distribution(0, 255);
-	
-	for (auto &r : _authstr)
-		r = distribution(generator);
+	randomPool().GenerateBlock(_authstr.data(), _authstr.size());
 }
 
 
@@ -361,8 +629,13 @@ void TCPConn::createRandomBytes() {
  *
  *    Params: buf - the encrypted string and holds the decrypted data (minus IV)
  *
+ *    Throws: socket_error if buf is too short to hold an IV
+ *
  **********************************************************************************************/
 void TCPConn::decryptData(std::vector<uint8_t> &buf) {
+	if (buf.size() < iv_size)
+		throw socket_error("Encrypted data was shorter than its IV");
+	
 	// For the initialization vector
 	SecByteBlock init_vector(iv_size);
 	
@@ -370,15 +643,10 @@ void TCPConn::decryptData(std::vector<uint8_t> &buf) {
 	init_vector.Assign(buf.data(), iv_size);
 	buf.erase(buf.begin(), buf.begin() + iv_size);
 	
-	// Decrypt the data
+	// Decrypt the data in place
 	CFB_Mode<AES>::Decryption decryptor;
 	decryptor.SetKeyWithIV(_aes_key, _aes_key.size(), init_vector);
-	
-	std::string recovered;
-	ArraySource as(buf.data(), buf.size(), true, new StreamTransformationFilter(decryptor, new StringSink(recovered)));
-	
-	buf.assign(recovered.begin(), recovered.end());
-	
+	decryptor.ProcessData(buf.data(), buf.data(), buf.size());
 }
 
 /**********************************************************************************************
@@ -393,7 +661,7 @@ void TCPConn::decryptData(std::vector<uint8_t> &buf) {
  **********************************************************************************************/
 
 bool TCPConn::getData() {
-	std::array<uint8_t, 1024> readbuf = {};
+	std::array<uint8_t, conn_read_size> readbuf;
 	int n;
 	while ((n = read(_connfd.getFD(), readbuf.data(), readbuf.size())) > 0) {
 		_buf.insert(_buf.end(), readbuf.begin(), readbuf.begin() + n);
@@ -403,8 +671,12 @@ bool TCPConn::getData() {
 
 
 std::optional<std::vector<uint8_t>> TCPConn::getPacket() {
-	if (getData())
+	if (getData()) {
+		// A server that refused our ticket answers with its auth challenge instead of the ACK
+		if ((_status == s_resumewait) && (_buf.size() >= c_auth.size()) && std::equal(c_auth.begin(), c_auth.end(), _buf.begin()))
+			_status = s_auth2;
 		return getCmdData(getStateStartEnd(_status));
+	}
 	if (_status == s_connecting)
 		return std::vector<uint8_t>{};
 	return std::nullopt;
@@ -439,7 +711,8 @@ std::optional<std::vector<uint8_t>> TCPConn::getCmdData(std::pair<std::vector<ui
 	if ((start == _buf.end()) || (end == _buf.end()))
 		return std::nullopt;
 	
-	auto ret = std::make_optional(std::vector<uint8_t>(start + startcmd.size(), end));
+	auto ret = std::make_optional(BufferPool::global().acquire(end - start - startcmd.size()));
+	ret->assign(start + startcmd.size(), end);
 	_buf.erase(_buf.begin(), end + endcmd.size());
 	return ret;
 }
@@ -469,8 +742,9 @@ void TCPConn::wrapCmd(std::vector<uint8_t> &buf, std::vector<uint8_t> &startcmd,
 
 void TCPConn::getInputData(std::vector<uint8_t> &buf) {
 	
-	// Returns the replication data off this connection, then prepares it to be removed
-	buf = _inputbuf;
+	// Hands over the replication data off this connection, then prepares it to be removed
+	buf.swap(_inputbuf);
+	BufferPool::global().release(_inputbuf);
 	
 	_data_ready = false;
 	_status = s_none;
@@ -478,7 +752,8 @@ void TCPConn::getInputData(std::vector<uint8_t> &buf) {
 
 
 /**********************************************************************************************
- * connect - Opens the socket FD, attempting to connect to the remote server
+ * connect - Opens the socket FD and starts connecting to the remote server. Doesn't wait for
+ *           the connect to finish--see finishConnect
  *
  *    Params:  ip_addr - ip address string to connect to
  *             port - port in host format to connect to
@@ -487,45 +762,200 @@ void TCPConn::getInputData(std::vector<uint8_t> &buf) {
  **********************************************************************************************/
 
 void TCPConn::connect(const char *ip_addr, unsigned short port) {
-	
-	// Set the status to connecting
-	_status = s_connecting;
-	
-	// Try to connect
-	if (!_connfd.connectTo(ip_addr, port))
-		throw socket_error("TCP Connection failed!");
-	
-	_connfd.setNonBlocking();
-	_connected = true;
+	in_addr n_ip_addr;
+	inet_pton(AF_INET, ip_addr, &n_ip_addr);
+	connect(n_ip_addr.s_addr, htons(port));
 }
 
 
 // Same as above, but ip_addr and port are in network (big endian) format
 void TCPConn::connect(unsigned long ip_addr, unsigned short port) {
+	setTarget(ip_addr, port);
+	connect();
+}
+
+// Remembers where to connect (network format) so connect() can be retried later
+void TCPConn::setTarget(unsigned long ip_addr, unsigned short port) {
+	_connfd.setAddr(ip_addr, port);
+	_status = s_connecting;
+	_outgoing = true;
+}
+
+void TCPConn::connect() {
 	// Set the status to connecting
 	_status = s_connecting;
 	
-	if (!_connfd.connectTo(ip_addr, port))
-		throw socket_error("TCP Connection failed!");
-	
-	_connfd.setNonBlocking();
+	_connect_start = std::chrono::steady_clock::now();
+	recordEvent(ev_connect_start);
+	_connect_pending = !_connfd.connectAsync();
 	_connected = true;
+	if (!_connect_pending) {
+		auto took = std::chrono::steady_clock::now() - _connect_start;
+		recordEvent(ev_connect_done, std::chrono::duration_cast<std::chrono::microseconds>(took).count());
+	}
+}
+
+/**********************************************************************************************
+ * finishConnect - checks on a connect started by connect()
+ *
+ *    Params:  timeout - seconds after which a connect still in progress counts as failed
+ *
+ *    Returns: true once connected, false while still in progress
+ *
+ *    Throws: socket_error if the connect failed or timed out
+ **********************************************************************************************/
+
+bool TCPConn::finishConnect(double timeout) {
+	if (!_connect_pending)
+		return true;
+	
+	if (_connfd.checkConnect()) {
+		_connect_pending = false;
+		auto took = std::chrono::steady_clock::now() - _connect_start;
+		recordEvent(ev_connect_done, std::chrono::duration_cast<std::chrono::microseconds>(took).count());
+		return true;
+	}
+	
+	if (std::chrono::duration<double>(std::chrono::steady_clock::now() - _connect_start).count() > timeout)
+		throw socket_error("Connect timed out");
+	return false;
 }
 
 /**********************************************************************************************
  * assignOutgoingData - sets up the connection so that, at the next handleConnection, the data
  *                      is sent to the target server
  *
- *    Params:  data - the data stream to send to the server
+ *    Params:  data - the data stream to send to the server (taken, leaving data empty)
  *
  **********************************************************************************************/
 
 void TCPConn::assignOutgoingData(std::vector<uint8_t> &data) {
 	
-	_outputbuf.clear();
-	_outputbuf = c_rep;
-	_outputbuf.insert(_outputbuf.end(), data.begin(), data.end());
-	_outputbuf.insert(_outputbuf.end(), c_endrep.begin(), c_endrep.end());
+	// Held raw--how it gets encoded depends on what the server supports, which we learn later
+	BufferPool::global().release(_outputbuf);
+	_outputbuf.swap(data);
+}
+
+/**********************************************************************************************
+ * makeSID - builds our wrapped <SID> message. With capabilities it reads "<id>;caps=<n>", and
+ *           a client resuming a session adds ";resume"
+ *
+ * parseSID - pulls the other side's node ID, capabilities (if any) and resume request out of
+ *            its SID message
+ **********************************************************************************************/
+
+std::vector<uint8_t> TCPConn::makeSID(bool with_caps, bool resume) {
+	std::string sid = _svr_id;
+	if (with_caps)
+		sid += caps_tag + std::to_string(local_caps);
+	if (resume)
+		sid += resume_tag;
+	
+	std::vector<uint8_t> buf(sid.begin(), sid.end());
+	wrapCmd(buf, c_sid, c_endsid);
+	return buf;
+}
+
+void TCPConn::parseSID(const std::vector<uint8_t> &recvBuf) {
+	std::string node(recvBuf.begin(), recvBuf.end());
+	
+	auto resume_pos = node.find(resume_tag);
+	if (resume_pos != std::string::npos) {
+		_resuming = true;
+		node.erase(resume_pos);
+	}
+	
+	auto caps_pos = node.find(caps_tag);
+	if (caps_pos != std::string::npos) {
+		_peer_caps = (int) strtol(node.c_str() + caps_pos + caps_tag.size(), NULL, 10);
+		node.erase(caps_pos);
+	}
+	setNodeID(node.c_str());
+}
+
+/**********************************************************************************************
+ * encodePayload - turns the raw replication batch into the <REP> payload. A legacy peer gets
+ *                 the batch as-is. Otherwise the payload starts with a format byte and uses
+ *                 the best encoding both sides support, block compressed on top when both
+ *                 sides support it and the batch is big enough to be worth it.
+ *
+ * decodePayload - the reverse, run by the receiving server
+ *
+ *    Throws: runtime_error if the payload is malformed
+ **********************************************************************************************/
+
+void TCPConn::encodePayload(const std::vector<uint8_t> &batch, std::vector<uint8_t> &payload) {
+	if (_peer_caps < 0) {
+		payload = batch;
+		return;
+	}
+	
+	unsigned int caps = local_caps & (unsigned int) _peer_caps;
+	uint8_t format;
+	std::vector<uint8_t> encoded = BufferPool::global().acquire();
+	if (caps & cap_compact) {
+		PlotCodec::compactBatch(batch, encoded);
+		format = payload_compact;
+	} else {
+		encoded = batch;
+		format = payload_raw;
+	}
+	
+	// Block compress on top if we can, it's big enough to bother and it actually got smaller
+	payload.clear();
+	if ((caps & cap_compress) && (encoded.size() >= min_compress_size)) {
+		BlockCompress::compress(encoded.data(), encoded.size(), payload);
+		if (payload.size() < encoded.size()) {
+			payload.insert(payload.begin(), format | payload_compressed);
+			encoded.clear();
+		} else
+			payload.clear();
+	}
+	
+	if (payload.empty()) {
+		payload.reserve(encoded.size() + 1);
+		payload.push_back(format);
+		payload.insert(payload.end(), encoded.begin(), encoded.end());
+	}
+	BufferPool::global().release(encoded);
+	
+	if (_verbosity >= 3)
+		std::cout << "Encoded " << batch.size() << " byte batch into " << payload.size() << " bytes for " << getNodeID() << "\n";
+}
+
+void TCPConn::decodePayload(const std::vector<uint8_t> &payload, std::vector<uint8_t> &batch) {
+	if (_peer_caps < 0) {
+		batch = payload;
+		return;
+	}
+	
+	if (payload.empty())
+		throw std::runtime_error("Empty replication payload");
+	
+	// Undo the block compression first if it was used
+	uint8_t format = payload[0];
+	const uint8_t *data = payload.data() + 1;
+	size_t len = payload.size() - 1;
+	
+	std::vector<uint8_t> expanded = BufferPool::global().acquire();
+	if (format & payload_compressed) {
+		BlockCompress::decompress(data, len, expanded, max_payload_size);
+		data = expanded.data();
+		len = expanded.size();
+		format &= ~payload_compressed;
+	}
+	
+	switch (format) {
+		case payload_raw:
+			batch.assign(data, data + len);
+			break;
+		case payload_compact:
+			PlotCodec::expandBatch(data, len, batch);
+			break;
+		default:
+			throw std::runtime_error("Unknown replication payload encoding");
+	}
+	BufferPool::global().release(expanded);
 }
 
 /**********************************************************************************************
@@ -534,8 +964,10 @@ void TCPConn::assignOutgoingData(std::vector<uint8_t> &data) {
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 void TCPConn::disconnect() {
+	backoff_claim.release();
 	_connfd.closeFD();
 	_connected = false;
+	_connect_pending = false;
 }
 
 /**********************************************************************************************
@@ -568,7 +1000,13 @@ std::pair<std::vector<uint8_t>, std::vector<uint8_t>> TCPConn::getStateStartEnd(
 		case s_datarx:
 			return std::pair{c_rep, c_endrep};
 		case s_waitack:
+		case s_resumewait:
 			return std::pair{c_ack, std::vector<uint8_t>{}};
+		case s_resumerx:
+			return std::pair{c_rep, c_endrep};
+		case s_tktrx:
+		case s_tktwait:
+			return std::pair{c_tkt, c_endtkt};
 		case s_hasdata:
 			return std::pair{std::vector<uint8_t>{}, std::vector<uint8_t>{}};
 		case s_auth2:
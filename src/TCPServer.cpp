@@ -11,7 +11,7 @@
 #include "TCPServer.h"
 #include "ALMgr.h"
 
-TCPServer::TCPServer(unsigned int verbosity) : _aes_key(CryptoPP::AES::DEFAULT_KEYLENGTH), _server_log("server.log", 0), _verbosity(verbosity) {
+TCPServer::TCPServer(unsigned int verbosity) : _aes_key(CryptoPP::AES::DEFAULT_KEYLENGTH), _whitelist("whitelist"), _server_log("server.log", 0), _verbosity(verbosity) {
 }
 
 
@@ -99,11 +99,12 @@ TCPConn *TCPServer::handleSocket() {
 	if (_sockfd.hasData()) {
 		
 		// Try to accept the connection
-		TCPConn *new_conn = new TCPConn(_server_log, _aes_key, _verbosity);
+		TCPConn *new_conn = new TCPConn(_server_log, _aes_key, _tickets, _events, _verbosity);
 		if (!new_conn->accept(_sockfd)) {
 			_server_log.strerrLog("Data received on socket but failed to accept.");
 			return NULL;
 		}
+		new_conn->recordEvent(ev_accept, new_conn->getIPAddr());
 		std::cout << "***Got a connection***\n";
 		
 		_connlist.push_back(std::unique_ptr<TCPConn>(new_conn));
@@ -114,8 +115,7 @@ TCPConn *TCPServer::handleSocket() {
 		
 		
 		// Check the whitelist
-		ALMgr al("whitelist");
-		if (!al.isAllowed(new_conn->getIPAddr())) {
+		if (!_whitelist.isAllowed(new_conn->getIPAddr())) {
 			// Disconnect the user
 			new_conn->disconnect();
 			
@@ -160,25 +160,13 @@ void TCPServer::handleConnections() {
 			if ((*tptr)->getStatus() == TCPConn::s_connecting) {
 				
 				// If our retry timer hasn't expired....skip
-				if ((*tptr)->reconnect > time(NULL)) {
+				if ((*tptr)->reconnect > std::chrono::steady_clock::now()) {
 					tptr++;
 					continue;
 				}
 				
-				unsigned long ip_addr = (*tptr)->getIPAddr();
-				unsigned short port = (*tptr)->getPort();
-				
-				// Try to connect and handle failure
-				try {
-					(*tptr)->connect(ip_addr, port);
-				} catch (socket_error &e) {
-					std::stringstream msg;
-					msg << "Connect to SID " << (*tptr)->getNodeID() << " failed when trying to send data. Msg: " << e.what();
-					if (_verbosity >= 2)
-						std::cout << msg.str() << "\n";
-					_server_log.writeLog(msg.str().c_str());
-					(*tptr)->disconnect();
-					(*tptr)->reconnect = time(NULL) + reconnect_delay;
+				tryConnect(**tptr);
+				if (!(*tptr)->isConnected()) {
 					tptr++;
 					continue;
 				}
@@ -199,6 +187,21 @@ void TCPServer::handleConnections() {
 			continue;
 		}
 		
+		// Connects finish in the background--check on them without waiting
+		if ((*tptr)->isConnectPending()) {
+			try {
+				if (!(*tptr)->finishConnect(_backoff.getConfig().connect_timeout)) {
+					tptr++;
+					continue;
+				}
+				_backoff.success((*tptr)->getPeerID());
+			} catch (socket_error &e) {
+				connectFailed(**tptr, e.what());
+				tptr++;
+				continue;
+			}
+		}
+		
 		// Process any user inputs
 		(*tptr)->handleConnection();
 		
@@ -208,6 +211,50 @@ void TCPServer::handleConnections() {
 	
 }
 
+/*********************************************************************************************
+ * tryConnect - starts connecting an outgoing connection unless its peer is backing off or
+ *              another connection is already finding out whether the peer is back. Either
+ *              way nothing here waits on the network.
+ *
+ * connectFailed - logs a failed connect, closes the socket and schedules the retry from the
+ *                 peer's backoff
+ *********************************************************************************************/
+void TCPServer::tryConnect(TCPConn &conn) {
+	auto now = std::chrono::steady_clock::now();
+	if (!_backoff.canAttempt(conn.getPeerID(), now, conn.backoff_claim)) {
+		conn.reconnect = _backoff.nextAttempt(conn.getPeerID(), now);
+		return;
+	}
+	
+	try {
+		conn.connect();
+		if (!conn.isConnectPending())
+			_backoff.success(conn.getPeerID());
+	} catch (socket_error &e) {
+		connectFailed(conn, e.what());
+	}
+}
+
+void TCPServer::connectFailed(TCPConn &conn, const char *msg) {
+	std::stringstream logmsg;
+	logmsg << "Connect to SID " << conn.getNodeID() << " failed when trying to send data. Msg: " << msg;
+	if (_verbosity >= 2)
+		std::cout << logmsg.str() << "\n";
+	_server_log.writeLog(logmsg.str().c_str());
+	
+	auto now = std::chrono::steady_clock::now();
+	conn.disconnect();
+	bool tripped = _backoff.failure(conn.getPeerID(), now);
+	conn.recordEvent(ev_connect_fail, tripped);
+	if (tripped) {
+		std::string tripmsg = "Too many failed connects to SID ";
+		tripmsg += conn.getNodeID();
+		tripmsg += ", holding off on it for a while.";
+		_server_log.writeLog(tripmsg);
+	}
+	conn.reconnect = _backoff.nextAttempt(conn.getPeerID(), now);
+}
+
 /*********************************************************************************************
  * loadAESKey - reads in the 128 bit AES key from the indicated file
  *********************************************************************************************/
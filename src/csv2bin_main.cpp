@@ -1,5 +1,7 @@
 /****************************************************************************************
- * csv2bin_main - reads in a csv file with drone information and saves it as a binary file
+ * csv2bin_main - reads in a csv file with drone information and saves it as a binary file.
+ *                Streams the input, so it runs in bounded memory however big the CSV is,
+ *                and can split it by node into one output per node in a single pass
  *
  *              **Students should not modify this code! Or at least you can to test your
  *                code, but your code should work with the unmodified version
@@ -8,75 +10,219 @@
 
 #include <stdexcept>
 #include <iostream>
-#include "FileDesc.h"
+#include <memory>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "DronePlotDB.h"
-#include "strfuncts.h"
+#include "PlotCSV.h"
+#include "PlotFile.h"
 
 using namespace std;
 
 void displayHelp(const char *execname) {
-	std::cout << execname << " <input file> <output file> <NodeID>\n";
-//   std::cout << "   t: maximum number of threads to use\n";
-//   std::cout << "   n: calculate primes up to the given range\n";
-//   std::cout << "   s: only run in single process mode\n";
-//   std::cout << "   m: only run in multithreaded mode\n";
-//   std::cout << "   w: skip writing to disk\n";
+	std::cout << execname << " [-f <format>] [-a] [-t <threads>] <input file> <output file> [<NodeID>[,<NodeID>...]]\n";
+	std::cout << "   Keeps only the plots from the given node(s), or all of them if none are given\n";
+	std::cout << "   f: output format - raw (default, what older tools read), versioned or compressed\n";
+	std::cout << "   a: split every node in the input into its own output file\n";
+	std::cout << "   t: most threads to parse with (default: one per core)\n";
+	std::cout << "   When there's an output per node, a %n in the output filename is replaced by the node\n";
+	std::cout << "   ID, otherwise _<NodeID> goes in front of the extension (sim.bin -> sim_2.bin)\n";
+}
+
+/*****************************************************************************************
+ * nodeFilename - the output filename for one node when splitting
+ *****************************************************************************************/
+
+std::string nodeFilename(const std::string &pattern, unsigned int node_id) {
+	std::string id = std::to_string(node_id);
+	std::string name = pattern;
+	
+	size_t pos = name.find("%n");
+	if (pos != std::string::npos) {
+		do {
+			name.replace(pos, 2, id);
+			pos = name.find("%n", pos + id.size());
+		} while (pos != std::string::npos);
+		return name;
+	}
+	
+	size_t dot = name.rfind('.');
+	size_t slash = name.rfind('/');
+	if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+		return name + "_" + id;
+	return name.substr(0, dot) + "_" + id + name.substr(dot);
 }
 
 
 int main(int argc, char *argv[]) {
+	PlotFile::file_format format = PlotFile::raw;
+	bool split_all = false;
+	unsigned int threads = 0;
+	std::vector<std::string> args;
+	
+	int c;
+	while ((c = getopt(argc, argv, "-f:at:")) != -1) {
+		switch (c) {
+			case 1:
+				args.push_back(optarg);
+				break;
+			
+			case 'f':
+				if (!PlotFile::formatFromName(optarg, format)) {
+					std::cerr << "Unknown format '" << optarg << "'. Use raw, versioned or compressed.\n";
+					exit(-1);
+				}
+				break;
+			
+			case 'a':
+				split_all = true;
+				break;
+			
+			case 't':
+				threads = (unsigned int) strtol(optarg, NULL, 10);
+				break;
+			
+			default:
+				displayHelp(argv[0]);
+				exit(0);
+		}
+	}
 	
 	// Check the command line input
-	if (argc < 4) {
+	if ((args.size() < 2) || (args.size() > 3)) {
 		displayHelp(argv[0]);
 		exit(0);
 	}
 	
 	// Get the filenames for the input and output file
-	std::string input_file(argv[1]);
-	std::string output_file(argv[2]);
+	std::string input_file(args[0]);
+	std::string output_file(args[1]);
 	
-	unsigned long node_id = strtol(argv[3], NULL, 10);
-	
-	std::cout << "Filtering to only node: " << node_id << "\n";
+	std::set<unsigned int> nodes;
+	if (args.size() == 3) {
+		const std::string &list = args[2];
+		size_t start = 0;
+		while (start <= list.size()) {
+			size_t comma = list.find(',', start);
+			if (comma == std::string::npos)
+				comma = list.size();
+			
+			std::string id = list.substr(start, comma - start);
+			char *end;
+			unsigned long node_id = strtoul(id.c_str(), &end, 10);
+			if (id.empty() || (*end != '\0')) {
+				std::cerr << "Invalid NodeID '" << id << "'.\n";
+				exit(-1);
+			}
+			nodes.insert((unsigned int) node_id);
+			start = comma + 1;
+		}
+	}
 	
-	std::cout << "Reading in the CSV file.";
+	// One output per node when asked to split, or when several nodes were picked
+	bool per_node = split_all || (nodes.size() > 1);
+	if (nodes.empty())
+		std::cout << "Keeping every node\n";
+	else {
+		std::cout << "Filtering to only node(s):";
+		for (auto node_id : nodes)
+			std::cout << " " << node_id;
+		std::cout << "\n";
+	}
 	
-	DronePlotDB db;
-	int count = 0;
-	if ((count = db.loadCSVFile(input_file.c_str())) < 0) {
-		std::cerr << "Either failed opening file for reading or file was corrupted.\n";
+	int infd = open(input_file.c_str(), O_RDONLY);
+	if (infd < 0) {
+		std::cerr << "Unable to open " << input_file << " for reading.\n";
 		exit(-1);
 	}
 	
-	// Filter by NodeID
-	for (unsigned int i = 1; i <= 3; i++) {
-		if (i != node_id)
-			db.removeNodeID(i);
-	}
+	// Outputs are opened the first time their node shows up. They're written under a .tmp name
+	// and only renamed into place once the whole input has gone through, so a bad input
+	// doesn't leave truncated files behind
+	std::map<unsigned int, std::unique_ptr<PlotFileWriter>> outputs;
+	std::vector<std::string> filenames;
+	PlotFileWriter *last_out = NULL;
+	unsigned int last_node = 0;
+	auto discardOutputs = [&]() {
+		outputs.clear();
+		for (auto &filename : filenames)
+			unlink((filename + ".tmp").c_str());
+	};
+	auto openOutput = [&](const std::string &filename) {
+		std::unique_ptr<PlotFileWriter> out(new PlotFileWriter);
+		filenames.push_back(filename);
+		if (!out->open((filename + ".tmp").c_str(), format)) {
+			std::cerr << "Unable to open " << filename << ".tmp for writing.\n";
+			discardOutputs();
+			exit(-1);
+		}
+		std::cout << "Writing to: " << filename << "\n";
+		return out;
+	};
+	if (!per_node)
+		outputs[0] = openOutput(output_file);
 	
-	if (count == 0) {
-		std::cout << "No data points in the file. Exiting without writing to output file.\n";
-		exit(0);
-	}
+	std::cout << "Reading in the CSV file.\n";
 	
-	std::cout << "Read in " << count << " drone data points successfully.\n";
-	std::cout << "Size: " << db.size() << "\n";
+	long count;
+	try {
+		count = PlotCSV::parseStream(infd, [&](std::vector<DronePlot> &plots) {
+			for (auto &plot : plots) {
+				if (!nodes.empty() && (nodes.count(plot.node_id) == 0))
+					continue;
+				
+				if (!per_node) {
+					outputs[0]->write(&plot, 1);
+					continue;
+				}
+				
+				if ((last_out == NULL) || (plot.node_id != last_node)) {
+					auto &out = outputs[plot.node_id];
+					if (!out)
+						out = openOutput(nodeFilename(output_file, plot.node_id));
+					last_out = out.get();
+					last_node = plot.node_id;
+				}
+				last_out->write(&plot, 1);
+			}
+		}, threads);
+		
+		for (auto &out : outputs)
+			out.second->close();
+	} catch (std::runtime_error &e) {
+		std::cerr << e.what() << "\n";
+		discardOutputs();
+		exit(-1);
+	}
+	close(infd);
 	
-	std::cout << "Writing to: " << output_file.c_str() << "\n";
-	if (db.writeBinaryFile(output_file.c_str()) < 0) {
-		std::cerr << "Unable to open output file for writing.\n";
+	if (count < 0) {
+		std::cerr << "Either failed reading the file or file was corrupted.\n";
+		discardOutputs();
 		exit(-1);
 	}
 	
-	std::cout << "Wrote " << db.size() << " drone data points\n";
-	db.clear();
+	for (auto &filename : filenames) {
+		if (rename((filename + ".tmp").c_str(), filename.c_str()) != 0) {
+			std::cerr << "Unable to rename " << filename << ".tmp into place.\n";
+			discardOutputs();
+			exit(-1);
+		}
+	}
 	
-	// Test the functions
-	db.loadBinaryFile(output_file.c_str());
+	std::cout << "Read in " << count << " drone data points successfully.\n";
+	if (count == 0)
+		std::cout << "No data points in the file.\n";
 	
-	std::cout << "Num: " << db.size() << "\n";
-	db.writeCSVFile("diditwork.csv");
+	for (auto &out : outputs) {
+		if (per_node)
+			std::cout << "Node " << out.first << ": ";
+		std::cout << "Wrote " << out.second->getCount() << " drone data points\n";
+	}
 	
 	return 0;
 }
@@ -0,0 +1,218 @@
+/****************************************************************************************
+ * evtdump_main - decodes a binary event log written by repsvr (-e) and summarizes it:
+ *                how often each event happened and how long connects, handshakes and
+ *                ACK round trips took, overall and per peer
+ *
+ ****************************************************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <getopt.h>
+#include "EventLog.h"
+
+// Latency samples (in microseconds) for one measurement
+struct latency_set {
+	std::vector<uint64_t> samples;
+	
+	void add(uint64_t usec) { samples.push_back(usec); };
+	
+	void print(const char *name) {
+		std::cout << "  " << std::left << std::setw(18) << name << std::right;
+		if (samples.empty()) {
+			std::cout << "no samples\n";
+			return;
+		}
+		
+		std::sort(samples.begin(), samples.end());
+		double total = 0;
+		for (uint64_t s : samples)
+			total += s;
+		
+		auto pct = [this](double p) { return samples[std::min(samples.size() - 1, (size_t) (p * samples.size()))] / 1000.0; };
+		std::cout << std::fixed << std::setprecision(3) << "n=" << samples.size() << "  min " << samples.front() / 1000.0
+		          << "  avg " << total / samples.size() / 1000.0 << "  p50 " << pct(0.5) << "  p99 " << pct(0.99)
+		          << "  max " << samples.back() / 1000.0 << " ms\n";
+	}
+};
+
+struct peer_summary {
+	unsigned long batches_sent = 0;
+	unsigned long batches_recv = 0;
+	unsigned long plots_sent = 0;
+	unsigned long plots_recv = 0;
+	unsigned long connect_fails = 0;
+	unsigned long trips = 0;
+	latency_set ack;
+};
+
+void displayHelp(const char *execname) {
+	std::cout << execname << " [-r] [-p <peer>] <event log>\n";
+	std::cout << "   r: print every record, not just the summary\n";
+	std::cout << "   p: only look at records about this peer ID\n";
+}
+
+// Prints one record as: seconds since the log opened, event, connection, peer, args
+void printRecord(const event_record &rec, uint64_t start_ns) {
+	std::cout << std::fixed << std::setprecision(6) << std::setw(12) << (rec.ts_ns - start_ns) / 1e9 << "  "
+	          << std::left << std::setw(15) << EventLog::eventName(rec.event) << std::right << "  conn " << std::setw(6) << rec.conn;
+	if (rec.peer == no_peer)
+		std::cout << "  peer    -";
+	else
+		std::cout << "  peer " << std::setw(4) << rec.peer;
+	std::cout << "  " << rec.args[0] << " " << rec.args[1] << " " << rec.args[2] << "\n";
+}
+
+
+int main(int argc, char *argv[]) {
+	bool print_all = false;
+	long only_peer = -1;
+	
+	int c;
+	while ((c = getopt(argc, argv, "rp:")) != -1) {
+		switch (c) {
+			case 'r':
+				print_all = true;
+				break;
+			case 'p':
+				only_peer = strtol(optarg, NULL, 10);
+				break;
+			default:
+				displayHelp(argv[0]);
+				exit(0);
+		}
+	}
+	
+	if (optind >= argc) {
+		displayHelp(argv[0]);
+		exit(0);
+	}
+	
+	std::ifstream in(argv[optind], std::ios::binary);
+	if (!in.is_open()) {
+		std::cerr << "Unable to open event log '" << argv[optind] << "'\n";
+		exit(-1);
+	}
+	
+	evlog_header header;
+	if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) || (memcmp(header.magic, evlog_magic, sizeof(evlog_magic)) != 0)) {
+		std::cerr << "Not an event log file.\n";
+		exit(-1);
+	}
+	if ((header.version != evlog_version) || (header.record_size != sizeof(event_record))) {
+		std::cerr << "Event log version " << header.version << " (" << header.record_size << " byte records) isn't supported.\n";
+		exit(-1);
+	}
+	
+	std::vector<unsigned long> counts(ev_count + 1, 0);
+	std::map<peer_id, peer_summary> peers;
+	std::map<uint32_t, uint64_t> auth_started;    // By connection
+	latency_set connect_lat, auth_lat, ack_lat;
+	unsigned long raw_bytes = 0, wire_bytes = 0, recv_bytes = 0;
+	unsigned long plots_added = 0, plots_removed = 0, dropped = 0;
+	uint64_t last_ns = header.mono_ns;
+	unsigned long total = 0;
+	
+	event_record rec;
+	while (in.read(reinterpret_cast<char *>(&rec), sizeof(rec))) {
+		if ((only_peer >= 0) && (rec.peer != (peer_id) only_peer))
+			continue;
+		
+		total++;
+		last_ns = std::max(last_ns, rec.ts_ns);
+		counts[std::min<uint16_t>(rec.event, ev_count)]++;
+		if (print_all)
+			printRecord(rec, header.mono_ns);
+		
+		peer_summary *peer = (rec.peer == no_peer) ? NULL : &peers[rec.peer];
+		switch (rec.event) {
+			case ev_connect_done:
+				connect_lat.add(rec.args[0]);
+				break;
+			case ev_connect_fail:
+				if (peer) {
+					peer->connect_fails++;
+					peer->trips += rec.args[0];
+				}
+				break;
+			case ev_auth_start:
+				auth_started[rec.conn] = rec.ts_ns;
+				break;
+			case ev_auth_ok: {
+				auto it = auth_started.find(rec.conn);
+				if (it != auth_started.end()) {
+					auth_lat.add((rec.ts_ns - it->second) / 1000);
+					auth_started.erase(it);
+				}
+				break;
+			}
+			case ev_batch_sent:
+				raw_bytes += rec.args[1];
+				wire_bytes += rec.args[2];
+				if (peer) {
+					peer->batches_sent++;
+					peer->plots_sent += rec.args[0];
+				}
+				break;
+			case ev_batch_acked:
+				ack_lat.add(rec.args[0]);
+				if (peer)
+					peer->ack.add(rec.args[0]);
+				break;
+			case ev_batch_recv:
+				recv_bytes += rec.args[1];
+				if (peer) {
+					peer->batches_recv++;
+					peer->plots_recv += rec.args[0];
+				}
+				break;
+			case ev_plots_added:
+				plots_added += rec.args[0];
+				plots_removed += rec.args[1];
+				break;
+			case ev_dropped:
+				dropped += rec.args[0];
+				break;
+		}
+	}
+	
+	std::cout << "\n" << total << " records over " << std::fixed << std::setprecision(3) << (last_ns - header.mono_ns) / 1e9 << " seconds";
+	if (dropped > 0)
+		std::cout << " (" << dropped << " more were dropped when the queue filled)";
+	std::cout << "\n\nEvents:\n";
+	for (uint16_t ev = 1; ev <= ev_count; ev++) {
+		if (counts[ev] > 0)
+			std::cout << "  " << std::left << std::setw(18) << EventLog::eventName(ev) << std::right << counts[ev] << "\n";
+	}
+	
+	std::cout << "\nLatencies:\n";
+	connect_lat.print("connect");
+	auth_lat.print("handshake");
+	ack_lat.print("ACK round trip");
+	
+	std::cout << "\nData:\n";
+	std::cout << "  sent " << raw_bytes << " bytes as " << wire_bytes << " on the wire";
+	if (raw_bytes > 0)
+		std::cout << std::setprecision(1) << " (" << 100.0 * wire_bytes / raw_bytes << "%)";
+	std::cout << "\n  received " << recv_bytes << " bytes\n";
+	std::cout << "  " << plots_added << " replicated plots applied, dedup removed " << plots_removed << "\n";
+	
+	if (!peers.empty()) {
+		std::cout << "\nPer peer:\n";
+		for (auto &p : peers) {
+			std::cout << "  peer " << p.first << ": sent " << p.second.batches_sent << " batches/" << p.second.plots_sent
+			          << " plots, received " << p.second.batches_recv << " batches/" << p.second.plots_recv << " plots, "
+			          << p.second.connect_fails << " failed connects";
+			if (p.second.trips > 0)
+				std::cout << " (circuit opened " << p.second.trips << "x)";
+			std::cout << "\n";
+			p.second.ack.print("  ACK round trip");
+		}
+	}
+	
+	return 0;
+}
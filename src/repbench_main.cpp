@@ -0,0 +1,420 @@
+/****************************************************************************************
+ * repbench_main - microbenchmarks for the replication hot paths. Compares the batch
+ *                 PlotCodec against the original byte-at-a-time DronePlot marshalling, and
+ *                 times message framing, AES encryption, the dedup pass (updatePlots),
+ *                 binary file loads and CSV dumps, so regressions show up before they hit
+ *                 a replication tick. Results can be written as JSON or CSV for comparing
+ *                 between builds.
+ *
+ ****************************************************************************************/
+
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <getopt.h>
+#include <crypto++/secblock.h>
+#include <crypto++/osrng.h>
+#include <crypto++/aes.h>
+#include "DronePlotDB.h"
+#include "PlotCodec.h"
+#include "TCPConn.h"
+#include "ReplicationManager.h"
+
+using namespace std;
+
+// Keeps the optimizer from throwing away results we never look at
+volatile uint64_t bench_sink = 0;
+
+/*****************************************************************************************
+ * legacySerialize/legacyDeserialize - the original per-byte DronePlot marshalling, kept
+ *                                     here as the baseline to compare against
+ *****************************************************************************************/
+
+void legacySerialize(DronePlot &plot, std::vector<uint8_t> &buf) {
+	uint8_t *dataptrs[5] = {(uint8_t *) &plot.drone_id, (uint8_t *) &plot.node_id, (uint8_t *) &plot.timestamp, (uint8_t *) &plot.latitude, (uint8_t *) &plot.longitude};
+	uint8_t sizes[5] = {sizeof(plot.drone_id), sizeof(plot.node_id), sizeof(plot.timestamp), sizeof(plot.latitude), sizeof(plot.longitude)};
+	
+	for (unsigned int i = 0; i < 5; i++) {
+		for (unsigned int j = 0; j < sizes[i]; j++, dataptrs[i]++) {
+			buf.push_back(*dataptrs[i]);
+		}
+	}
+}
+
+void legacyDeserialize(DronePlot &plot, std::vector<uint8_t> &buf, unsigned int start_pt) {
+	uint8_t *dataptrs[5] = {(uint8_t *) &plot.drone_id, (uint8_t *) &plot.node_id, (uint8_t *) &plot.timestamp, (uint8_t *) &plot.latitude, (uint8_t *) &plot.longitude};
+	uint8_t sizes[5] = {sizeof(plot.drone_id), sizeof(plot.node_id), sizeof(plot.timestamp), sizeof(plot.latitude), sizeof(plot.longitude)};
+	
+	unsigned int vpos = start_pt;
+	for (unsigned int i = 0; i < 5; i++) {
+		for (unsigned int j = 0; j < sizes[i]; j++, dataptrs[i]++) {
+			if (vpos > buf.size())
+				throw std::runtime_error("DronePlot deserialize ran out of data in vector buffer prematurely");
+			*dataptrs[i] = buf[vpos++];
+		}
+	}
+}
+
+/*****************************************************************************************
+ * genPlots - fills a vector with n random-ish plots
+ *****************************************************************************************/
+
+void genPlots(std::vector<DronePlot> &plots, size_t n) {
+	std::mt19937 rng(689);
+	std::uniform_int_distribution<unsigned int> drone(1, 50), node(1, 10);
+	std::uniform_real_distribution<float> coord(-90.0, 90.0);
+	
+	plots.clear();
+	plots.reserve(n);
+	for (size_t i = 0; i < n; i++)
+		plots.emplace_back(drone(rng), node(rng), (int) i, coord(rng), coord(rng));
+}
+
+/*****************************************************************************************
+ * genReplDB - fills db with n plots the way a replicated database looks before dedup: each
+ *             sighting is reported by one to three nodes, each node's clock off by its own
+ *             skew, so updatePlots has skews to find and duplicates to drop
+ *****************************************************************************************/
+
+void genReplDB(DronePlotDB &db, size_t n) {
+	const int skew[3] = {0, 7, -4};
+	std::mt19937 rng(689);
+	std::uniform_int_distribution<unsigned int> drone(1, 50), reporters(1, 3);
+	std::uniform_real_distribution<float> coord(-90.0, 90.0);
+	
+	db.clear();
+	for (int t = 0; db.size() < n; t++) {
+		int drone_id = drone(rng);
+		float lat = coord(rng), lon = coord(rng);
+		unsigned int count = reporters(rng);
+		for (unsigned int node = 1; (node <= count) && (db.size() < n); node++)
+			db.addPlot(drone_id, node, t + skew[node - 1], lat, lon);
+	}
+}
+
+/*****************************************************************************************
+ * BenchConn - a TCPConn we can feed bytes to directly, to time the framing on its own
+ *****************************************************************************************/
+
+class BenchConn : public TCPConn {
+	public:
+	using TCPConn::TCPConn;
+	using TCPConn::feedInput;
+	using TCPConn::getCmdData;
+	using TCPConn::getStateStartEnd;
+	using TCPConn::wrapCmd;
+};
+
+/*****************************************************************************************
+ * Results - every benchmark's timing, kept so they can be printed in the format asked for
+ *****************************************************************************************/
+
+struct bench_result {
+	std::string name;
+	size_t items;          // Items (plots, bytes, messages) handled per iteration
+	unsigned int iters;
+	double mean_ns;        // Per item
+	double median_ns;
+	double best_ns;
+	double mb_per_sec;     // Based on the mean
+};
+
+enum out_format {
+	fmt_text, fmt_json, fmt_csv
+};
+
+std::vector<bench_result> results;
+out_format format = fmt_text;
+
+/*****************************************************************************************
+ * runBench - times func over iters iterations, calling setup (untimed) before each one,
+ *            and records the per-item cost. Reports the mean, median and best iteration
+ *            since the median and best are far steadier between runs than the mean.
+ *
+ *    Params:  items - how many items each call handles
+ *             bytes - how many bytes each call handles (for MB/s)
+ *****************************************************************************************/
+
+template<typename Setup, typename Func>
+void runBench(const char *name, size_t items, size_t bytes, unsigned int iters, Setup setup, Func func) {
+	setup();
+	func();  // Warm up caches and buffers
+	
+	std::vector<double> times;
+	times.reserve(iters);
+	for (unsigned int i = 0; i < iters; i++) {
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		func();
+		times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	
+	double total = 0;
+	for (double t : times)
+		total += t;
+	std::sort(times.begin(), times.end());
+	
+	bench_result res;
+	res.name = name;
+	res.items = items;
+	res.iters = iters;
+	res.mean_ns = total * 1e9 / ((double) iters * items);
+	res.median_ns = times[times.size() / 2] * 1e9 / items;
+	res.best_ns = times.front() * 1e9 / items;
+	res.mb_per_sec = ((double) iters * bytes) / total / 1e6;
+	results.push_back(res);
+	
+	if (format == fmt_text) {
+		std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << items
+		          << std::setw(12) << std::fixed << std::setprecision(2) << res.mean_ns << " ns/item"
+		          << std::setw(12) << res.median_ns << " med" << std::setw(12) << res.mb_per_sec << " MB/s\n";
+	}
+}
+
+// Same, but for benchmarks with nothing to reset between iterations (bytes are plot bytes)
+template<typename Func>
+void runBench(const char *name, size_t nplots, unsigned int iters, Func func) {
+	runBench(name, nplots, nplots * DronePlot::getDataSize(), iters, []() {}, func);
+}
+
+/*****************************************************************************************
+ * writeResults - prints the collected results as JSON or CSV
+ *****************************************************************************************/
+
+void writeResults(std::ostream &out) {
+	out << std::fixed << std::setprecision(3);
+	if (format == fmt_csv) {
+		out << "name,items,iterations,mean_ns,median_ns,best_ns,mb_per_sec\n";
+		for (auto &res : results) {
+			out << res.name << "," << res.items << "," << res.iters << "," << res.mean_ns << "," << res.median_ns << ","
+			    << res.best_ns << "," << res.mb_per_sec << "\n";
+		}
+		return;
+	}
+	
+	out << "{\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		auto &res = results[i];
+		out << "    {\"name\": \"" << res.name << "\", \"items\": " << res.items << ", \"iterations\": " << res.iters
+		    << ", \"mean_ns\": " << res.mean_ns << ", \"median_ns\": " << res.median_ns << ", \"best_ns\": " << res.best_ns
+		    << ", \"mb_per_sec\": " << res.mb_per_sec << "}" << ((i + 1 < results.size()) ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+}
+
+void displayHelp(const char *execname) {
+	std::cout << execname << " [-n <plots per batch>] [-i <iterations>] [-u <max dedup plots>] [-f text|json|csv] [-o <file>]\n";
+	std::cout << "   n: plots per batch for serialization and file loads (default: 100000)\n";
+	std::cout << "   i: iterations per benchmark (default: 20)\n";
+	std::cout << "   u: largest database for the updatePlots runs, from 1000 up by 10x (default: 10000).\n";
+	std::cout << "      updatePlots is quadratic, so 100000 and up take minutes to hours\n";
+	std::cout << "   f: output format (default: text)\n";
+	std::cout << "   o: write JSON/CSV results to this file instead of stdout\n";
+}
+
+
+int main(int argc, char *argv[]) {
+	size_t nplots = 100000;
+	unsigned int iters = 20;
+	size_t max_dedup = 10000;
+	std::string outfile;
+	
+	int c = 0;
+	while ((c = getopt(argc, argv, "n:i:u:f:o:")) != -1) {
+		switch (c) {
+			case 'n':
+				nplots = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				iters = (unsigned int) strtoul(optarg, NULL, 10);
+				break;
+			case 'u':
+				max_dedup = strtoul(optarg, NULL, 10);
+				break;
+			case 'f':
+				if (strcmp(optarg, "json") == 0)
+					format = fmt_json;
+				else if (strcmp(optarg, "csv") == 0)
+					format = fmt_csv;
+				else if (strcmp(optarg, "text") == 0)
+					format = fmt_text;
+				else {
+					displayHelp(argv[0]);
+					exit(0);
+				}
+				break;
+			case 'o':
+				outfile = optarg;
+				break;
+			default:
+				displayHelp(argv[0]);
+				exit(0);
+		}
+	}
+	
+	if ((nplots == 0) || (iters == 0)) {
+		displayHelp(argv[0]);
+		exit(0);
+	}
+	
+	std::vector<DronePlot> plots;
+	genPlots(plots, nplots);
+	
+	std::vector<uint8_t> wire;
+	std::vector<uint8_t> buf;
+	PlotColumns cols;
+	
+	// Serialization: old per-byte loop, new DronePlot::serialize, and the batch codec
+	runBench("serialize/legacy", nplots, iters, [&]() {
+		buf.clear();
+		for (auto &plot : plots)
+			legacySerialize(plot, buf);
+		bench_sink += buf.size();
+	});
+	
+	runBench("serialize/DronePlot", nplots, iters, [&]() {
+		buf.clear();
+		for (auto &plot : plots)
+			plot.serialize(buf);
+		bench_sink += buf.size();
+	});
+	
+	runBench("serialize/PlotCodec", nplots, iters, [&]() {
+		buf.clear();
+		PlotCodec::encode(plots.begin(), plots.end(), buf);
+		bench_sink += buf.size();
+	});
+	
+	PlotCodec::decodeColumns(buf.data(), nplots, cols);
+	runBench("serialize/PlotColumns", nplots, iters, [&]() {
+		buf.clear();
+		PlotCodec::encodeColumns(cols, buf);
+		bench_sink += buf.size();
+	});
+	
+	// Deserialization of the same batch
+	wire.clear();
+	PlotCodec::encode(plots.begin(), plots.end(), wire);
+	
+	runBench("deserialize/legacy", nplots, iters, [&]() {
+		DronePlot plot;
+		for (size_t i = 0; i < nplots; i++) {
+			legacyDeserialize(plot, wire, i * DronePlot::getDataSize());
+			bench_sink += plot.drone_id;
+		}
+	});
+	
+	runBench("deserialize/DronePlot", nplots, iters, [&]() {
+		DronePlot plot;
+		for (size_t i = 0; i < nplots; i++) {
+			plot.deserialize(wire, i * DronePlot::getDataSize());
+			bench_sink += plot.drone_id;
+		}
+	});
+	
+	runBench("deserialize/PlotCodec", nplots, iters, [&]() {
+		PlotCodec::decode(wire.data(), nplots, [](DronePlot &plot) { bench_sink += plot.drone_id; });
+	});
+	
+	runBench("deserialize/PlotColumns", nplots, iters, [&]() {
+		PlotCodec::decodeColumns(wire.data(), nplots, cols);
+		bench_sink += cols.drone_id.back();
+	});
+	
+	// Framing and encryption go through a TCPConn with no socket behind it
+	LogMgr bench_log("/dev/null", 0);
+	CryptoPP::SecByteBlock key(CryptoPP::AES::DEFAULT_KEYLENGTH);
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(key, key.size());
+	SessionTickets tickets;
+	EventLog events;
+	BenchConn conn(bench_log, key, tickets, events, 0);
+	
+	auto rep_tags = conn.getStateStartEnd(TCPConn::s_datarx);
+	const size_t frame_sizes[] = {4 * 1024, 256 * 1024, 16 * 1024 * 1024};
+	for (size_t size : frame_sizes) {
+		// Filler that can't be mistaken for a tag
+		std::vector<uint8_t> frame(size, 'x');
+		BenchConn::wrapCmd(frame, rep_tags.first, rep_tags.second);
+		
+		std::string name = "framing/getCmdData/" + std::to_string(size / 1024) + "K";
+		runBench(name.c_str(), size, size, iters, [&]() { conn.feedInput(frame); }, [&]() {
+			auto data = conn.getCmdData(rep_tags);
+			bench_sink += data->size();
+		});
+	}
+	
+	// AES round trip on a batch-sized buffer
+	std::vector<uint8_t> plain = wire, cipher;
+	runBench("crypto/encryptData", nplots, wire.size(), iters, [&]() { cipher = plain; }, [&]() {
+		conn.encryptData(cipher);
+		bench_sink += cipher.size();
+	});
+	
+	std::vector<uint8_t> encrypted = plain;
+	conn.encryptData(encrypted);
+	runBench("crypto/decryptData", nplots, wire.size(), iters, [&]() { cipher = encrypted; }, [&]() {
+		conn.decryptData(cipher);
+		bench_sink += cipher.size();
+	});
+	
+	// Dedup pass over databases of increasing size. It's quadratic, so only a few iterations
+	// of the bigger ones
+	DronePlotDB db;
+	for (size_t size = 1000; size <= max_dedup; size *= 10) {
+		std::string name = "dedup/updatePlots/" + std::to_string(size);
+		unsigned int dedup_iters = std::max(1u, (unsigned int) (iters * 1000 / size));
+		runBench(name.c_str(), size, size * DronePlot::getDataSize(), dedup_iters, [&]() { genReplDB(db, size); }, [&]() {
+			ReplicationManager manager;
+			manager.updatePlots(db);
+			bench_sink += db.size();
+		});
+	}
+	
+	// Loading a binary plot file (from the page cache, so this is the parse cost)
+	char binfile[] = "/tmp/repbenchXXXXXX";
+	int tmpfd = mkstemp(binfile);
+	if (tmpfd < 0) {
+		std::cerr << "Unable to create a temp file for the load benchmark.\n";
+		exit(-1);
+	}
+	close(tmpfd);
+	
+	db.clear();
+	for (auto &plot : plots)
+		db.addPlot(plot.drone_id, plot.node_id, plot.timestamp, plot.latitude, plot.longitude);
+	std::streambuf *saved = std::cout.rdbuf(NULL);   // writeBinaryFile chats on stdout
+	db.writeBinaryFile(binfile);
+	std::cout.rdbuf(saved);
+	
+	runBench("file/loadBinaryFile", nplots, nplots * DronePlot::getDataSize(), iters, [&]() { db.clear(); }, [&]() {
+		bench_sink += db.loadBinaryFile(binfile);
+	});
+	
+	// The database is still loaded from the last pass above
+	runBench("file/writeCSVFile", nplots, iters, [&]() {
+		bench_sink += db.writeCSVFile(binfile);
+	});
+	unlink(binfile);
+	
+	if (format != fmt_text) {
+		if (outfile.empty())
+			writeResults(std::cout);
+		else {
+			std::ofstream out(outfile);
+			if (!out.is_open()) {
+				std::cerr << "Unable to open '" << outfile << "' for writing.\n";
+				exit(-1);
+			}
+			writeResults(out);
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,598 @@
+/****************************************************************************************
+ * repcluster_main - load harness for the replication cluster. Generates a synthetic drone
+ *                   workload, starts N repsvr instances on loopback ports (each in its own
+ *                   directory with a shared servers.txt, key and whitelist), watches them
+ *                   through their metrics endpoints and reports how long the cluster took
+ *                   to converge, replication latency, bandwidth and CPU per node, and
+ *                   whether every node ended up with the same database.
+ *
+ ****************************************************************************************/
+
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <getopt.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "DronePlotDB.h"
+#include "FileDesc.h"
+
+using namespace std;
+
+// How often (milliseconds) to scrape every node's metrics
+const unsigned int poll_interval = 250;
+
+// How often (seconds) to print a progress line
+const double progress_interval = 5.0;
+
+struct workload_config {
+	unsigned int nodes = 3;
+	unsigned int drones = 20;
+	unsigned int duration = 120;    // Sim seconds of drone traffic
+	double rate = 1.0;              // Sightings per drone per sim second
+	double dup_rate = 0.2;          // Chance a sighting is also reported by a second node
+	std::vector<int> skews;         // Per node clock skew (sim seconds) added to its timestamps
+};
+
+// One repsvr instance and what we've seen of it
+struct node_info {
+	unsigned int id;
+	unsigned short port;
+	unsigned short metrics_port;
+	std::string dir;
+	DronePlotDB plots;              // This node's antenna feed
+	
+	pid_t pid = -1;
+	bool running = false;
+	double exit_time = 0;           // Seconds after launch
+	int status = 0;
+	rusage usage = {};
+	
+	// From the last successful scrape
+	uint64_t ingested = 0;
+	uint64_t replicated = 0;
+	uint64_t bytes_sent = 0;
+	uint64_t bytes_recv = 0;
+	std::vector<std::pair<double, uint64_t>> age_buckets;   // le, cumulative count
+};
+
+volatile sig_atomic_t interrupted = 0;
+
+void interruptHandler(int) {
+	interrupted = 1;
+}
+
+void displayHelp(const char *execname) {
+	std::cout << execname << " [options]\n";
+	std::cout << "   x: path to the repsvr executable (default: ./repsvr)\n";
+	std::cout << "   n: number of nodes to launch (default: 3)\n";
+	std::cout << "   D: number of drones (default: 20)\n";
+	std::cout << "   d: duration - sim seconds of drone traffic (default: 120)\n";
+	std::cout << "   r: sightings per drone per sim second (default: 1.0)\n";
+	std::cout << "   u: duplicate rate - chance a sighting is seen by a second node (default: 0.2)\n";
+	std::cout << "   s: comma separated clock skew per node in sim seconds, e.g. 0,3,-2 (default: none)\n";
+	std::cout << "   t: time multiplier passed to each repsvr (default: 1.0)\n";
+	std::cout << "   g: grace - real seconds the nodes keep running after the traffic ends (default: 20)\n";
+	std::cout << "   p: first replication port; node i uses port+i-1, its metrics port+1000+i-1 (default: 10000)\n";
+	std::cout << "   w: working directory for the node directories (default: a new /tmp/repcluster.XXXXXX)\n";
+	std::cout << "   S: random seed for the workload (default: 1)\n";
+}
+
+/*****************************************************************************************
+ * parseSkews - reads a comma separated list of integers
+ *
+ *    Throws: runtime_error if an entry isn't a number
+ *****************************************************************************************/
+
+void parseSkews(const char *list, std::vector<int> &skews) {
+	std::stringstream in(list);
+	std::string entry;
+	while (std::getline(in, entry, ',')) {
+		char *end;
+		long skew = strtol(entry.c_str(), &end, 10);
+		if ((end == entry.c_str()) || (*end != '\0'))
+			throw std::runtime_error("Invalid clock skew '" + entry + "'");
+		skews.push_back((int) skew);
+	}
+}
+
+/*****************************************************************************************
+ * genWorkload - builds each node's antenna feed. Every drone wanders on its own random walk
+ *               and is sighted rate times a sim second by one node, and with dup_rate
+ *               chance by a second node too (the duplicates the dedup pass has to find).
+ *               Each node's timestamps are shifted by its skew.
+ *
+ *    Returns: number of distinct sightings, which is what a converged database should hold
+ *****************************************************************************************/
+
+size_t genWorkload(const workload_config &config, std::vector<node_info> &nodes, unsigned int seed) {
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<unsigned int> pick_node(0, config.nodes - 1);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	std::uniform_real_distribution<float> start(-60.0, 60.0);
+	
+	// Steps are well over the dedup tolerance so consecutive sightings never look the same
+	std::uniform_real_distribution<float> step(0.0005, 0.005);
+	std::bernoulli_distribution sign(0.5);
+	
+	std::vector<std::pair<float, float>> position(config.drones);
+	for (auto &pos : position)
+		pos = {start(rng), start(rng)};
+	
+	size_t sightings = 0;
+	unsigned int total = (unsigned int) (config.duration * config.rate);
+	for (unsigned int i = 0; i < total; i++) {
+		time_t when = 1 + (time_t) (i / config.rate);
+		
+		for (unsigned int drone = 0; drone < config.drones; drone++) {
+			auto &pos = position[drone];
+			pos.first += sign(rng) ? step(rng) : -step(rng);
+			pos.second += sign(rng) ? step(rng) : -step(rng);
+			
+			unsigned int seen_by = pick_node(rng);
+			unsigned int also_seen_by = seen_by;
+			if ((config.nodes > 1) && (chance(rng) < config.dup_rate)) {
+				while (also_seen_by == seen_by)
+					also_seen_by = pick_node(rng);
+			}
+			
+			for (unsigned int node : {seen_by, also_seen_by}) {
+				node_info &info = nodes[node];
+				info.plots.addPlot(drone + 1, info.id, when + config.skews[node], pos.first, pos.second);
+				if (also_seen_by == seen_by)
+					break;
+			}
+			sightings++;
+		}
+	}
+	
+	return sightings;
+}
+
+/*****************************************************************************************
+ * writeFile - writes data to path, replacing whatever was there
+ *
+ *    Throws: runtime_error if the file can't be written
+ *****************************************************************************************/
+
+void writeFile(const std::string &path, const std::string &data) {
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open() || !out.write(data.data(), data.size()))
+		throw std::runtime_error("Unable to write " + path);
+}
+
+/*****************************************************************************************
+ * setupNodes - creates a directory per node holding everything repsvr looks for in its
+ *              working directory: servers.txt, sharedkey.bin, whitelist and the sim data
+ *
+ *    Throws: runtime_error if a directory or file can't be created
+ *****************************************************************************************/
+
+void setupNodes(const std::string &workdir, std::vector<node_info> &nodes) {
+	std::stringstream servers;
+	for (auto &node : nodes)
+		servers << "DS" << node.id << ", 127.0.0.1, " << node.port << "\n";
+	
+	std::random_device rd;
+	std::string key(16, '\0');
+	for (auto &byte : key)
+		byte = (char) (rd() & 0xFF);
+	
+	for (auto &node : nodes) {
+		node.dir = workdir + "/DS" + std::to_string(node.id);
+		if ((mkdir(node.dir.c_str(), 0755) != 0) && (errno != EEXIST))
+			throw std::runtime_error("Unable to create node directory " + node.dir + ": " + strerror(errno));
+		
+		writeFile(node.dir + "/servers.txt", servers.str());
+		writeFile(node.dir + "/sharedkey.bin", key);
+		writeFile(node.dir + "/whitelist", "127.0.0.1\n");
+		if (node.plots.writeBinaryFile((node.dir + "/sim.bin").c_str()) < 0)
+			throw std::runtime_error("Unable to write the sim data for " + node.dir);
+	}
+}
+
+/*****************************************************************************************
+ * launchNode - forks off a repsvr for the node, running in its directory with its output
+ *              going to repsvr.out there
+ *
+ *    Throws: runtime_error if the fork fails
+ *****************************************************************************************/
+
+void launchNode(node_info &node, const std::string &repsvr, float time_mult, unsigned int sim_time) {
+	std::vector<std::string> args = {repsvr, "sim.bin", "-a", "127.0.0.1", "-p", std::to_string(node.port),
+	                                 "-t", std::to_string(time_mult), "-d", std::to_string(sim_time),
+	                                 "-o", "replication_db.csv", "-e", "events.bin",
+	                                 "-m", std::to_string(node.metrics_port)};
+	
+	// Don't let the child inherit (and print again) whatever we haven't flushed yet
+	std::cout.flush();
+	fflush(stdout);
+	
+	pid_t pid = fork();
+	if (pid < 0)
+		throw std::runtime_error(std::string("Unable to fork a node: ") + strerror(errno));
+	
+	if (pid == 0) {
+		if (chdir(node.dir.c_str()) != 0)
+			_exit(127);
+		
+		FILE *out = freopen("repsvr.out", "w", stdout);
+		if ((out == NULL) || (dup2(fileno(stdout), STDERR_FILENO) < 0))
+			_exit(127);
+		
+		std::vector<char *> argv;
+		for (auto &arg : args)
+			argv.push_back(const_cast<char *>(arg.c_str()));
+		argv.push_back(NULL);
+		
+		execv(repsvr.c_str(), argv.data());
+		_exit(127);
+	}
+	
+	node.pid = pid;
+	node.running = true;
+}
+
+/*****************************************************************************************
+ * scrapeMetrics - fetches the node's /metrics page and picks out the counters and the plot
+ *                 age histogram we report on
+ *
+ *    Returns: false if the node didn't answer (not up yet, or already gone) or the page
+ *             didn't all arrive within a second
+ *****************************************************************************************/
+
+bool scrapeMetrics(node_info &node) {
+	SocketFD sock;
+	if (!sock.connectTo("127.0.0.1", node.metrics_port))
+		return false;
+	
+	sock.writeFD("GET /metrics HTTP/1.0\r\n\r\n");
+	
+	// The node closes the connection once the page is sent
+	std::string page;
+	char buf[4096];
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (true) {
+		int wait_ms = (int) std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		struct pollfd pfd = {sock.getFD(), POLLIN, 0};
+		if ((wait_ms <= 0) || (poll(&pfd, 1, wait_ms) <= 0))
+			return false;
+		
+		ssize_t got = read(sock.getFD(), buf, sizeof(buf));
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (got == 0)
+			break;
+		page.append(buf, got);
+	}
+	
+	// A page cut short would read as zero counters, so only take a complete one
+	size_t body = page.find("\r\n\r\n");
+	size_t length = page.find("Content-Length: ");
+	if ((page.compare(0, 12, "HTTP/1.0 200") != 0) || (body == std::string::npos) || (length == std::string::npos) || (length > body))
+		return false;
+	if (strtoull(page.c_str() + length + 16, NULL, 10) != page.size() - (body + 4))
+		return false;
+	
+	uint64_t ingested = 0, replicated = 0, sent = 0, recv = 0;
+	std::vector<std::pair<double, uint64_t>> buckets;
+	
+	std::stringstream lines(page);
+	std::string line;
+	while (std::getline(lines, line)) {
+		if (line.empty() || (line[0] == '#'))
+			continue;
+		
+		size_t space = line.rfind(' ');
+		if (space == std::string::npos)
+			continue;
+		std::string name = line.substr(0, line.find_first_of("{ "));
+		uint64_t value = strtoull(line.c_str() + space + 1, NULL, 10);
+		
+		if (name == "repl_plots_ingested_total")
+			ingested = value;
+		else if (name == "repl_plots_replicated_total")
+			replicated = value;
+		else if (name == "repl_peer_bytes_sent_total")
+			sent += value;
+		else if (name == "repl_peer_bytes_received_total")
+			recv += value;
+		else if (name == "repl_plot_age_seconds_bucket") {
+			size_t le = line.find("le=\"") + 4;
+			double limit = (line.compare(le, 4, "+Inf") == 0) ? HUGE_VAL : strtod(line.c_str() + le, NULL);
+			buckets.emplace_back(limit, value);
+		}
+	}
+	
+	node.ingested = ingested;
+	node.replicated = replicated;
+	node.bytes_sent = sent;
+	node.bytes_recv = recv;
+	node.age_buckets = std::move(buckets);
+	return true;
+}
+
+/*****************************************************************************************
+ * percentile - upper bound of the histogram bucket holding the pct'th sample
+ *
+ *    Returns: the bucket limit in seconds, HUGE_VAL if it's in the overflow bucket, or -1
+ *             if there are no samples
+ *****************************************************************************************/
+
+double percentile(const std::vector<std::pair<double, uint64_t>> &buckets, double pct) {
+	if (buckets.empty() || (buckets.back().second == 0))
+		return -1;
+	
+	uint64_t target = (uint64_t) std::ceil(pct * buckets.back().second);
+	for (auto &bucket : buckets) {
+		if (bucket.second >= target)
+			return bucket.first;
+	}
+	return buckets.back().first;
+}
+
+std::string fmtSeconds(double secs) {
+	if (secs < 0)
+		return "-";
+	if (std::isinf(secs))
+		return "overflow";
+	
+	std::stringstream out;
+	out << std::fixed << std::setprecision(3) << secs << "s";
+	return out.str();
+}
+
+
+int main(int argc, char *argv[]) {
+	workload_config config;
+	std::string repsvr = "./repsvr";
+	std::string workdir;
+	float time_mult = 1.0;
+	unsigned int grace = 20;
+	unsigned long base_port = 10000;
+	unsigned int seed = 1;
+	
+	try {
+		int c = 0;
+		while ((c = getopt(argc, argv, "x:n:D:d:r:u:s:t:g:p:w:S:")) != -1) {
+			switch (c) {
+				case 'x':
+					repsvr = optarg;
+					break;
+				case 'n':
+					config.nodes = (unsigned int) strtoul(optarg, NULL, 10);
+					break;
+				case 'D':
+					config.drones = (unsigned int) strtoul(optarg, NULL, 10);
+					break;
+				case 'd':
+					config.duration = (unsigned int) strtoul(optarg, NULL, 10);
+					break;
+				case 'r':
+					config.rate = strtod(optarg, NULL);
+					break;
+				case 'u':
+					config.dup_rate = strtod(optarg, NULL);
+					break;
+				case 's':
+					parseSkews(optarg, config.skews);
+					break;
+				case 't':
+					time_mult = strtof(optarg, NULL);
+					break;
+				case 'g':
+					grace = (unsigned int) strtoul(optarg, NULL, 10);
+					break;
+				case 'p':
+					base_port = strtoul(optarg, NULL, 10);
+					break;
+				case 'w':
+					workdir = optarg;
+					break;
+				case 'S':
+					seed = (unsigned int) strtoul(optarg, NULL, 10);
+					break;
+				default:
+					displayHelp(argv[0]);
+					exit(0);
+			}
+		}
+	} catch (std::runtime_error &e) {
+		std::cerr << e.what() << "\n";
+		exit(-1);
+	}
+	
+	// repsvr runs its sim for -d sim seconds (at most 1000), then sleeps 10 more real seconds
+	unsigned int sim_time = config.duration + (unsigned int) std::ceil(grace * time_mult);
+	if ((config.nodes == 0) || (config.drones == 0) || (config.duration == 0) || (config.rate <= 0.0) ||
+	    (config.dup_rate < 0.0) || (config.dup_rate > 1.0) || (time_mult <= 0.0) || (sim_time > 1000) ||
+	    (base_port == 0) || (base_port + 1000 + config.nodes > 65535) || (config.skews.size() > config.nodes)) {
+		std::cerr << "Invalid settings. The traffic plus grace period must fit in 1000 sim seconds, and there can't be more skews than nodes.\n";
+		displayHelp(argv[0]);
+		exit(-1);
+	}
+	config.skews.resize(config.nodes, 0);
+	
+	char resolved[PATH_MAX];
+	if (realpath(repsvr.c_str(), resolved) == NULL) {
+		std::cerr << "Unable to find repsvr at '" << repsvr << "'. Use -x to give its path.\n";
+		exit(-1);
+	}
+	repsvr = resolved;
+	
+	if (workdir.empty()) {
+		char tmpl[] = "/tmp/repcluster.XXXXXX";
+		if (mkdtemp(tmpl) == NULL) {
+			std::cerr << "Unable to create a working directory: " << strerror(errno) << "\n";
+			exit(-1);
+		}
+		workdir = tmpl;
+	} else if ((mkdir(workdir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+		std::cerr << "Unable to create working directory " << workdir << ": " << strerror(errno) << "\n";
+		exit(-1);
+	}
+	
+	std::vector<node_info> nodes(config.nodes);
+	for (unsigned int i = 0; i < config.nodes; i++) {
+		nodes[i].id = i + 1;
+		nodes[i].port = (unsigned short) (base_port + i);
+		nodes[i].metrics_port = (unsigned short) (base_port + 1000 + i);
+	}
+	
+	size_t sightings = genWorkload(config, nodes, seed);
+	size_t total_plots = 0;
+	for (auto &node : nodes)
+		total_plots += node.plots.size();
+	
+	std::cout << "Workload: " << config.nodes << " nodes, " << config.drones << " drones, " << config.duration << " sim secs, "
+	          << sightings << " sightings reported as " << total_plots << " plots\n";
+	std::cout << "Node directories in " << workdir << "\n";
+	
+	try {
+		setupNodes(workdir, nodes);
+	} catch (std::runtime_error &e) {
+		std::cerr << e.what() << "\n";
+		exit(-1);
+	}
+	
+	signal(SIGINT, interruptHandler);
+	signal(SIGTERM, interruptHandler);
+	
+	auto launched = std::chrono::steady_clock::now();
+	auto elapsed = [&launched]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - launched).count(); };
+	
+	for (auto &node : nodes) {
+		try {
+			launchNode(node, repsvr, time_mult, sim_time);
+		} catch (std::runtime_error &e) {
+			std::cerr << e.what() << "\n";
+			interrupted = 1;
+			break;
+		}
+	}
+	
+	// Watch the cluster until every node has exited. Ingest is done once every node has queued
+	// all of its antenna's plots for replication; the cluster has converged once every node has
+	// also applied every plot the others sent
+	double ingest_done = -1, converged = -1, last_progress = 0;
+	bool killed = false;
+	unsigned int running = std::count_if(nodes.begin(), nodes.end(), [](const node_info &node) { return node.running; });
+	while (running > 0) {
+		if (interrupted && !killed) {
+			std::cerr << "Interrupted, stopping the nodes.\n";
+			for (auto &node : nodes) {
+				if (node.running)
+					kill(node.pid, SIGTERM);
+			}
+			killed = true;
+		}
+		
+		for (auto &node : nodes) {
+			if (!node.running)
+				continue;
+			
+			scrapeMetrics(node);
+			if (wait4(node.pid, &node.status, WNOHANG, &node.usage) == node.pid) {
+				node.running = false;
+				node.exit_time = elapsed();
+				running--;
+			}
+		}
+		
+		bool all_ingested = true, all_replicated = true;
+		uint64_t ingested = 0, replicated = 0;
+		for (auto &node : nodes) {
+			all_ingested &= (node.ingested >= node.plots.size());
+			all_replicated &= (node.replicated >= total_plots - node.plots.size());
+			ingested += node.ingested;
+			replicated += node.replicated;
+		}
+		
+		double now = elapsed();
+		if ((ingest_done < 0) && all_ingested)
+			ingest_done = now;
+		if ((converged < 0) && all_ingested && all_replicated)
+			converged = now;
+		
+		if (now - last_progress >= progress_interval) {
+			std::cout << std::fixed << std::setprecision(1) << std::setw(7) << now << "s  ingested " << ingested << "/" << total_plots
+			          << ", applied " << replicated << "/" << total_plots * (config.nodes - 1) << "\n";
+			last_progress = now;
+		}
+		
+		usleep(poll_interval * 1000);
+	}
+	
+	// Results
+	std::cout << "\nConvergence:\n";
+	std::cout << "  all plots ingested:  " << fmtSeconds(ingest_done) << " after launch\n";
+	if (converged < 0)
+		std::cout << "  cluster never converged before the nodes exited\n";
+	else
+		std::cout << "  cluster converged:   " << fmtSeconds(converged) << " after launch, " << fmtSeconds(converged - ingest_done)
+		          << " after the last plot was ingested\n";
+	
+	std::vector<std::pair<double, uint64_t>> ages;
+	for (auto &node : nodes) {
+		if (ages.empty())
+			ages = node.age_buckets;
+		else if (node.age_buckets.size() == ages.size()) {
+			for (size_t i = 0; i < ages.size(); i++)
+				ages[i].second += node.age_buckets[i].second;
+		}
+	}
+	std::cout << "\nReplication latency (plot age on arrival, to histogram bucket resolution; includes clock skew):\n";
+	std::cout << "  samples " << (ages.empty() ? 0 : ages.back().second) << "  p50 " << fmtSeconds(percentile(ages, 0.5))
+	          << "  p90 " << fmtSeconds(percentile(ages, 0.9)) << "  p99 " << fmtSeconds(percentile(ages, 0.99))
+	          << "  max " << fmtSeconds(percentile(ages, 1.0)) << "\n";
+	
+	std::cout << "\nPer node:\n";
+	std::string reference;
+	bool identical = true;
+	for (auto &node : nodes) {
+		double cpu = node.usage.ru_utime.tv_sec + node.usage.ru_utime.tv_usec / 1e6 + node.usage.ru_stime.tv_sec + node.usage.ru_stime.tv_usec / 1e6;
+		double lifetime = std::max(node.exit_time, 0.001);
+		
+		std::cout << "  DS" << node.id << ": " << node.plots.size() << " local plots, ";
+		if (WIFEXITED(node.status))
+			std::cout << "exit " << WEXITSTATUS(node.status);
+		else if (WIFSIGNALED(node.status))
+			std::cout << "killed by signal " << WTERMSIG(node.status);
+		std::cout << std::fixed << std::setprecision(1) << ", cpu " << std::setprecision(2) << cpu << "s (" << std::setprecision(1)
+		          << 100.0 * cpu / lifetime << "%), max rss " << node.usage.ru_maxrss << " KB\n";
+		std::cout << "        sent " << node.bytes_sent << " bytes (" << node.bytes_sent / lifetime / 1024.0 << " KB/s), received "
+		          << node.bytes_recv << " bytes (" << node.bytes_recv / lifetime / 1024.0 << " KB/s)\n";
+		
+		std::ifstream db(node.dir + "/replication_db.csv", std::ios::binary);
+		std::string contents((std::istreambuf_iterator<char>(db)), std::istreambuf_iterator<char>());
+		size_t rows = std::count(contents.begin(), contents.end(), '\n');
+		std::cout << "        final database: " << rows << " plots (" << sightings << " distinct sightings generated)\n";
+		
+		if (&node == &nodes.front())
+			reference = std::move(contents);
+		else if (contents != reference)
+			identical = false;
+	}
+	
+	std::cout << "\nFinal databases " << (identical ? "are identical" : "DIFFER") << " across nodes. Logs and event logs (see evtdump) are in "
+	          << workdir << "\n";
+	
+	return ((converged >= 0) && identical) ? 0 : 1;
+}
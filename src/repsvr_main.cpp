@@ -10,10 +10,14 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include <getopt.h>
 #include <pthread.h>
+#include <csignal>
 #include "DronePlotDB.h"
 #include "AntennaSim.h"
+#include "SimClock.h"
 #include "strfuncts.h"
 #include "ReplServer.h"
 
@@ -47,22 +51,48 @@ void *t_simulator(void *data) {
 void *t_replserver(void *data) {
 	ReplServer *rs_ptr = static_cast<ReplServer *>(data);
 	
-	rs_ptr->replicate();
+	// The sim still runs to the end without us, so the local database gets written out
+	try {
+		rs_ptr->replicate();
+	} catch (std::exception &e) {
+		std::cerr << "Replication server stopped: " << e.what() << "\n";
+	}
 	return NULL;
 }
 
+/*****************************************************************************************
+ * reloadHandler - SIGHUP handler, asks the replication server to re-read servers.txt
+ *****************************************************************************************/
+
+void reloadHandler(int) {
+	QueueMgr::requestReload();
+}
+
 /*****************************************************************************************
  * displayHelp - Shows command line parameters to the user.
  *****************************************************************************************/
 
 void displayHelp(const char *execname) {
-	std::cout << execname << " <sim_data>\n";
+	std::cout << execname << " <sim_data> [<sim_data> ...]\n";
+	std::cout << "   Each sim_data file is one antenna feed; all feeds inject concurrently\n";
 	std::cout << "   a: IP address to bind the server to (default: 127.0.0.1)\n";
 	std::cout << "   p: Port to bind the server to (default: 9999)\n";
 	std::cout << "   t: time multiplier - t=2.0 runs the sim at 2x speed\n";
 	std::cout << "   o: the file to write the DB dump CSV to (default: replication_db.cv)\n";
 	std::cout << "   d: duration - seconds in \"sim time\" to run the sim\n";
 	std::cout << "   v: verbosity - how much information to send to stdout (0-3, 3=max)\n";
+	std::cout << "   b: batch size - replicate as soon as this many new plots are waiting (default: 64)\n";
+	std::cout << "   l: latency - max sim seconds a new plot waits before being replicated (default: 2.0)\n";
+	std::cout << "   e: event log - record connection/replication events to this binary file (see evtdump)\n";
+	std::cout << "   m: metrics port - serve Prometheus metrics at http://<ip>:<port>/metrics\n";
+	std::cout << "   c: clock - real (whole seconds, default), scaled (sub-second) or virtual (skips ahead\n";
+	std::cout << "      to the next inject or replication deadline, as fast as the CPU allows)\n";
+	std::cout << "   g: generated antenna feed - <node_id>:<drones>[:<plots per drone per sec>] (default rate 1.0),\n";
+	std::cout << "      adds a feed of synthetic traffic for the whole duration. Can be given more than once\n";
+	std::cout << "   r: retention - <horizon secs>[:<archive dir>], moves plots older than the horizon (sim secs,\n";
+	std::cout << "      at least 60) into compressed hourly files in the archive dir (default: plot_archive). Off\n";
+	std::cout << "      by default. The output CSV then only holds the plots still inside the horizon\n";
+	std::cout << "Send SIGHUP (or just edit servers.txt) to reload the server list while running\n";
 }
 
 
@@ -75,22 +105,39 @@ int main(int argc, char *argv[]) {
 	std::string ip_addr = "127.0.0.1";
 	unsigned short port = 9999;
 	
+	// When to flush replication batches - whichever of these is hit first
+	ReplScheduler::Config sched_config;
+	
 	// Filename to write the replication output
 	std::string outfile("replication_db.csv");
-	std::string simdata_file;
+	std::vector<std::string> simdata_files;
+	
+	// Generated antenna feeds: node ID, drones, rate
+	struct gen_feed {
+		unsigned int node_id;
+		unsigned int drones;
+		double rate;
+	};
+	std::vector<gen_feed> gen_feeds;
+	char *end;
+	std::string eventlog_file;
+	unsigned short metrics_port = 0;
+	std::string clock_type = "real";
+	double retention = 0.0;
+	std::string archive_dir = "plot_archive";
 	
 	// Get the command line arguments and set params appropriately
-	// The - at the beginning of our getopt optstring means that the inject database file
+	// The - at the beginning of our getopt optstring means that the inject database files
 	// will appear in case 1
 	unsigned long portval;
 	int c = 0;
-	while ((c = getopt(argc, argv, "-o:t:v:d:p:a:")) != -1) {
+	while ((c = getopt(argc, argv, "-o:t:v:d:p:a:b:l:e:m:c:g:r:")) != -1) {
 		fprintf(stdout, "%d\n", c);
 		switch (c) {
 			
-			// The inject database file specified in the command line
+			// An inject database file specified in the command line
 			case 1:
-				simdata_file = optarg;
+				simdata_files.push_back(optarg);
 				break;
 				
 				// Set the max number to count up to
@@ -141,6 +188,71 @@ int main(int argc, char *argv[]) {
 			case 'o':
 				outfile = optarg;
 				break;
+				
+				// Replication batch size threshold
+			case 'b':
+				sched_config.batch_size = (unsigned int) strtol(optarg, NULL, 10);
+				if (sched_config.batch_size < 1) {
+					std::cerr << "Invalid batch size. Must be >= 1\n";
+					exit(0);
+				}
+				break;
+				
+				// Replication latency deadline
+			case 'l':
+				sched_config.max_latency = strtod(optarg, NULL);
+				if ((sched_config.max_latency < sched_config.min_interval) || (sched_config.max_latency > sched_config.max_interval)) {
+					std::cerr << "Invalid latency. Range: " << sched_config.min_interval << " to " << sched_config.max_interval << "\n";
+					exit(0);
+				}
+				break;
+			
+				// Binary event log
+			case 'e':
+				eventlog_file = optarg;
+				break;
+				
+				// Metrics HTTP port
+			case 'm':
+				portval = strtol(optarg, NULL, 10);
+				if ((portval < 1) || (portval > 65535)) {
+					std::cerr << "Invalid metrics port. Value must be between 1 and 65535\n";
+					exit(0);
+				}
+				metrics_port = (unsigned short) portval;
+				break;
+				
+				// Sim clock
+			case 'c':
+				clock_type = optarg;
+				break;
+				
+				// Generated antenna feed
+			case 'g': {
+				gen_feed feed;
+				feed.node_id = (unsigned int) strtoul(optarg, &end, 10);
+				feed.drones = (*end == ':') ? (unsigned int) strtoul(end + 1, &end, 10) : 0;
+				feed.rate = (*end == ':') ? strtod(end + 1, &end) : 1.0;
+				if ((*end != '\0') || (feed.drones == 0) || (feed.rate <= 0.0)) {
+					std::cerr << "Invalid generated feed. Format: <node_id>:<drones>[:<rate>]\n";
+					exit(0);
+				}
+				gen_feeds.push_back(feed);
+				break;
+			}
+			
+				// Retention horizon and archive directory
+			case 'r':
+				retention = strtod(optarg, &end);
+				if (*end == ':')
+					archive_dir = end + 1;
+				else if (*end != '\0')
+					retention = 0.0;
+				if ((retention < 60.0) || archive_dir.empty()) {
+					std::cerr << "Invalid retention. Format: <horizon secs>[:<archive dir>], horizon at least 60\n";
+					exit(0);
+				}
+				break;
 			
 			case '?':
 				displayHelp(argv[0]);
@@ -154,38 +266,72 @@ int main(int argc, char *argv[]) {
 		
 	}
 	
-	if (simdata_file.size() == 0) {
-		std::cerr << "You must specify the sim_data inject database file.\n";
+	if (simdata_files.empty() && gen_feeds.empty()) {
+		std::cerr << "You must specify a sim_data inject database file or a generated feed.\n";
 		displayHelp(argv[0]);
 		exit(0);
 	}
 	
 	DronePlotDB db;
 	
-	// Kick off the simulation thread by creating the sim management object
-	// This will raise a runtime_exception if the simdata database load fails
-	AntennaSim sim(db, simdata_file.c_str(), time_mult, verbosity);
+	// The sim clock the antenna and the replication server share. We count as one of its
+	// users until the sim is over, so a virtual clock can't run ahead while we set up
+	std::unique_ptr<SimClock> clock;
+	try {
+		clock = SimClock::create(clock_type, time_mult);
+	} catch (std::runtime_error &e) {
+		std::cerr << e.what() << "\n";
+		exit(0);
+	}
+	clock->join();
+	clock->start(AntennaSim::startup_delay * time_mult);
+	
+	// Kick off the simulation thread by creating the sim management object, with a feed per
+	// antenna. This will raise a runtime_exception if a simdata database load fails
+	AntennaSim sim(db, *clock, verbosity);
+	for (auto &file : simdata_files)
+		sim.loadSourceDB(file.c_str());
+	for (auto &feed : gen_feeds)
+		sim.addGeneratedFeed(feed.node_id, feed.drones, feed.rate, sim_time);
 	
 	// Launch the thread
 	pthread_t simthread;
 	if (pthread_create(&simthread, NULL, t_simulator, (void *) &sim) != 0)
 		throw std::runtime_error("Unable to create simulator thread");
 	
+	// Pick up servers.txt edits without a restart
+	signal(SIGHUP, reloadHandler);
+	
 	// Start the replication server
-	ReplServer repl_server(db, ip_addr.c_str(), port, time_mult, verbosity);
+	ReplServer repl_server(db, *clock, ip_addr.c_str(), port, verbosity);
+	repl_server.configureScheduler(sched_config);
+	if (eventlog_file.size() > 0)
+		repl_server.openEventLog(eventlog_file.c_str());
+	if (metrics_port != 0)
+		repl_server.serveMetrics(metrics_port);
+	if (retention > 0.0) {
+		try {
+			repl_server.configureRetention(retention, archive_dir.c_str());
+		} catch (std::runtime_error &e) {
+			std::cerr << e.what() << "\n";
+			exit(0);
+		}
+	}
 	
 	pthread_t replthread;
 	if (pthread_create(&replthread, NULL, t_replserver, (void *) &repl_server) != 0)
 		throw std::runtime_error("Unable to create replication server thread");
 	
-	// Sleep the duration of the simulation
-	sleep(sim_time / time_mult + 10);
+	// Sleep the duration of the simulation, plus 10 real seconds (at the time multiplier) to let
+	// the last replication finish
+	clock->sleepUntil(sim_time + 10.0 * time_mult);
 	
 	// Stop the replication server
 	repl_server.shutdown();
 	
 	// Stop the thread
 	sim.terminate();
+	clock->leave();
 	
 	// Wait until the thread has exited
 	pthread_join(simthread, NULL);
@@ -194,7 +340,11 @@ int main(int argc, char *argv[]) {
 	// Write the replication database to a CSV file
 	std::cout << "Writing results to: " << outfile << "\n";
 	db.sortByTime();
-	db.writeCSVFile(outfile.c_str());
+	int written = db.writeCSVFile(outfile.c_str());
+	if (written < 0)
+		std::cerr << "Unable to write " << outfile << "\n";
+	else if (verbosity >= 1)
+		std::cout << "Wrote " << written << " plots.\n";
 	
 	return 0;
 }